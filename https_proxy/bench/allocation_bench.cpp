@@ -0,0 +1,139 @@
+// Checks that relaying a chunk through a tunnel allocates nothing once the tunnel is warmed up. Runs a shard of the
+// proxy in process and opens a CONNECT tunnel through it on loopback, then bounces chunks between the client and the
+// upstream ends, counting every allocation made by the process while the chunks are relayed. Each relay is checked
+// in turn, and the run fails if any of them allocates on the steady-state path.
+// Usage: ./allocation_bench [CHUNKS]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "connection.hpp"
+#include "context.hpp"
+#include "shard.hpp"
+#include "uring_relay.hpp"
+
+#define DEFAULT_CHUNKS 10000
+#define WARMUP_CHUNKS 1000
+#define CHUNK_SIZE 4096
+#define CONNECTION_ESTABLISHED "HTTP/1.1 200 Connection established\r\n\r\n"
+#define TEARDOWN_TIMEOUT std::chrono::seconds(5)
+#define TEARDOWN_POLL_INTERVAL std::chrono::milliseconds(10)
+
+// Every allocation made through operator new is counted, then served by malloc. GCC takes the replaced operators
+// for its builtins and warns about memory freed with free.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *pointer = malloc(size > 0 ? size : 1);
+  if (!pointer) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  free(pointer);
+}
+
+// Sends a chunk from one end of the tunnel and reads it at the other, in both directions.
+static void bounce(boost::asio::ip::tcp::socket &client, boost::asio::ip::tcp::socket &upstream,
+  std::vector<char> &chunk) {
+  boost::asio::write(client, boost::asio::buffer(chunk));
+  boost::asio::read(upstream, boost::asio::buffer(chunk));
+  boost::asio::write(upstream, boost::asio::buffer(chunk));
+  boost::asio::read(client, boost::asio::buffer(chunk));
+}
+
+// Returns the allocations per relayed chunk, or a negative value if the tunnel could not be set up or torn down.
+static double measure(RelayMode relay_mode, size_t chunks) {
+  ctx.relay_mode = relay_mode;
+  Shard shard(0);
+  boost::asio::ip::tcp::endpoint loopback(boost::asio::ip::address_v4::loopback(), 0);
+  shard.acceptor.open(loopback.protocol());
+  shard.acceptor.bind(loopback);
+  shard.acceptor.listen();
+  boost::asio::io_context io;
+  boost::asio::ip::tcp::acceptor upstream_acceptor(io, loopback);
+  std::thread runner([&shard]() { shard.run(false); });
+
+  boost::asio::ip::tcp::socket client(io);
+  client.connect(shard.acceptor.local_endpoint());
+  std::shared_ptr<boost::asio::ip::tcp::socket> accepted =
+    std::make_shared<boost::asio::ip::tcp::socket>(shard.acceptor.accept());
+  boost::asio::post(shard.io, [accepted, &shard]() {
+    ctx.admission.acquire(TUNNEL_SLOT);
+    ctx.admission.acquire(HANDSHAKE_SLOT);
+    Connection::create(std::move(*accepted), shard)->start_handshake();
+  });
+  std::string request = "CONNECT 127.0.0.1:" + std::to_string(upstream_acceptor.local_endpoint().port()) +
+    " HTTP/1.1\r\n\r\n";
+  boost::asio::write(client, boost::asio::buffer(request));
+  boost::asio::ip::tcp::socket upstream = upstream_acceptor.accept();
+  std::string response(strlen(CONNECTION_ESTABLISHED), '\0');
+  boost::asio::read(client, boost::asio::buffer(&response[0], response.size()));
+
+  std::vector<char> chunk(CHUNK_SIZE, 'x');
+  for (size_t i = 0; i < WARMUP_CHUNKS; i++) {
+    bounce(client, upstream, chunk);
+  }
+  uint64_t before = allocations.load();
+  for (size_t i = 0; i < chunks; i++) {
+    bounce(client, upstream, chunk);
+  }
+  uint64_t counted = allocations.load() - before;
+
+  client.close();
+  upstream.close();
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + TEARDOWN_TIMEOUT;
+  while (ctx.admission.statistics().tunnels > 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(TEARDOWN_POLL_INTERVAL);
+  }
+  bool destroyed = ctx.admission.statistics().tunnels == 0;
+  shard.io.stop();
+  runner.join();
+  if (response != CONNECTION_ESTABLISHED || !destroyed) {
+    return -1;
+  }
+  return static_cast<double>(counted) / (2 * chunks);
+}
+
+int main(int argc, char * argv[]) {
+  size_t chunks = argc > 1 ? atol(argv[1]) : DEFAULT_CHUNKS;
+  ctx.logger.set_logging_level(ERROR);
+  ctx.resolver.start();
+  std::vector<std::pair<RelayMode, std::string>> relays = {{COPY_RELAY, "copy"}, {SPLICE_RELAY, "splice"}};
+  if (UringRelay::is_supported()) {
+    relays.push_back({URING_RELAY, "uring"});
+  }
+  bool passed = true;
+  printf("%-10s %24s\n", "relay", "allocations per chunk");
+  for (const std::pair<RelayMode, std::string> &relay : relays) {
+    double per_chunk = measure(relay.first, chunks);
+    if (per_chunk < 0) {
+      printf("%-10s %24s\n", relay.second.c_str(), "tunnel failed");
+    } else {
+      printf("%-10s %24.4f\n", relay.second.c_str(), per_chunk);
+    }
+    passed = passed && per_chunk == 0;
+  }
+  ctx.resolver.stop();
+  ctx.logger.close();
+  return passed ? 0 : 1;
+}
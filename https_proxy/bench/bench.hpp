@@ -0,0 +1,133 @@
+#ifndef HTTPS_PROXY_BENCH_HPP_
+#define HTTPS_PROXY_BENCH_HPP_
+
+#include <sched.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define BENCH_REPETITIONS 15
+#define BENCH_SAMPLE_DURATION std::chrono::milliseconds(40)
+#define BENCH_WARMUP_DURATION std::chrono::milliseconds(200)
+// Smallest change called out when comparing runs, below which runs of the same build differ on a busy machine.
+#define BENCH_MIN_CHANGE 0.05
+
+// Cost of one operation, as the median of the repetitions, and the median absolute deviation of the repetitions
+// relative to it.
+struct BenchResult {
+  std::string name;
+  double nanoseconds;
+  double spread;
+};
+
+// Keeps the compiler from discarding the operations being measured.
+static volatile size_t bench_sink;
+
+// Number of checks made with expect that failed.
+static int bench_failures;
+
+// Prints the outcome of a check and counts it if it failed.
+inline void expect(bool condition, const char *description) {
+  printf("%-60s %s\n", description, condition ? "ok" : "FAILED");
+  bench_failures += !condition;
+}
+
+// Keeps the process on the CPU it started on, so that samples are not disturbed by migrations. Threads started
+// afterwards share that CPU.
+inline void pin_to_current_cpu() {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(sched_getcpu(), &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+#endif
+}
+
+// Runs the operation, which returns a value folded into bench_sink, first doubling the number of iterations per
+// sample until a sample lasts BENCH_SAMPLE_DURATION and the warm up has elapsed, then measuring BENCH_REPETITIONS
+// samples. Each call may perform several operations, given by batch.
+template <typename Operation>
+BenchResult run_benchmark(const std::string &name, size_t batch, Operation operation) {
+  typedef std::chrono::steady_clock Clock;
+  size_t iterations = 1;
+  size_t result = 0;
+  Clock::time_point warmup_end = Clock::now() + BENCH_WARMUP_DURATION;
+  while (true) {
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      result += operation();
+    }
+    if (Clock::now() - start >= BENCH_SAMPLE_DURATION && Clock::now() >= warmup_end) {
+      break;
+    }
+    if (Clock::now() - start < BENCH_SAMPLE_DURATION) {
+      iterations *= 2;
+    }
+  }
+  std::vector<double> samples;
+  for (int repetition = 0; repetition < BENCH_REPETITIONS; repetition++) {
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      result += operation();
+    }
+    samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (iterations * batch));
+  }
+  bench_sink += result;
+  std::sort(samples.begin(), samples.end());
+  double median = samples[BENCH_REPETITIONS / 2];
+  std::vector<double> deviations;
+  for (double sample : samples) {
+    deviations.push_back(std::fabs(sample - median));
+  }
+  std::sort(deviations.begin(), deviations.end());
+  return {name, median, median > 0 ? deviations[BENCH_REPETITIONS / 2] / median : 0};
+}
+
+// Prints a result as "NAME NANOSECONDS SPREAD", the format read back by read_results.
+inline void print_result(const BenchResult &result) {
+  printf("%-40s %12.2f ns %8.2f %%\n", result.name.c_str(), result.nanoseconds, 100 * result.spread);
+}
+
+// Reads results printed by an earlier run, e.g. of another build, skipping lines that are not results.
+inline std::map<std::string, BenchResult> read_results(const std::string &path) {
+  std::map<std::string, BenchResult> results;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    BenchResult result;
+    std::string unit;
+    std::string percent;
+    if (fields >> result.name >> result.nanoseconds >> unit >> result.spread >> percent && unit == "ns") {
+      result.spread /= 100;
+      results[result.name] = result;
+    }
+  }
+  return results;
+}
+
+// Prints the change of each result against the baseline. A change is only called out as faster or slower when it
+// exceeds BENCH_MIN_CHANGE and three times the combined spread of both runs.
+inline void compare_results(const std::vector<BenchResult> &results, const std::map<std::string, BenchResult> &baseline) {
+  printf("\n%-40s %12s %12s %9s\n", "", "baseline ns", "ns", "change");
+  for (const BenchResult &result : results) {
+    std::map<std::string, BenchResult>::const_iterator before = baseline.find(result.name);
+    if (before == baseline.end()) {
+      continue;
+    }
+    double change = result.nanoseconds / before->second.nanoseconds - 1;
+    double noise = std::max(BENCH_MIN_CHANGE, 3 * (result.spread + before->second.spread));
+    const char *verdict = change < -noise ? "faster" : change > noise ? "slower" : "";
+    printf("%-40s %12.2f %12.2f %+8.1f%% %s\n", result.name.c_str(), before->second.nanoseconds, result.nanoseconds,
+      100 * change, verdict);
+  }
+}
+
+#endif  // HTTPS_PROXY_BENCH_HPP_
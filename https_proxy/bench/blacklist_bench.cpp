@@ -0,0 +1,102 @@
+// Compares the throughput of Blacklist::is_blocked against the linear scan it replaced.
+// Usage: ./blacklist_bench [ENTRY_COUNT ...]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "blacklist.hpp"
+
+#define QUERY_COUNT 10000
+#define MIN_DURATION std::chrono::milliseconds(300)
+#define SEED 3103
+
+// Keeps the compiler from discarding the lookups being measured.
+static volatile size_t sink;
+
+static const char *const ALPHABET = "abcdefghijklmnopqrstuvwxyz0123456789-";
+
+static std::string random_label(std::mt19937 &generator, size_t length) {
+  std::uniform_int_distribution<int> character(0, 36);
+  std::string label;
+  for (size_t i = 0; i < length; i++) {
+    label.push_back(ALPHABET[character(generator)]);
+  }
+  return label;
+}
+
+static bool linear_scan(const std::vector<std::string> &entries, const std::string &hostname) {
+  for (const std::string &entry : entries) {
+    if (hostname.find(entry) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Repeats the full set of queries until MIN_DURATION has elapsed and returns the number of lookups per second.
+template <typename Lookup>
+static double measure(const std::vector<std::string> &queries, Lookup lookup) {
+  size_t lookups = 0;
+  size_t blocked = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (const std::string &query : queries) {
+      blocked += lookup(query);
+    }
+    lookups += queries.size();
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  sink += blocked;
+  return lookups / std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char * argv[]) {
+  std::vector<size_t> sizes = {10, 1000, 100000};
+  if (argc > 1) {
+    sizes.clear();
+    for (int i = 1; i < argc; i++) {
+      sizes.push_back(atol(argv[i]));
+    }
+  }
+  printf("%10s %14s %14s %14s %14s %10s\n", "entries", "linear/s", "automaton/s", "blacklist/s", "speedup", "states");
+  for (size_t size : sizes) {
+    std::mt19937 generator(SEED);
+    std::uniform_int_distribution<int> length(5, 14);
+    std::unique_ptr<std::vector<std::string>> entries = std::make_unique<std::vector<std::string>>();
+    for (size_t i = 0; i < size; i++) {
+      entries->push_back(random_label(generator, length(generator)) + (i % 2 == 0 ? ".com" : ""));
+    }
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < QUERY_COUNT; i++) {
+      if (i % 10 == 0) {
+        queries.push_back("www." + (*entries)[generator() % size] + ".example");
+      } else {
+        queries.push_back("www." + random_label(generator, length(generator)) + ".example.com");
+      }
+    }
+    std::vector<std::string> patterns = *entries;
+    AhoCorasick automaton(patterns);
+    std::unique_ptr<Blacklist> blacklist = std::make_unique<Blacklist>();
+    blacklist->add_entries(std::move(entries));
+
+    for (const std::string &query : queries) {
+      bool expected = linear_scan(patterns, query);
+      if (automaton.matches(query) != expected || blacklist->is_blocked(query) != expected) {
+        printf("Verdict mismatch for %s\n", query.c_str());
+        return 1;
+      }
+    }
+    double linear = measure(queries, [&patterns](const std::string &query) { return linear_scan(patterns, query); });
+    double compiled = measure(queries, [&automaton](const std::string &query) { return automaton.matches(query); });
+    double cached = measure(queries, [&blacklist](const std::string &query) { return blacklist->is_blocked(query); });
+    printf("%10zu %14.0f %14.0f %14.0f %13.1fx %10zu\n", size, linear, compiled, cached, cached / linear,
+      automaton.state_count());
+  }
+  return 0;
+}
@@ -0,0 +1,242 @@
+// Checks that BodyFramer finds the end of every body however its bytes are split across reads: chunked bodies with
+// extensions and trailers split at every byte boundary and fed one byte at a time, and Content-Length bodies followed
+// by a pipelined request. Checks that HttpHead rejects request bodies whose end is ambiguous and broken chunk sizes,
+// and gives no body to HEAD, 1xx, 204 and 304 responses. Then measures how fast a chunked body is followed.
+// Usage: ./http_message_bench [RANDOM_BODY_COUNT]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "http_message.hpp"
+
+#define DEFAULT_RANDOM_BODIES 200
+#define MIN_DURATION std::chrono::milliseconds(300)
+#define SEED 3103
+#define PIPELINED_REQUEST "GET /next HTTP/1.1\r\nHost: example.com\r\n\r\n"
+
+// Keeps the compiler from discarding the bodies being followed.
+static volatile size_t sink;
+
+static size_t failures;
+
+static const std::vector<std::string> EXTENSIONS = {"", ";name=value", ";a", " ;b=\"quoted;value\"", "\t;c"};
+static const std::vector<std::string> TRAILERS = {"", "Checksum: 1234\r\n", "A: b\r\nExpires: never\r\n"};
+
+struct FramingCase {
+  const char *head;
+  bool head_request;
+  bool accepted;
+  BodyFraming framing;
+  uint64_t length;
+};
+
+// Requests whose body cannot be delimited are rejected, while responses fall back to reading until the server closes.
+static const std::vector<FramingCase> FRAMING_CASES = {
+  {"POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n", false, true, LENGTH_BODY, 5},
+  {"POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n", false, true, NO_BODY, 0},
+  {"GET / HTTP/1.1\r\nHost: a\r\n\r\n", false, true, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", false, true, CHUNKED_BODY, 0},
+  {"POST / HTTP/1.1\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n", false, true, CHUNKED_BODY, 0},
+  {"POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n", false, true, LENGTH_BODY, 5},
+  {"POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nContent-Length: 1 2\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nContent-Length: 0x10\r\n\r\n", false, false, NO_BODY, 0},
+  {"POST / HTTP/1.1\r\nContent-Length: 1234567890123456789\r\n\r\n", false, false, NO_BODY, 0},
+  {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n", false, true, LENGTH_BODY, 5},
+  {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", false, true, CHUNKED_BODY, 0},
+  {"HTTP/1.1 200 OK\r\n\r\n", false, true, CLOSE_DELIMITED_BODY, 0},
+  {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n", false, true, CHUNKED_BODY, 0},
+  {"HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip\r\n\r\n", false, true, CLOSE_DELIMITED_BODY, 0},
+  {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n", false, true, CLOSE_DELIMITED_BODY, 0},
+  {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n", true, true, NO_BODY, 0},
+  {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", true, true, NO_BODY, 0},
+  {"HTTP/1.1 100 Continue\r\n\r\n", false, true, NO_BODY, 0},
+  {"HTTP/1.1 204 No Content\r\nContent-Length: 5\r\n\r\n", false, true, NO_BODY, 0},
+  {"HTTP/1.1 304 Not Modified\r\nContent-Length: 5\r\n\r\n", false, true, NO_BODY, 0},
+  {"HTTP/1.1 304 Not Modified\r\nTransfer-Encoding: chunked\r\n\r\n", false, true, NO_BODY, 0},
+};
+
+// Chunked bodies the framer must stop at, as far as the byte that breaks them.
+static const std::vector<std::string> BROKEN_CHUNKED_BODIES = {
+  "g\r\n", "\r\n", ";a\r\n", " 5\r\nhello\r\n", "5\nhello", "5\r\rhello", "5\r\nhelloX\r\n", "5\r\nhello\r\r",
+  "10000000000000000\r\n", "5;a\n", "0\r\nTrailer\r\r", "0\r\n\rX",
+};
+
+static void report(const char *description, const std::string &text) {
+  if (failures++ < 10) {
+    std::string escaped;
+    for (char c : text.substr(0, 120)) {
+      escaped += c == '\r' ? "\\r" : c == '\n' ? "\\n" : std::string(1, c);
+    }
+    printf("%s: \"%s\"\n", description, escaped.c_str());
+  }
+}
+
+static std::string random_chunked_body(std::mt19937 &generator) {
+  std::string body;
+  for (int chunks = generator() % 5; chunks > 0; chunks--) {
+    size_t size = 1 + generator() % 300;
+    char digits[32];
+    snprintf(digits, sizeof(digits), generator() % 2 ? "%zx" : "%03zX", size);
+    body.append(digits).append(EXTENSIONS[generator() % EXTENSIONS.size()]).append("\r\n");
+    for (size_t i = 0; i < size; i++) {
+      body += "0123456789\r\n;"[generator() % 13];
+    }
+    body.append("\r\n");
+  }
+  body.append(generator() % 2 ? "0" : "000").append(EXTENSIONS[generator() % EXTENSIONS.size()]).append("\r\n");
+  return body.append(TRAILERS[generator() % TRAILERS.size()]).append("\r\n");
+}
+
+// Feeds the body and the request pipelined after it in the given pieces, and checks that exactly the body is taken.
+static bool follows(BodyFraming framing, uint64_t length, const std::string &body, const std::vector<size_t> &splits) {
+  std::string data = body + PIPELINED_REQUEST;
+  BodyFramer framer;
+  framer.start(framing, length);
+  size_t offset = 0;
+  for (size_t i = 0; i <= splits.size() && !framer.is_done(); i++) {
+    size_t size = (i < splits.size() ? splits[i] : data.size()) - offset;
+    if (framing == LENGTH_BODY && offset + framer.wanted(size) > body.size()) {
+      return false;
+    }
+    size_t used = framer.consume(data.data() + offset, size);
+    offset += used;
+    if (framer.has_failed() || (used < size && !framer.is_done())) {
+      return false;
+    }
+  }
+  return framer.is_done() && offset == body.size();
+}
+
+static void check_body(BodyFraming framing, uint64_t length, const std::string &body) {
+  std::vector<size_t> splits;
+  for (size_t split = 0; split <= body.size() + 1; split++) {
+    if (!follows(framing, length, body, {split})) {
+      report("Body not followed when split once", body);
+      return;
+    }
+  }
+  for (size_t split = 1; split <= body.size(); split++) {
+    splits.push_back(split);
+  }
+  if (!follows(framing, length, body, splits)) {
+    report("Body not followed one byte at a time", body);
+  }
+}
+
+static void check_framing() {
+  for (const FramingCase &framing_case : FRAMING_CASES) {
+    HttpHead head;
+    BodyFraming framing = NO_BODY;
+    uint64_t length = 0;
+    if (!head.parse(framing_case.head)) {
+      report("Head not parsed", framing_case.head);
+      continue;
+    }
+    bool accepted = head.body_framing(framing_case.head_request, framing, length);
+    if (accepted != framing_case.accepted
+      || (accepted && (framing != framing_case.framing
+      || (framing == LENGTH_BODY && length != framing_case.length)))) {
+      report(framing_case.head_request ? "Wrong framing for a HEAD request" : "Wrong framing", framing_case.head);
+    }
+  }
+  for (const std::string &body : BROKEN_CHUNKED_BODIES) {
+    BodyFramer framer;
+    framer.start(CHUNKED_BODY);
+    size_t used = framer.consume(body.data(), body.size());
+    if (!framer.has_failed() || framer.is_done() || used > body.size()) {
+      report("Broken chunked body accepted", body);
+    }
+  }
+}
+
+// Keep-alive and the headers passed on to the next hop.
+static void check_forwarding() {
+  HttpHead head;
+  head.parse("GET http://example.com/ HTTP/1.1\r\nHost: other\r\nConnection: close, X-Hop\r\nX-Hop: 1\r\n"
+    "Keep-Alive: 5\r\nProxy-Connection: keep-alive\r\nProxy-Authorization: Basic a\r\nTE: trailers\r\n"
+    "Upgrade: h2c\r\nAccept: */*\r\n\r\n");
+  std::string forwarded;
+  head.write_forwarded(forwarded, "GET / HTTP/1.1", "example.com", false);
+  if (forwarded != "GET / HTTP/1.1\r\nHost: example.com\r\nAccept: */*\r\n\r\n" || head.keeps_alive()) {
+    report("Hop-by-hop headers forwarded", forwarded);
+  }
+  struct KeepAlive {
+    const char *head;
+    bool keeps_alive;
+  };
+  for (const KeepAlive &keep_alive : std::vector<KeepAlive> {
+    {"GET / HTTP/1.1\r\n\r\n", true}, {"GET / HTTP/1.0\r\n\r\n", false},
+    {"GET / HTTP/1.0\r\nProxy-Connection: Keep-Alive\r\n\r\n", true},
+    {"HTTP/1.1 200 OK\r\nConnection: Close\r\n\r\n", false}, {"HTTP/1.0 200 OK\r\n\r\n", false},
+  }) {
+    HttpHead parsed;
+    if (!parsed.parse(keep_alive.head) || parsed.keeps_alive() != keep_alive.keeps_alive) {
+      report("Wrong keep-alive", keep_alive.head);
+    }
+  }
+}
+
+// Follows the body repeatedly in reads of the given size until MIN_DURATION has elapsed, and returns the MB/s.
+static double measure(const std::string &body, size_t read_size) {
+  size_t bytes = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    BodyFramer framer;
+    framer.start(CHUNKED_BODY);
+    for (size_t offset = 0; offset < body.size() && !framer.is_done(); ) {
+      offset += framer.consume(body.data() + offset, std::min(read_size, body.size() - offset));
+    }
+    sink += framer.is_done();
+    bytes += body.size();
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  return bytes / std::chrono::duration<double>(elapsed).count() / 1e6;
+}
+
+int main(int argc, char * argv[]) {
+  size_t random_bodies = argc > 1 ? atol(argv[1]) : DEFAULT_RANDOM_BODIES;
+  check_framing();
+  check_forwarding();
+  check_body(LENGTH_BODY, 11, "hello world");
+  check_body(NO_BODY, 0, "");
+  check_body(CHUNKED_BODY, 0, "0\r\n\r\n");
+  check_body(CHUNKED_BODY, 0, "5;a=b\r\nhello\r\n6\r\n world\r\n0;last\r\nChecksum: 1\r\nA: b\r\n\r\n");
+  std::mt19937 generator(SEED);
+  for (size_t i = 0; i < random_bodies; i++) {
+    check_body(CHUNKED_BODY, 0, random_chunked_body(generator));
+    std::string body(generator() % 2000, 'b');
+    check_body(body.empty() ? NO_BODY : LENGTH_BODY, body.size(), body);
+  }
+  printf("Framing check: %zu heads, %zu broken chunked bodies, %zu random bodies split at every byte, "
+    "%zu failures\n", FRAMING_CASES.size(), BROKEN_CHUNKED_BODIES.size(), 2 * random_bodies, failures);
+  if (failures > 0) {
+    return 1;
+  }
+
+  std::string large_chunks;
+  std::string small_chunks;
+  for (int i = 0; i < 64; i++) {
+    large_chunks.append("4000\r\n").append(0x4000, 'x').append("\r\n");
+  }
+  for (int i = 0; i < 4096; i++) {
+    small_chunks.append("100;ext=1\r\n").append(0x100, 'x').append("\r\n");
+  }
+  large_chunks.append("0\r\n\r\n");
+  small_chunks.append("0\r\n\r\n");
+  printf("%20s %14s\n", "", "MB/s");
+  printf("%20s %14.0f\n", "16 KiB chunks", measure(large_chunks, 16384));
+  printf("%20s %14.0f\n", "256 B chunks", measure(small_chunks, 16384));
+  return 0;
+}
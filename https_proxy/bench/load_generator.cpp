@@ -0,0 +1,660 @@
+// Measures the proxy under load, entirely on loopback. Starts a local upstream server and the proxy, then runs two
+// phases through CONNECT tunnels: a tunnel phase that opens tunnels back to back, each exchanging a small message
+// before closing, and a relay phase that keeps the given number of tunnels pushing payloads for a fixed duration.
+// Reports the tunnel rate, handshake latency percentiles, relay throughput and the CPU time and memory of the proxy
+// as a single JSON object on stdout, and as a summary on stderr. With --count-syscalls, the proxy runs under ptrace
+// and the system calls it makes in each phase are counted as well. Stopping the proxy at every system call slows it
+// down by far, so rates and throughput of counted runs are not comparable with those of other runs. With
+// --idle-tunnels, a last phase opens that many tunnels, exchanges a probe through each and leaves them all open, then
+// reports how much the resident memory of the proxy grew per idle tunnel.
+// Usage: ./load_generator [--proxy=PATH] [--connections=COUNT] [--tunnels=COUNT] [--duration=SECONDS]
+//   [--payload=BYTES] [--pattern=echo|upload|download] [--threads=COUNT] [--idle-tunnels=COUNT]
+//   [--target-host=HOST] [--count-syscalls] [-- PROXY_FLAGS...]
+
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#define DEFAULT_CONNECTIONS 64
+#define DEFAULT_TUNNELS 5000
+#define DEFAULT_DURATION 5
+#define DEFAULT_PAYLOAD 16384
+#define DEFAULT_THREADS 2
+#define UPSTREAM_THREADS 2
+#define PROBE_SIZE 64
+#define STARTUP_TIMEOUT std::chrono::seconds(5)
+#define STARTUP_POLL_INTERVAL std::chrono::milliseconds(50)
+// Time given to the proxy to finish handling the idle tunnels before its memory is sampled.
+#define IDLE_SETTLE_TIME std::chrono::milliseconds(500)
+#define CONNECTION_ESTABLISHED "HTTP/1.1 200"
+#define HEADER_END "\r\n\r\n"
+
+typedef std::chrono::steady_clock Clock;
+
+// The first byte a client sends through its tunnel tells the upstream what to do with the rest.
+enum Pattern {ECHO_PATTERN = 'E', UPLOAD_PATTERN = 'U', DOWNLOAD_PATTERN = 'D'};
+
+struct Settings {
+  std::string proxy = "./proxy";
+  std::string target_host = "127.0.0.1";
+  int connections = DEFAULT_CONNECTIONS;
+  long tunnels = DEFAULT_TUNNELS;
+  int duration = DEFAULT_DURATION;
+  size_t payload = DEFAULT_PAYLOAD;
+  Pattern pattern = ECHO_PATTERN;
+  std::string pattern_name = "echo";
+  int threads = DEFAULT_THREADS;
+  long idle_tunnels = 0;
+  bool count_syscalls = false;
+  std::vector<std::string> proxy_flags;
+};
+
+// Results of one client thread, merged once the phase is over.
+struct Totals {
+  std::vector<uint64_t> handshakes;
+  uint64_t completed = 0;
+  uint64_t failed = 0;
+  uint64_t bytes = 0;
+};
+
+struct ProcessUsage {
+  double cpu_seconds;
+  long rss_kilobytes;
+  long peak_rss_kilobytes;
+};
+
+static Settings settings;
+static boost::asio::ip::tcp::endpoint proxy_endpoint;
+static std::string connect_request;
+
+// Echoes, discards or produces bytes depending on the pattern byte the client sends first.
+class UpstreamSession : public std::enable_shared_from_this<UpstreamSession> {
+  public:
+    explicit UpstreamSession(boost::asio::ip::tcp::socket socket)
+      : socket(std::move(socket)), buffer(std::max(settings.payload, (size_t) PROBE_SIZE), 'd') {}
+
+    void start() {
+      std::shared_ptr<UpstreamSession> self = shared_from_this();
+      boost::asio::async_read(this->socket, boost::asio::buffer(&this->pattern, 1),
+        [self](const boost::system::error_code &error, size_t) {
+          if (!error) {
+            self->pattern == DOWNLOAD_PATTERN ? self->produce() : self->consume();
+          }
+        });
+    }
+
+  private:
+    boost::asio::ip::tcp::socket socket;
+    std::vector<char> buffer;
+    char pattern;
+
+    void consume() {
+      std::shared_ptr<UpstreamSession> self = shared_from_this();
+      this->socket.async_read_some(boost::asio::buffer(this->buffer),
+        [self](const boost::system::error_code &error, size_t length) {
+          if (error) {
+            return;
+          }
+          if (self->pattern != ECHO_PATTERN) {
+            self->consume();
+            return;
+          }
+          boost::asio::async_write(self->socket, boost::asio::buffer(self->buffer, length),
+            [self](const boost::system::error_code &error, size_t) {
+              if (!error) {
+                self->consume();
+              }
+            });
+        });
+    }
+
+    void produce() {
+      std::shared_ptr<UpstreamSession> self = shared_from_this();
+      boost::asio::async_write(this->socket, boost::asio::buffer(this->buffer, settings.payload),
+        [self](const boost::system::error_code &error, size_t) {
+          if (!error) {
+            self->produce();
+          }
+        });
+    }
+};
+
+class Upstream {
+  public:
+    Upstream() : acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {}
+
+    uint16_t port() const {
+      return this->acceptor.local_endpoint().port();
+    }
+
+    void start() {
+      this->accept();
+      for (int i = 0; i < UPSTREAM_THREADS; i++) {
+        this->threads.emplace_back([this]() { this->io.run(); });
+      }
+    }
+
+    void stop() {
+      this->io.stop();
+      for (std::thread &thread : this->threads) {
+        thread.join();
+      }
+    }
+
+  private:
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::vector<std::thread> threads;
+
+    void accept() {
+      this->acceptor.async_accept([this](const boost::system::error_code &error, boost::asio::ip::tcp::socket socket) {
+        if (!error) {
+          std::make_shared<UpstreamSession>(std::move(socket))->start();
+        }
+        this->accept();
+      });
+    }
+};
+
+// Opens tunnels through the proxy. In the tunnel phase, a client opens tunnels one after another while tunnels
+// remain to be opened; in the relay phase, it keeps a single tunnel relaying until the deadline. In the idle phase, it
+// opens tunnels like in the tunnel phase, but keeps each one open once its probe has been echoed.
+class Client : public std::enable_shared_from_this<Client> {
+  public:
+    Client(boost::asio::io_context &io, Totals &totals, std::atomic<long> *remaining, Clock::time_point deadline,
+      std::vector<boost::asio::ip::tcp::socket> *idle = nullptr)
+      : io(io), socket(io), totals(totals), remaining(remaining), deadline(deadline), idle(idle),
+        payload(std::max(settings.payload, (size_t) PROBE_SIZE), 'u') {}
+
+    void start() {
+      if (this->remaining != nullptr && this->remaining->fetch_sub(1) <= 0) {
+        return;
+      }
+      this->socket = boost::asio::ip::tcp::socket(this->io);
+      this->response.consume(this->response.size());
+      this->started = Clock::now();
+      std::shared_ptr<Client> self = shared_from_this();
+      this->socket.async_connect(proxy_endpoint, [self](const boost::system::error_code &error) {
+        if (error) {
+          self->finish(false);
+          return;
+        }
+        boost::asio::async_write(self->socket, boost::asio::buffer(connect_request),
+          [self](const boost::system::error_code &error, size_t) {
+            if (error) {
+              self->finish(false);
+              return;
+            }
+            boost::asio::async_read_until(self->socket, self->response, HEADER_END,
+              [self](const boost::system::error_code &error, size_t) {
+                self->handle_response(error);
+              });
+          });
+      });
+    }
+
+  private:
+    boost::asio::io_context &io;
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::streambuf response;
+    Totals &totals;
+    std::atomic<long> *remaining;
+    Clock::time_point deadline;
+    Clock::time_point started;
+    std::vector<boost::asio::ip::tcp::socket> *idle;
+    std::vector<char> payload;
+    char pattern;
+
+    void handle_response(const boost::system::error_code &error) {
+      std::string status(boost::asio::buffers_begin(this->response.data()),
+        boost::asio::buffers_begin(this->response.data()) + std::min(this->response.size(),
+        sizeof(CONNECTION_ESTABLISHED) - 1));
+      if (error || status != CONNECTION_ESTABLISHED) {
+        this->finish(false);
+        return;
+      }
+      this->totals.handshakes.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - this->started).count());
+      this->pattern = this->remaining != nullptr ? ECHO_PATTERN : settings.pattern;
+      std::shared_ptr<Client> self = shared_from_this();
+      boost::asio::async_write(this->socket, boost::asio::buffer(&this->pattern, 1),
+        [self](const boost::system::error_code &error, size_t) {
+          if (error) {
+            self->finish(false);
+          } else if (self->remaining != nullptr) {
+            self->probe();
+          } else {
+            self->relay();
+          }
+        });
+    }
+
+    // Checks that the tunnel relays in both directions.
+    void probe() {
+      std::shared_ptr<Client> self = shared_from_this();
+      boost::asio::async_write(this->socket, boost::asio::buffer(this->payload, PROBE_SIZE),
+        [self](const boost::system::error_code &error, size_t) {
+          if (error) {
+            self->finish(false);
+            return;
+          }
+          boost::asio::async_read(self->socket, boost::asio::buffer(self->payload, PROBE_SIZE),
+            [self](const boost::system::error_code &error, size_t) {
+              self->finish(!error);
+            });
+        });
+    }
+
+    void relay() {
+      if (Clock::now() >= this->deadline) {
+        this->finish(true);
+        return;
+      }
+      std::shared_ptr<Client> self = shared_from_this();
+      if (this->pattern == DOWNLOAD_PATTERN) {
+        this->socket.async_read_some(boost::asio::buffer(this->payload, settings.payload),
+          [self](const boost::system::error_code &error, size_t length) {
+            self->handle_relay(error, length);
+          });
+        return;
+      }
+      boost::asio::async_write(this->socket, boost::asio::buffer(this->payload, settings.payload),
+        [self](const boost::system::error_code &error, size_t length) {
+          if (error || self->pattern == UPLOAD_PATTERN) {
+            self->handle_relay(error, length);
+            return;
+          }
+          boost::asio::async_read(self->socket, boost::asio::buffer(self->payload, settings.payload),
+            [self](const boost::system::error_code &error, size_t length) {
+              self->handle_relay(error, 2 * length);
+            });
+        });
+    }
+
+    void handle_relay(const boost::system::error_code &error, size_t length) {
+      this->totals.bytes += length;
+      if (error) {
+        this->finish(false);
+        return;
+      }
+      this->relay();
+    }
+
+    void finish(bool succeeded) {
+      (succeeded ? this->totals.completed : this->totals.failed)++;
+      boost::system::error_code error;
+      if (succeeded && this->idle != nullptr) {
+        this->idle->push_back(std::move(this->socket));
+      } else {
+        this->socket.close(error);
+      }
+      if (this->remaining != nullptr) {
+        this->start();
+      }
+    }
+};
+
+// Runs the clients of a phase on the client threads, each with its own IO context, and merges their results.
+static Totals run_phase(std::atomic<long> *remaining, Clock::time_point deadline) {
+  std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+  std::vector<Totals> totals(settings.threads);
+  for (int i = 0; i < settings.threads; i++) {
+    contexts.push_back(std::make_unique<boost::asio::io_context>());
+  }
+  for (int i = 0; i < settings.connections; i++) {
+    int thread = i % settings.threads;
+    std::make_shared<Client>(*contexts[thread], totals[thread], remaining, deadline)->start();
+  }
+  std::vector<std::thread> threads;
+  for (int i = 0; i < settings.threads; i++) {
+    threads.emplace_back([&contexts, i]() { contexts[i]->run(); });
+  }
+  Totals merged;
+  for (int i = 0; i < settings.threads; i++) {
+    threads[i].join();
+    merged.handshakes.insert(merged.handshakes.end(), totals[i].handshakes.begin(), totals[i].handshakes.end());
+    merged.completed += totals[i].completed;
+    merged.failed += totals[i].failed;
+    merged.bytes += totals[i].bytes;
+  }
+  std::sort(merged.handshakes.begin(), merged.handshakes.end());
+  return merged;
+}
+
+static double percentile(const std::vector<uint64_t> &sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, (size_t) (fraction * sorted.size()))] / 1000.0;
+}
+
+// Reads the CPU time of the process from /proc/PID/stat and its memory from /proc/PID/status.
+static ProcessUsage sample_usage(pid_t pid) {
+  ProcessUsage usage = {0, 0, 0};
+  std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+  std::string line;
+  if (std::getline(stat, line) && line.rfind(')') != std::string::npos) {
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long user_ticks = 0;
+    unsigned long system_ticks = 0;
+    // The fields after the command name start at the third one, and the user and system times are the 14th and 15th.
+    for (int index = 3; fields >> field && index <= 15; index++) {
+      if (index == 14) {
+        user_ticks = std::stoul(field);
+      } else if (index == 15) {
+        system_ticks = std::stoul(field);
+      }
+    }
+    usage.cpu_seconds = (double) (user_ticks + system_ticks) / sysconf(_SC_CLK_TCK);
+  }
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  while (std::getline(status, line)) {
+    if (line.find("VmRSS:") == 0) {
+      usage.rss_kilobytes = atol(line.c_str() + 6);
+    } else if (line.find("VmHWM:") == 0) {
+      usage.peak_rss_kilobytes = atol(line.c_str() + 6);
+    }
+  }
+  return usage;
+}
+
+// Opens the idle tunnels from a single thread and samples the memory of the proxy while they are all open. Returns the
+// resident memory the proxy gained per tunnel, in bytes.
+static double run_idle_phase(pid_t proxy, Totals &totals) {
+  boost::asio::io_context io;
+  std::vector<boost::asio::ip::tcp::socket> idle;
+  std::atomic<long> remaining(settings.idle_tunnels);
+  ProcessUsage before = sample_usage(proxy);
+  for (int i = 0; i < settings.connections; i++) {
+    std::make_shared<Client>(io, totals, &remaining, Clock::time_point::max(), &idle)->start();
+  }
+  io.run();
+  std::this_thread::sleep_for(IDLE_SETTLE_TIME);
+  ProcessUsage after = sample_usage(proxy);
+  for (boost::asio::ip::tcp::socket &socket : idle) {
+    boost::system::error_code error;
+    socket.close(error);
+  }
+  return idle.empty() ? 0 : (after.rss_kilobytes - before.rss_kilobytes) * 1024.0 / idle.size();
+}
+
+static uint16_t free_port() {
+  boost::asio::io_context io;
+  boost::asio::ip::tcp::acceptor acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+  return acceptor.local_endpoint().port();
+}
+
+static pid_t fork_proxy(uint16_t port, bool traced) {
+  std::vector<std::string> arguments = {settings.proxy, std::to_string(port), "0"};
+  arguments.insert(arguments.end(), settings.proxy_flags.begin(), settings.proxy_flags.end());
+  pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<char*> argv;
+    for (std::string &argument : arguments) {
+      argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+    if (traced) {
+      ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    }
+    execv(argv[0], argv.data());
+    perror("execv");
+    _exit(127);
+  }
+  return pid;
+}
+
+// Runs the proxy under ptrace and counts the system calls of all its threads. Only the thread that forked the proxy
+// may trace it, and any thread waiting for the proxy could take its stops, so that thread does all the waiting.
+class SyscallCounter {
+  public:
+    pid_t start(uint16_t port) {
+      std::promise<pid_t> started;
+      std::future<pid_t> pid = started.get_future();
+      this->tracer = std::thread([this, port, &started]() {
+        pid_t pid = fork_proxy(port, true);
+        started.set_value(pid);
+        if (pid > 0) {
+          this->trace(pid);
+        }
+        this->exited = true;
+      });
+      return pid.get();
+    }
+
+    // Each system call stops the proxy once on entry and once on exit.
+    uint64_t count() const {
+      return this->stops / 2;
+    }
+
+    bool has_exited() const {
+      return this->exited;
+    }
+
+    void join() {
+      this->tracer.join();
+    }
+
+  private:
+    std::thread tracer;
+    std::atomic<uint64_t> stops{0};
+    std::atomic<bool> exited{false};
+
+    // Threads of the proxy start out stopped with SIGSTOP, which is not passed on, while other signals such as the
+    // SIGINT that stops the proxy are delivered.
+    void trace(pid_t pid) {
+      int status;
+      if (waitpid(pid, &status, __WALL) != pid || !WIFSTOPPED(status)) {
+        return;
+      }
+      ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+      ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr);
+      pid_t thread;
+      while ((thread = waitpid(-1, &status, __WALL)) > 0) {
+        if (!WIFSTOPPED(status)) {
+          continue;
+        }
+        int signal = WSTOPSIG(status);
+        if (signal == (SIGTRAP | 0x80)) {
+          this->stops++;
+          signal = 0;
+        } else if (signal == SIGTRAP || signal == SIGSTOP) {
+          signal = 0;
+        }
+        ptrace(PTRACE_SYSCALL, thread, nullptr, (void*) (long) signal);
+      }
+    }
+};
+
+static SyscallCounter syscall_counter;
+
+static pid_t start_proxy(uint16_t port) {
+  return settings.count_syscalls ? syscall_counter.start(port) : fork_proxy(port, false);
+}
+
+static bool has_exited(pid_t pid) {
+  if (settings.count_syscalls) {
+    return syscall_counter.has_exited();
+  }
+  int status;
+  return waitpid(pid, &status, WNOHANG) == pid;
+}
+
+// Waits until the proxy accepts connections, and fails if it exits or does not listen in time.
+static bool wait_for_proxy(pid_t pid) {
+  boost::asio::io_context io;
+  Clock::time_point timeout = Clock::now() + STARTUP_TIMEOUT;
+  while (Clock::now() < timeout) {
+    if (has_exited(pid)) {
+      return false;
+    }
+    boost::asio::ip::tcp::socket socket(io);
+    boost::system::error_code error;
+    socket.connect(proxy_endpoint, error);
+    if (!error) {
+      return true;
+    }
+    std::this_thread::sleep_for(STARTUP_POLL_INTERVAL);
+  }
+  return false;
+}
+
+static void stop_proxy(pid_t pid) {
+  kill(pid, SIGINT);
+  if (settings.count_syscalls) {
+    syscall_counter.join();
+    return;
+  }
+  int status;
+  waitpid(pid, &status, 0);
+}
+
+static bool parse_settings(int argc, char * argv[]) {
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "--") {
+      settings.proxy_flags.assign(argv + i + 1, argv + argc);
+      break;
+    }
+    if (argument == "--count-syscalls") {
+      settings.count_syscalls = true;
+      continue;
+    }
+    size_t separator = argument.find('=');
+    if (argument.find("--") != 0 || separator == std::string::npos) {
+      return false;
+    }
+    std::string name = argument.substr(2, separator - 2);
+    std::string value = argument.substr(separator + 1);
+    if (name == "proxy") {
+      settings.proxy = value;
+    } else if (name == "target-host") {
+      settings.target_host = value;
+    } else if (name == "connections") {
+      settings.connections = atoi(value.c_str());
+    } else if (name == "tunnels") {
+      settings.tunnels = atol(value.c_str());
+    } else if (name == "duration") {
+      settings.duration = atoi(value.c_str());
+    } else if (name == "payload") {
+      settings.payload = atol(value.c_str());
+    } else if (name == "threads") {
+      settings.threads = atoi(value.c_str());
+    } else if (name == "idle-tunnels") {
+      settings.idle_tunnels = atol(value.c_str());
+    } else if (name == "pattern" && (value == "echo" || value == "upload" || value == "download")) {
+      settings.pattern = value == "echo" ? ECHO_PATTERN : value == "upload" ? UPLOAD_PATTERN : DOWNLOAD_PATTERN;
+      settings.pattern_name = value;
+    } else {
+      return false;
+    }
+  }
+  return settings.connections > 0 && settings.tunnels >= 0 && settings.duration >= 0 && settings.payload > 0
+    && settings.threads > 0 && settings.idle_tunnels >= 0;
+}
+
+int main(int argc, char * argv[]) {
+  if (!parse_settings(argc, argv)) {
+    fprintf(stderr, "Usage: ./load_generator [--proxy=PATH] [--connections=COUNT] [--tunnels=COUNT] "
+      "[--duration=SECONDS] [--payload=BYTES] [--pattern=echo|upload|download] [--threads=COUNT] "
+      "[--idle-tunnels=COUNT] [--target-host=HOST] [--count-syscalls] [-- PROXY_FLAGS...]\n");
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  // Every idle tunnel takes two descriptors here and two in the proxy, which inherits the limit.
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  Upstream upstream;
+  upstream.start();
+  std::string target = settings.target_host + ":" + std::to_string(upstream.port());
+  connect_request = "CONNECT " + target + " HTTP/1.1\r\nHost: " + target + HEADER_END;
+  proxy_endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), free_port());
+  pid_t proxy = start_proxy(proxy_endpoint.port());
+  if (proxy < 0 || !wait_for_proxy(proxy)) {
+    fprintf(stderr, "The proxy at %s did not start listening\n", settings.proxy.c_str());
+    if (proxy > 0) {
+      stop_proxy(proxy);
+    }
+    upstream.stop();
+    return 3;
+  }
+
+  ProcessUsage before = sample_usage(proxy);
+  uint64_t syscalls_before = syscall_counter.count();
+  std::atomic<long> remaining(settings.tunnels);
+  Clock::time_point start = Clock::now();
+  Totals tunnels = run_phase(&remaining, Clock::time_point::max());
+  double tunnel_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  ProcessUsage after_tunnels = sample_usage(proxy);
+  uint64_t syscalls_after_tunnels = syscall_counter.count();
+
+  start = Clock::now();
+  Totals relay = run_phase(nullptr, start + std::chrono::seconds(settings.duration));
+  double relay_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  ProcessUsage after_relay = sample_usage(proxy);
+  uint64_t syscalls_after_relay = syscall_counter.count();
+  Totals idle;
+  double idle_tunnel_bytes = settings.idle_tunnels > 0 ? run_idle_phase(proxy, idle) : 0;
+  stop_proxy(proxy);
+  upstream.stop();
+
+  double tunnel_rate = tunnels.completed / tunnel_seconds;
+  double throughput = relay.bytes / relay_seconds / 1e6;
+  double tunnel_cpu = after_tunnels.cpu_seconds - before.cpu_seconds;
+  double relay_cpu = after_relay.cpu_seconds - after_tunnels.cpu_seconds;
+  printf("{\"connections\": %d, \"pattern\": \"%s\", \"payload_bytes\": %zu, \"tunnels\": %lu, "
+    "\"failed_tunnels\": %lu, \"tunnels_per_second\": %.1f, \"handshake_p50_us\": %.1f, \"handshake_p99_us\": %.1f, "
+    "\"handshake_p999_us\": %.1f, \"relay_tunnels\": %lu, \"failed_relay_tunnels\": %lu, \"relay_bytes\": %lu, "
+    "\"relay_megabytes_per_second\": %.1f, \"tunnel_phase_cpu_percent\": %.1f, \"relay_phase_cpu_percent\": %.1f, "
+    "\"proxy_cpu_seconds\": %.2f, \"proxy_rss_kilobytes\": %ld, \"proxy_peak_rss_kilobytes\": %ld",
+    settings.connections, settings.pattern_name.c_str(), settings.payload, tunnels.completed, tunnels.failed,
+    tunnel_rate, percentile(tunnels.handshakes, 0.5), percentile(tunnels.handshakes, 0.99),
+    percentile(tunnels.handshakes, 0.999), relay.completed, relay.failed, relay.bytes, throughput,
+    100 * tunnel_cpu / tunnel_seconds, 100 * relay_cpu / relay_seconds, after_relay.cpu_seconds,
+    after_relay.rss_kilobytes, after_relay.peak_rss_kilobytes);
+  fprintf(stderr, "%lu tunnels (%lu failed) at %.0f tunnels/s, handshake p50 %.0f us, p99 %.0f us, p99.9 %.0f us\n"
+    "%d %s tunnels relayed %.1f MB/s (%lu failed)\nproxy CPU %.0f%% opening tunnels, %.0f%% relaying, "
+    "RSS %ld KiB (peak %ld KiB)\n", tunnels.completed, tunnels.failed, tunnel_rate,
+    percentile(tunnels.handshakes, 0.5), percentile(tunnels.handshakes, 0.99), percentile(tunnels.handshakes, 0.999),
+    settings.connections, settings.pattern_name.c_str(), throughput, relay.failed, 100 * tunnel_cpu / tunnel_seconds,
+    100 * relay_cpu / relay_seconds, after_relay.rss_kilobytes, after_relay.peak_rss_kilobytes);
+  if (settings.count_syscalls) {
+    uint64_t tunnel_syscalls = syscalls_after_tunnels - syscalls_before;
+    uint64_t relay_syscalls = syscalls_after_relay - syscalls_after_tunnels;
+    double per_tunnel = tunnels.completed > 0 ? (double) tunnel_syscalls / tunnels.completed : 0;
+    double per_megabyte = relay.bytes > 0 ? relay_syscalls / (relay.bytes / 1e6) : 0;
+    printf(", \"tunnel_phase_syscalls\": %lu, \"syscalls_per_tunnel\": %.1f, \"relay_phase_syscalls\": %lu, "
+      "\"relay_syscalls_per_megabyte\": %.1f", tunnel_syscalls, per_tunnel, relay_syscalls, per_megabyte);
+    fprintf(stderr, "proxy system calls: %.1f per tunnel, %.1f per MB relayed\n", per_tunnel, per_megabyte);
+  }
+  if (settings.idle_tunnels > 0) {
+    printf(", \"idle_tunnels\": %lu, \"failed_idle_tunnels\": %lu, \"proxy_rss_bytes_per_idle_tunnel\": %.0f",
+      idle.completed, idle.failed, idle_tunnel_bytes);
+    fprintf(stderr, "%lu idle tunnels (%lu failed), proxy RSS %.0f bytes per idle tunnel\n", idle.completed,
+      idle.failed, idle_tunnel_bytes);
+  }
+  printf("}\n");
+  return tunnels.failed > 0 || relay.failed > 0 || idle.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+// Checks that the histogram buckets of Metrics tile the range of values: every value falls in the bucket whose limits
+// surround it, within the relative error the sub-buckets allow, and bucket_index and bucket_limit agree at every bucket
+// boundary. Then records random durations spread over several orders of magnitude, checks that the percentiles are
+// monotonic and within that error of the exact ones, and measures how many values are recorded per second.
+// Usage: ./metrics_bench [VALUE_COUNT]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "metrics.hpp"
+
+#define DEFAULT_VALUES 1000000
+#define MIN_DURATION std::chrono::milliseconds(300)
+#define SEED 3103
+// Durations are drawn log-normally around 50 us, spanning nanoseconds to seconds.
+#define LOG_MEAN std::log(50000.0)
+#define LOG_DEVIATION 3.0
+
+static size_t mismatches;
+
+static void report(const char *format, ...) {
+  if (mismatches++ < 10) {
+    va_list arguments;
+    va_start(arguments, format);
+    vprintf(format, arguments);
+    va_end(arguments);
+    printf("\n");
+  }
+}
+
+// The smallest value in the bucket, which is the limit of the one before it.
+static uint64_t bucket_start(size_t index) {
+  return index == 0 ? 0 : Metrics::bucket_limit(index - 1);
+}
+
+static void check_buckets(std::mt19937_64 &generator) {
+  for (size_t index = 0; index < HISTOGRAM_BUCKETS - 1; index++) {
+    uint64_t limit = Metrics::bucket_limit(index);
+    if (limit <= bucket_start(index) || Metrics::bucket_index(limit - 1) != index
+      || Metrics::bucket_index(limit) != index + 1) {
+      report("Bucket %zu: limit %lu, start %lu", index, limit, bucket_start(index));
+    }
+  }
+  uint64_t largest = Metrics::bucket_limit(HISTOGRAM_BUCKETS - 2);
+  for (int i = 0; i < 1000000; i++) {
+    uint64_t value = generator() >> (generator() % 64);
+    size_t index = Metrics::bucket_index(value);
+    if (value >= largest) {
+      if (index != HISTOGRAM_BUCKETS - 1) {
+        report("Value %lu past the last limit %lu went to bucket %zu", value, largest, index);
+      }
+      continue;
+    }
+    uint64_t start = bucket_start(index);
+    uint64_t limit = Metrics::bucket_limit(index);
+    if (value < start || value >= limit || (limit - start - 1) * HISTOGRAM_SUB_BUCKETS > std::max<uint64_t>(start, 1)) {
+      report("Value %lu went to the bucket from %lu to %lu", value, start, limit);
+    }
+  }
+}
+
+static void check_percentiles(std::vector<uint64_t> &values) {
+  MetricsSnapshot before = Metrics::snapshot();
+  for (uint64_t value : values) {
+    Metrics::record(RESOLVE_TIME, std::chrono::nanoseconds(value));
+  }
+  MetricsSnapshot after = Metrics::snapshot();
+  HistogramSnapshot histogram = after.histograms[RESOLVE_TIME];
+  for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    histogram.buckets[bucket] -= before.histograms[RESOLVE_TIME].buckets[bucket];
+  }
+  histogram.count -= before.histograms[RESOLVE_TIME].count;
+  histogram.sum -= before.histograms[RESOLVE_TIME].sum;
+  if (histogram.count != values.size()) {
+    report("Recorded %zu values, the histogram counted %lu", values.size(), histogram.count);
+  }
+  std::sort(values.begin(), values.end());
+  uint64_t previous = 0;
+  for (int step = 0; step <= 1000; step++) {
+    double fraction = step / 1000.0;
+    uint64_t estimate = histogram.percentile(fraction);
+    // The percentile is the last value of the bucket holding the exact one.
+    uint64_t exact = values[std::max<size_t>(1, std::ceil(fraction * values.size())) - 1];
+    if (estimate < previous) {
+      report("Percentile %d/1000 is %lu, below the previous %lu", step, estimate, previous);
+    }
+    if (estimate < exact || (estimate - exact) * HISTOGRAM_SUB_BUCKETS > std::max<uint64_t>(exact, 1)) {
+      report("Percentile %d/1000 is %lu, the exact one %lu", step, estimate, exact);
+    }
+    previous = estimate;
+  }
+}
+
+// Returns the values recorded per second.
+static double measure_record(const std::vector<uint64_t> &values) {
+  size_t recorded = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (uint64_t value : values) {
+      Metrics::record(CONNECT_TIME, std::chrono::nanoseconds(value));
+    }
+    recorded += values.size();
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  return recorded / std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char * argv[]) {
+  size_t count = argc > 1 ? atol(argv[1]) : DEFAULT_VALUES;
+  std::mt19937_64 generator(SEED);
+  check_buckets(generator);
+  std::lognormal_distribution<double> duration(LOG_MEAN, LOG_DEVIATION);
+  std::vector<uint64_t> values;
+  for (size_t i = 0; i < count; i++) {
+    values.push_back(static_cast<uint64_t>(duration(generator)));
+  }
+  std::vector<uint64_t> recorded = values;
+  check_percentiles(recorded);
+  printf("Bucket check: %d buckets, %d per power of two, %zu values, %zu mismatches\n", HISTOGRAM_BUCKETS,
+    HISTOGRAM_SUB_BUCKETS, count, mismatches);
+  if (mismatches > 0) {
+    return 1;
+  }
+  printf("Recorded values: %.0f/s\n", measure_record(values));
+  return 0;
+}
@@ -0,0 +1,210 @@
+// Checks the caching of Resolver against a stub lookup that counts its calls: answers are served from the cache
+// within their TTL, failures for the negative TTL, concurrent lookups for one hostname share a single query,
+// popular entries are refreshed before they expire while others are looked up again after, handlers are not kept
+// once they have been invoked, and a full cache evicts its least recently used entry. Then measures a cache hit.
+// Usage: ./resolver_bench
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include "bench.hpp"
+#include "resolver.hpp"
+
+#define POSITIVE_TTL 2
+#define NEGATIVE_TTL 1
+// Lookups of hostnames starting with "slow" take this long, so that concurrent requests for them overlap.
+#define SLOW_LOOKUP std::chrono::milliseconds(200)
+#define CONCURRENT_REQUESTS 16
+#define MIN_DURATION std::chrono::milliseconds(300)
+#define RELEASE_TIMEOUT std::chrono::seconds(1)
+
+// Answers every hostname with 192.0.2.1, except those starting with "nx", which are not found.
+class StubResolver : public Resolver {
+  public:
+    std::atomic<int> calls{0};
+
+  protected:
+    boost::system::error_code lookup(const std::string &hostname, AddressList &addresses) override {
+      this->calls++;
+      if (hostname.compare(0, 4, "slow") == 0) {
+        std::this_thread::sleep_for(SLOW_LOOKUP);
+      }
+      if (hostname.compare(0, 2, "nx") == 0) {
+        return boost::asio::error::host_not_found;
+      }
+      addresses.push_back(boost::asio::ip::make_address("192.0.2.1"));
+      return boost::system::error_code();
+    }
+};
+
+struct Answer {
+  boost::system::error_code error;
+  std::shared_ptr<const AddressList> addresses;
+};
+
+// Resolves the hostname and waits for the answer, which comes from a resolver thread unless it is cached.
+static Answer resolve(Resolver &resolver, const std::string &hostname) {
+  std::promise<Answer> answer;
+  resolver.resolve(hostname, [&answer](const boost::system::error_code &error,
+    std::shared_ptr<const AddressList> addresses) {
+    answer.set_value(Answer {error, addresses});
+  });
+  return answer.get_future().get();
+}
+
+static void sleep_seconds(double seconds) {
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+static void check_cache(StubResolver &resolver) {
+  Answer first = resolve(resolver, "cached.example");
+  Answer second = resolve(resolver, "cached.example");
+  expect(!first.error && first.addresses && first.addresses->size() == 1, "Lookup answers with the stub address");
+  expect(resolver.calls == 1 && second.addresses == first.addresses, "Repeated lookup within the TTL is a cache hit");
+
+  resolver.calls = 0;
+  Answer failed = resolve(resolver, "nx.example");
+  Answer cached_failure = resolve(resolver, "nx.example");
+  expect(failed.error == boost::asio::error::host_not_found && cached_failure.error == failed.error
+    && resolver.calls == 1, "Failure is cached for the negative TTL");
+  sleep_seconds(NEGATIVE_TTL + 0.1);
+  resolve(resolver, "nx.example");
+  expect(resolver.calls == 2, "Failure is looked up again after the negative TTL");
+}
+
+static void check_coalescing(StubResolver &resolver) {
+  resolver.calls = 0;
+  ResolverStatistics before = resolver.statistics();
+  std::atomic<int> answered{0};
+  std::atomic<int> matching{0};
+  std::promise<void> done;
+  std::shared_ptr<const AddressList> first;
+  std::mutex lock;
+  for (int i = 0; i < CONCURRENT_REQUESTS; i++) {
+    resolver.resolve("slow.example", [&](const boost::system::error_code &error,
+      std::shared_ptr<const AddressList> addresses) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!first) {
+          first = addresses;
+        }
+        matching += !error && addresses == first;
+      }
+      if (++answered == CONCURRENT_REQUESTS) {
+        done.set_value();
+      }
+    });
+  }
+  done.get_future().wait();
+  expect(resolver.calls == 1, "Concurrent lookups for one hostname share one query");
+  expect(matching == CONCURRENT_REQUESTS, "Every waiting lookup gets the shared answer");
+  ResolverStatistics after = resolver.statistics();
+  expect(after.misses - before.misses == 1 && after.coalesced - before.coalesced == CONCURRENT_REQUESTS - 1,
+    "Coalesced lookups are not counted as misses");
+}
+
+// Waits until only the caller holds the reference, or gives up after RELEASE_TIMEOUT.
+static bool released(const std::shared_ptr<int> &reference) {
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + RELEASE_TIMEOUT;
+  while (reference.use_count() > 1 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return reference.use_count() == 1;
+}
+
+// A connection passes a reference to itself to the resolver, which must not keep it once the handler has run, or the
+// connection may be destroyed on a resolver thread.
+static void check_release(StubResolver &resolver) {
+  std::shared_ptr<int> reference = std::make_shared<int>(0);
+  std::promise<void> answered;
+  resolver.resolve("released.example", [reference, &answered](const boost::system::error_code&,
+    std::shared_ptr<const AddressList>) {
+    answered.set_value();
+  });
+  answered.get_future().wait();
+  expect(released(reference), "Handler is dropped once a lookup has answered it");
+  resolver.resolve("released.example", [reference](const boost::system::error_code&,
+    std::shared_ptr<const AddressList>) {});
+  expect(reference.use_count() == 1, "Handler is dropped once a cache hit has answered it");
+}
+
+// The popular entry is looked up twice and then again within the refresh window, which starts a refresh and keeps
+// answering from the cache, and is then still cached past its original expiry. The other entry is only looked up once,
+// so it is looked up again once it expires.
+static void check_refresh(StubResolver &resolver) {
+  resolver.calls = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  resolve(resolver, "popular.example");
+  resolve(resolver, "unpopular.example");
+  resolve(resolver, "popular.example");
+  expect(resolver.calls == 2, "Entries are cached before the refresh window");
+  std::this_thread::sleep_until(start + std::chrono::milliseconds(POSITIVE_TTL * 1000 * (100 - REFRESH_WINDOW_PERCENT)
+    / 100 + 100));
+  Answer refreshing = resolve(resolver, "popular.example");
+  expect(!refreshing.error && refreshing.addresses, "Entry in the refresh window is answered from the cache");
+  std::this_thread::sleep_until(start + std::chrono::milliseconds(POSITIVE_TTL * 1000 + 100));
+  expect(resolver.calls == 3 && resolver.statistics().refreshes == 1, "Popular entry is refreshed before it expires");
+  resolve(resolver, "popular.example");
+  expect(resolver.calls == 3, "Refreshed entry is still cached after the original expiry");
+  resolve(resolver, "unpopular.example");
+  expect(resolver.calls == 4, "Unpopular entry is looked up again after it expires");
+}
+
+// Fills the cache, then uses the first hostname again, so that the next new hostname evicts the second one instead.
+static void check_eviction(StubResolver &resolver) {
+  for (int i = 0; i < RESOLVER_CACHE_CAPACITY; i++) {
+    resolve(resolver, "evicted-" + std::to_string(i) + ".example");
+  }
+  resolve(resolver, "evicted-0.example");
+  resolver.calls = 0;
+  resolve(resolver, "new.example");
+  resolve(resolver, "evicted-0.example");
+  expect(resolver.calls == 1, "Recently used entry is kept when the cache is full");
+  resolve(resolver, "evicted-1.example");
+  expect(resolver.calls == 2, "Least recently used entry is evicted when the cache is full");
+}
+
+// Returns the cache hits per second.
+static double measure_hits(StubResolver &resolver) {
+  resolve(resolver, "measured.example");
+  size_t hits = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (int i = 0; i < 1000; i++) {
+      resolver.resolve("measured.example", [&hits](const boost::system::error_code&,
+        std::shared_ptr<const AddressList> addresses) {
+        hits += addresses->size();
+      });
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  return hits / std::chrono::duration<double>(elapsed).count();
+}
+
+int main() {
+  StubResolver resolver;
+  resolver.set_ttl(POSITIVE_TTL, NEGATIVE_TTL);
+  resolver.start();
+  check_cache(resolver);
+  check_coalescing(resolver);
+  check_refresh(resolver);
+  check_release(resolver);
+  check_eviction(resolver);
+  double hits = measure_hits(resolver);
+  resolver.stop();
+  ResolverStatistics statistics = resolver.statistics();
+  printf("Hits: %lu, negative hits: %lu, misses: %lu, coalesced: %lu, refreshes: %lu, failures: %lu\n",
+    statistics.hits, statistics.negative_hits, statistics.misses, statistics.coalesced, statistics.refreshes,
+    statistics.failures);
+  printf("Cache hits: %.0f/s\n", hits);
+  return bench_failures == 0 ? 0 : 1;
+}
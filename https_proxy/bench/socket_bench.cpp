@@ -0,0 +1,154 @@
+// Measures the effect of each socket profile over loopback: the time to connect and get the response to a CONNECT
+// request, the round trip of a small request whose response is written in two parts, as the relay does when records
+// arrive split, and the throughput of a bulk transfer. The accepting side is tuned like the listener and the client
+// sockets of the proxy, the connecting side like its upstream sockets.
+// Usage: ./socket_bench [TRANSFER_MEGABYTES]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "socket_tuning.hpp"
+
+#define DEFAULT_TRANSFER_MEGABYTES 256
+#define HANDSHAKES 200
+#define EXCHANGES 50
+#define REQUEST_SIZE 100
+#define RESPONSE_PART_SIZE 500
+#define CHUNK_SIZE 65536
+
+static const std::vector<std::string> PROFILES = {"default", "latency", "bulk"};
+static const std::string CONNECT_REQUEST = "CONNECT example.com:443 HTTP/1.1\r\nHost: example.com:443\r\n\r\n";
+static const std::string CONNECTION_ESTABLISHED = "HTTP/1.1 200 Connection established\r\n\r\n";
+
+struct Result {
+  double handshake;
+  double exchange;
+  double throughput;
+  std::string client_options;
+  std::string upstream_options;
+};
+
+static void read_until_closed(boost::asio::ip::tcp::socket &socket, size_t *received) {
+  std::vector<char> buffer(CHUNK_SIZE);
+  boost::system::error_code error;
+  while (!error) {
+    size_t length = socket.read_some(boost::asio::buffer(buffer), error);
+    if (received != nullptr) {
+      *received += length;
+    }
+  }
+}
+
+// Plays the proxy: answers every CONNECT request, then either waits for the client to close, answers the exchanges
+// or drains the transfer, in the order the client runs them.
+static void serve(boost::asio::ip::tcp::acceptor &acceptor, SocketTuning &tuning, std::string &client_options) {
+  std::vector<char> request(REQUEST_SIZE);
+  std::vector<char> part(RESPONSE_PART_SIZE, 'x');
+  std::vector<char> header(CONNECT_REQUEST.size());
+  for (int i = 0; i < HANDSHAKES + 2; i++) {
+    boost::asio::ip::tcp::socket socket = acceptor.accept();
+    tuning.apply(socket.native_handle(), CLIENT_SOCKET);
+    if (tuning.is_first(CLIENT_SOCKET)) {
+      client_options = SocketTuning::describe(socket.native_handle(), CLIENT_SOCKET);
+    }
+    boost::asio::read(socket, boost::asio::buffer(header));
+    boost::asio::write(socket, boost::asio::buffer(CONNECTION_ESTABLISHED));
+    if (i == HANDSHAKES) {
+      for (int exchange = 0; exchange < EXCHANGES; exchange++) {
+        boost::asio::read(socket, boost::asio::buffer(request));
+        boost::asio::write(socket, boost::asio::buffer(part));
+        boost::asio::write(socket, boost::asio::buffer(part));
+      }
+    }
+    read_until_closed(socket, nullptr);
+  }
+}
+
+static boost::asio::ip::tcp::socket connect(boost::asio::io_context &io, SocketTuning &tuning,
+  const boost::asio::ip::tcp::endpoint &endpoint, std::string &upstream_options) {
+  boost::asio::ip::tcp::socket socket(io);
+  socket.open(endpoint.protocol());
+  tuning.apply(socket.native_handle(), UPSTREAM_SOCKET);
+  if (tuning.is_first(UPSTREAM_SOCKET)) {
+    upstream_options = SocketTuning::describe(socket.native_handle(), UPSTREAM_SOCKET);
+  }
+  socket.connect(endpoint);
+  std::vector<char> response(CONNECTION_ESTABLISHED.size());
+  boost::asio::write(socket, boost::asio::buffer(CONNECT_REQUEST));
+  boost::asio::read(socket, boost::asio::buffer(response));
+  return socket;
+}
+
+static double microseconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static Result measure(const std::string &profile, size_t transfer_size) {
+  SocketTuning tuning;
+  tuning.use_profile(profile);
+  boost::asio::io_context io;
+  boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), 0);
+  boost::asio::ip::tcp::acceptor acceptor(io);
+  acceptor.open(endpoint.protocol());
+  tuning.apply(acceptor.native_handle(), LISTENER_SOCKET);
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  endpoint = acceptor.local_endpoint();
+  Result result = {};
+  std::thread server(serve, std::ref(acceptor), std::ref(tuning), std::ref(result.client_options));
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < HANDSHAKES; i++) {
+    connect(io, tuning, endpoint, result.upstream_options).close();
+  }
+  result.handshake = microseconds_since(start) / HANDSHAKES;
+
+  boost::asio::ip::tcp::socket socket = connect(io, tuning, endpoint, result.upstream_options);
+  std::vector<char> request(REQUEST_SIZE, 'x');
+  std::vector<char> response(2 * RESPONSE_PART_SIZE);
+  start = std::chrono::steady_clock::now();
+  for (int exchange = 0; exchange < EXCHANGES; exchange++) {
+    boost::asio::write(socket, boost::asio::buffer(request));
+    boost::asio::read(socket, boost::asio::buffer(response));
+  }
+  result.exchange = microseconds_since(start) / EXCHANGES;
+  socket.close();
+
+  socket = connect(io, tuning, endpoint, result.upstream_options);
+  std::vector<char> chunk(CHUNK_SIZE, 'x');
+  start = std::chrono::steady_clock::now();
+  for (size_t sent = 0; sent < transfer_size; sent += CHUNK_SIZE) {
+    boost::asio::write(socket, boost::asio::buffer(chunk));
+  }
+  socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send);
+  read_until_closed(socket, nullptr);
+  result.throughput = transfer_size / microseconds_since(start);
+  socket.close();
+  server.join();
+  return result;
+}
+
+int main(int argc, char * argv[]) {
+  size_t transfer_size = (argc > 1 ? atol(argv[1]) : DEFAULT_TRANSFER_MEGABYTES) * 1024 * 1024;
+  std::vector<Result> results;
+  for (const std::string &profile : PROFILES) {
+    SocketTuning tuning;
+    tuning.use_profile(profile);
+    printf("Profile %s\n", SocketTuning::describe(tuning.profile()).c_str());
+    results.push_back(measure(profile, transfer_size));
+    printf("  client socket: %s\n  upstream socket: %s\n", results.back().client_options.c_str(),
+      results.back().upstream_options.c_str());
+  }
+  printf("%14s %14s %14s %14s\n", "", "handshake us", "exchange us", "MB/s");
+  for (size_t i = 0; i < PROFILES.size(); i++) {
+    printf("%14s %14.1f %14.1f %14.1f\n", PROFILES[i].c_str(), results[i].handshake, results[i].exchange,
+      results[i].throughput);
+  }
+  return 0;
+}
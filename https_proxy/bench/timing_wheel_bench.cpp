@@ -0,0 +1,161 @@
+// Checks that TimingWheel expires every entry on exactly the tick it is due, while entries are scheduled, pushed back,
+// brought forward and cancelled at random, then compares the cost of refreshing a deadline against re-arming a
+// steady_timer.
+// Usage: ./timing_wheel_bench [OPERATION_COUNT]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "timing_wheel.hpp"
+
+#define DEFAULT_OPERATIONS 2000000
+#define ENTRY_COUNT 10000
+#define MIN_DURATION std::chrono::milliseconds(300)
+#define SEED 3103
+// Most advances move the wheel by a few ticks, and some far enough to cascade entries from the coarser levels.
+#define LONG_ADVANCE 100000
+#define WHEEL_SPAN ((uint64_t) 1 << (TIMING_WHEEL_SLOT_BITS * TIMING_WHEEL_LEVELS))
+
+struct Tracked {
+  TimerEntry entry;
+  uint64_t due;
+  bool scheduled;
+};
+
+static TimingWheel *checked_wheel;
+static size_t expired;
+static size_t mismatches;
+
+static void check_expiry(TimerEntry &entry) {
+  Tracked *tracked = static_cast<Tracked*>(entry.owner);
+  uint64_t tick = checked_wheel->now() - 1;
+  if (!tracked->scheduled || tick != tracked->due) {
+    if (mismatches++ < 10) {
+      printf("Mismatch: entry due at tick %lu expired at tick %lu (scheduled: %d)\n", tracked->due, tick,
+        tracked->scheduled);
+    }
+  }
+  tracked->scheduled = false;
+  expired++;
+}
+
+// Deadlines are drawn from ranges matching each level of the wheel, and from up to twice beyond its span.
+static uint64_t random_delay(std::mt19937_64 &generator) {
+  int level = generator() % (TIMING_WHEEL_LEVELS + 1);
+  uint64_t span = WHEEL_SPAN * 3;
+  if (level < TIMING_WHEEL_LEVELS) {
+    span = (uint64_t) 1 << (TIMING_WHEEL_SLOT_BITS * (level + 1));
+  }
+  return generator() % span;
+}
+
+static bool check(size_t operations) {
+  std::vector<Tracked> entries(ENTRY_COUNT);
+  TimingWheel wheel;
+  checked_wheel = &wheel;
+  for (Tracked &tracked : entries) {
+    tracked.entry.expire = &check_expiry;
+    tracked.entry.owner = &tracked;
+    tracked.scheduled = false;
+  }
+  std::mt19937_64 generator(SEED);
+  for (size_t i = 0; i < operations; i++) {
+    Tracked &tracked = entries[generator() % ENTRY_COUNT];
+    int operation = generator() % 8;
+    if (operation < 5) {
+      // A deadline before the current tick expires on the next tick.
+      uint64_t deadline = wheel.now() + random_delay(generator);
+      deadline = deadline >= 2 && generator() % 16 == 0 ? deadline - 2 : deadline;
+      wheel.schedule(tracked.entry, deadline);
+      tracked.due = std::max(deadline, wheel.now());
+      tracked.scheduled = true;
+    } else if (operation == 5) {
+      wheel.cancel(tracked.entry);
+      tracked.scheduled = false;
+    } else {
+      wheel.advance(wheel.now() + (generator() % 64 == 0 ? generator() % LONG_ADVANCE : generator() % 4));
+    }
+  }
+  wheel.advance(wheel.now() + WHEEL_SPAN * 3);
+  size_t remaining = 0;
+  for (Tracked &tracked : entries) {
+    remaining += tracked.scheduled || tracked.entry.is_scheduled();
+  }
+  printf("Differential check: %zu operations, %zu expiries, %zu mismatches, %zu entries never expired\n",
+    operations, expired, mismatches, remaining);
+  return mismatches == 0 && remaining == 0 && wheel.size() == 0;
+}
+
+static void ignore_expiry(TimerEntry&) {
+}
+
+// Refreshes the deadline of one entry per relayed chunk, as the relay does, and returns the refreshes per second.
+static double measure_wheel() {
+  std::vector<TimerEntry> entries(ENTRY_COUNT);
+  TimingWheel wheel;
+  for (TimerEntry &entry : entries) {
+    entry.expire = &ignore_expiry;
+    wheel.schedule(entry, 9000);
+  }
+  size_t refreshes = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {
+      wheel.schedule(entries[(i * 7919) % ENTRY_COUNT], wheel.now() + 9000);
+    }
+    refreshes += ENTRY_COUNT;
+    wheel.advance(wheel.now() + 1);
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  return refreshes / std::chrono::duration<double>(elapsed).count();
+}
+
+// Re-arms one timer per relayed chunk, cancelling its pending wait, and returns the re-arms per second.
+static double measure_timers() {
+  boost::asio::io_context io;
+  std::vector<std::unique_ptr<boost::asio::steady_timer>> timers;
+  for (size_t i = 0; i < ENTRY_COUNT; i++) {
+    timers.push_back(std::make_unique<boost::asio::steady_timer>(io));
+  }
+  size_t refreshes = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {
+      boost::asio::steady_timer &timer = *timers[(i * 7919) % ENTRY_COUNT];
+      timer.expires_after(std::chrono::seconds(900));
+      timer.async_wait([](const boost::system::error_code&) {});
+    }
+    refreshes += ENTRY_COUNT;
+    io.poll();
+    io.restart();
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  for (std::unique_ptr<boost::asio::steady_timer> &timer : timers) {
+    timer->cancel();
+  }
+  io.poll();
+  return refreshes / std::chrono::duration<double>(elapsed).count();
+}
+
+int main(int argc, char * argv[]) {
+  size_t operations = argc > 1 ? atol(argv[1]) : DEFAULT_OPERATIONS;
+  if (!check(operations)) {
+    return 1;
+  }
+  double wheel = measure_wheel();
+  double timers = measure_timers();
+  printf("%14s %14s\n", "", "refreshes/s");
+  printf("%14s %14.0f\n", "steady_timer", timers);
+  printf("%14s %14.0f\n", "timing wheel", wheel);
+  printf("%14s %13.1fx\n", "speedup", wheel / timers);
+  return 0;
+}
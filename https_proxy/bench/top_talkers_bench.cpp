@@ -0,0 +1,144 @@
+// Checks the guarantees of the Space-Saving summary against exact totals on a skewed stream of weighted keys, alone and
+// merged from summaries of parts of the stream, then measures how many updates it handles per second.
+// Usage: ./top_talkers_bench [UPDATE_COUNT [CAPACITY]]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "top_talkers.hpp"
+
+#define DEFAULT_UPDATES 1000000
+#define DISTINCT_KEYS 100000
+#define ZIPF_EXPONENT 1.1
+#define REPORTED_TALKERS 10
+// The stream is also dealt round robin to this many summaries, as to the shards of the proxy, which are then merged.
+#define MERGED_SHARDS 4
+#define MIN_DURATION std::chrono::milliseconds(300)
+#define SEED 3103
+
+// Draws key ranks with probability proportional to 1 / rank^ZIPF_EXPONENT.
+class ZipfDistribution {
+  public:
+    explicit ZipfDistribution(size_t count) : cumulative(count) {
+      double total = 0;
+      for (size_t rank = 0; rank < count; rank++) {
+        total += 1.0 / pow(rank + 1, ZIPF_EXPONENT);
+        cumulative[rank] = total;
+      }
+      uniform = std::uniform_real_distribution<double>(0, total);
+    }
+
+    size_t operator()(std::mt19937 &generator) {
+      return std::lower_bound(cumulative.begin(), cumulative.end(), uniform(generator)) - cumulative.begin();
+    }
+
+  private:
+    std::vector<double> cumulative;
+    std::uniform_real_distribution<double> uniform;
+};
+
+struct Accuracy {
+  size_t violations;
+  size_t missing;
+  size_t found;
+};
+
+// Counts the estimates whose bounds exclude the exact total, the keys with more than 1 / capacity of the total that are
+// not reported, and how many of the REPORTED_TALKERS largest keys are reported as such.
+static Accuracy check_accuracy(const std::vector<TalkerEstimate> &estimates,
+  std::unordered_map<std::string, uint64_t> &exact, const std::vector<std::pair<uint64_t, std::string>> &ranked,
+  uint64_t total, size_t capacity) {
+  Accuracy accuracy = {};
+  for (const TalkerEstimate &estimate : estimates) {
+    uint64_t count = exact[estimate.key];
+    if (count > estimate.count || count < estimate.count - estimate.error) {
+      accuracy.violations++;
+    }
+  }
+  for (const std::pair<uint64_t, std::string> &entry : ranked) {
+    bool tracked = std::any_of(estimates.begin(), estimates.end(), [&entry](const TalkerEstimate &estimate) {
+      return estimate.key == entry.second;
+    });
+    // Space-Saving tracks every key whose share of the total exceeds 1 / capacity.
+    if (entry.first > total / capacity && !tracked) {
+      accuracy.missing++;
+    }
+  }
+  for (size_t i = 0; i < REPORTED_TALKERS && i < ranked.size() && i < estimates.size(); i++) {
+    for (size_t j = 0; j < REPORTED_TALKERS && j < estimates.size(); j++) {
+      accuracy.found += estimates[j].key == ranked[i].second;
+    }
+  }
+  return accuracy;
+}
+
+int main(int argc, char * argv[]) {
+  size_t updates = argc > 1 ? atol(argv[1]) : DEFAULT_UPDATES;
+  size_t capacity = argc > 2 ? atol(argv[2]) : DEFAULT_TOP_TALKERS;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < DISTINCT_KEYS; i++) {
+    keys.push_back("host" + std::to_string(i * 7919 % DISTINCT_KEYS) + ".example.com");
+  }
+  std::mt19937 generator(SEED);
+  ZipfDistribution zipf(DISTINCT_KEYS);
+  std::uniform_int_distribution<uint64_t> weight(1, 1 << 20);
+  std::vector<std::pair<size_t, uint64_t>> stream;
+  for (size_t i = 0; i < updates; i++) {
+    stream.push_back({zipf(generator), weight(generator)});
+  }
+
+  SpaceSaving summary(capacity);
+  std::vector<SpaceSaving> shards;
+  for (size_t i = 0; i < MERGED_SHARDS; i++) {
+    shards.emplace_back(capacity);
+  }
+  std::unordered_map<std::string, uint64_t> exact;
+  uint64_t total = 0;
+  for (size_t i = 0; i < stream.size(); i++) {
+    summary.add(keys[stream[i].first], stream[i].second);
+    shards[i % MERGED_SHARDS].add(keys[stream[i].first], stream[i].second);
+    exact[keys[stream[i].first]] += stream[i].second;
+    total += stream[i].second;
+  }
+  std::vector<const SpaceSaving*> summaries;
+  for (const SpaceSaving &shard : shards) {
+    summaries.push_back(&shard);
+  }
+  std::vector<std::pair<uint64_t, std::string>> ranked;
+  for (std::pair<const std::string, uint64_t> &entry : exact) {
+    ranked.push_back({entry.second, entry.first});
+  }
+  std::sort(ranked.rbegin(), ranked.rend());
+  Accuracy single = check_accuracy(summary.top(), exact, ranked, total, capacity);
+  // Every key tracked by a shard is kept, as the guarantee only covers the union of the shards' keys.
+  Accuracy merged = check_accuracy(SpaceSaving::merge(summaries, MERGED_SHARDS * capacity), exact, ranked, total,
+    capacity);
+  printf("Accuracy check: %zu updates over %zu keys, capacity %zu, %zu bound violations, %zu heavy hitters missing, "
+    "top %d recall %zu/%d\n", updates, exact.size(), capacity, single.violations, single.missing, REPORTED_TALKERS,
+    single.found, REPORTED_TALKERS);
+  printf("Merged %d shards: %zu bound violations, %zu heavy hitters missing, top %d recall %zu/%d\n", MERGED_SHARDS,
+    merged.violations, merged.missing, REPORTED_TALKERS, merged.found, REPORTED_TALKERS);
+  if (single.violations > 0 || single.missing > 0 || merged.violations > 0 || merged.missing > 0) {
+    return 1;
+  }
+
+  size_t added = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (std::pair<size_t, uint64_t> &update : stream) {
+      summary.add(keys[update.first], update.second);
+    }
+    added += stream.size();
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  printf("%14s %14.0f updates/s\n", "space saving", added / std::chrono::duration<double>(elapsed).count());
+  return 0;
+}
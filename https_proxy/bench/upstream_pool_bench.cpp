@@ -0,0 +1,221 @@
+// Checks the idle connections kept by the UpstreamPool of a shard, using connections to a listener on loopback: the
+// most recently released connection to a key is handed out first, a key keeps at most UPSTREAM_POOL_HOST_SIZE
+// connections and the shard at most the configured number, and a connection is dropped when the server closes it or
+// sends anything while it is idle, and once its idle timeout passes. Connections dropped by the pool are checked to be
+// closed from the server side. Then measures a release followed by an acquire.
+// Usage: ./upstream_pool_bench
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "bench.hpp"
+#include "context.hpp"
+#include "metrics.hpp"
+#include "shard.hpp"
+#include "upstream_pool.hpp"
+
+#define TOTAL_POOL_SIZE 4
+#define IDLE_TIMEOUT 1
+// How long the server end of a connection takes to be noticed by the shard.
+#define CLOSE_TIMEOUT std::chrono::seconds(2)
+#define CLOSE_POLL_INTERVAL std::chrono::milliseconds(10)
+#define MIN_DURATION std::chrono::milliseconds(300)
+
+// Connections to the listener, with the server end of each kept by the check.
+class Servers {
+  public:
+    explicit Servers(Shard &shard) : shard(shard), acceptor(io, boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::address_v4::loopback(), 0)) {
+    }
+
+    // Returns a connection made on the shard, and keeps its server end under the port of the connection.
+    boost::asio::ip::tcp::socket connect() {
+      boost::asio::ip::tcp::socket client(this->shard.io);
+      client.connect(this->acceptor.local_endpoint());
+      this->accepted.emplace_back(client.local_endpoint().port(), this->acceptor.accept());
+      return client;
+    }
+
+    boost::asio::ip::tcp::socket &server_of(unsigned short port) {
+      for (std::pair<unsigned short, boost::asio::ip::tcp::socket> &server : this->accepted) {
+        if (server.first == port) {
+          return server.second;
+        }
+      }
+      return this->accepted.front().second;
+    }
+
+    // Whether the pool closed the connection with the port, which the server end reads as the end of the stream.
+    bool is_closed(unsigned short port) {
+      boost::asio::ip::tcp::socket &server = this->server_of(port);
+      server.non_blocking(true);
+      boost::system::error_code error;
+      char byte;
+      for (std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + CLOSE_TIMEOUT;
+        std::chrono::steady_clock::now() < deadline; std::this_thread::sleep_for(CLOSE_POLL_INTERVAL)) {
+        server.read_some(boost::asio::buffer(&byte, 1), error);
+        if (error != boost::asio::error::would_block) {
+          break;
+        }
+      }
+      return error == boost::asio::error::eof;
+    }
+
+  private:
+    Shard &shard;
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::vector<std::pair<unsigned short, boost::asio::ip::tcp::socket>> accepted;
+};
+
+static uint64_t counted(const MetricsSnapshot &before, MetricCounter counter) {
+  return Metrics::snapshot().counters[counter] - before.counters[counter];
+}
+
+// Releases new connections to the key and returns their ports, in the order they were released.
+static std::vector<unsigned short> release(Shard &shard, Servers &servers, const std::string &key, size_t count) {
+  std::vector<unsigned short> ports;
+  for (size_t i = 0; i < count; i++) {
+    boost::asio::ip::tcp::socket client = servers.connect();
+    ports.push_back(client.local_endpoint().port());
+    shard.upstreams.release(key, std::move(client));
+  }
+  return ports;
+}
+
+// Acquires connections to the key until there are none left, and returns their ports in the order they were acquired.
+static std::vector<unsigned short> drain(Shard &shard, const std::string &key) {
+  std::vector<unsigned short> ports;
+  boost::asio::ip::tcp::socket socket(shard.io);
+  while (shard.upstreams.acquire(key, socket)) {
+    ports.push_back(socket.local_endpoint().port());
+    socket.close();
+  }
+  return ports;
+}
+
+// Runs the handlers of the shard until the pool holds no more than the given number of connections.
+static bool settle(Shard &shard, size_t size) {
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + CLOSE_TIMEOUT;
+  while (shard.upstreams.size() > size && std::chrono::steady_clock::now() < deadline) {
+    shard.io.restart();
+    shard.io.run_for(CLOSE_POLL_INTERVAL);
+  }
+  return shard.upstreams.size() == size;
+}
+
+static void check_order(Shard &shard, Servers &servers) {
+  MetricsSnapshot before = Metrics::snapshot();
+  std::vector<unsigned short> released = release(shard, servers, "lifo.example:80", 3);
+  release(shard, servers, "other.example:80", 1);
+  std::vector<unsigned short> acquired = drain(shard, "lifo.example:80");
+  expect(acquired == std::vector<unsigned short> {released[2], released[1], released[0]},
+    "Most recently released connection is acquired first");
+  expect(shard.upstreams.size() == 1, "Acquiring a key leaves the other keys");
+  expect(counted(before, UPSTREAM_POOL_RELEASES) == 4 && counted(before, UPSTREAM_POOL_HITS) == 3
+    && counted(before, UPSTREAM_POOL_MISSES) == 1, "Releases, hits and misses are counted");
+  drain(shard, "other.example:80");
+}
+
+static void check_limits(Shard &shard, Servers &servers) {
+  MetricsSnapshot before = Metrics::snapshot();
+  std::vector<unsigned short> released = release(shard, servers, "busy.example:80", UPSTREAM_POOL_HOST_SIZE + 2);
+  expect(shard.upstreams.size() == UPSTREAM_POOL_HOST_SIZE && counted(before, UPSTREAM_POOL_EVICTIONS) == 2,
+    "A key keeps at most UPSTREAM_POOL_HOST_SIZE connections");
+  expect(servers.is_closed(released[0]) && servers.is_closed(released[1]),
+    "Oldest connections to the key are closed to make room");
+  std::vector<unsigned short> acquired = drain(shard, "busy.example:80");
+  expect(acquired.size() == UPSTREAM_POOL_HOST_SIZE && acquired.back() == released[2],
+    "Newer connections to the key are kept");
+
+  ctx.upstream_pool_size = TOTAL_POOL_SIZE;
+  std::vector<unsigned short> kept;
+  std::vector<unsigned short> refused;
+  for (int i = 0; i < TOTAL_POOL_SIZE + 2; i++) {
+    std::vector<unsigned short> ports = release(shard, servers, "host" + std::to_string(i) + ".example:80", 1);
+    (i < TOTAL_POOL_SIZE ? kept : refused).push_back(ports[0]);
+  }
+  expect(shard.upstreams.size() == TOTAL_POOL_SIZE && servers.is_closed(refused[0]) && servers.is_closed(refused[1]),
+    "A shard keeps at most the configured number of connections");
+  boost::asio::ip::tcp::socket socket(shard.io);
+  expect(!shard.upstreams.acquire("host" + std::to_string(TOTAL_POOL_SIZE) + ".example:80", socket)
+    && shard.upstreams.acquire("host0.example:80", socket) && socket.local_endpoint().port() == kept[0],
+    "Connections released past the limit are not kept");
+  for (int i = 1; i < TOTAL_POOL_SIZE; i++) {
+    drain(shard, "host" + std::to_string(i) + ".example:80");
+  }
+  ctx.upstream_pool_size = DEFAULT_UPSTREAM_POOL_SIZE;
+}
+
+static void check_server_close(Shard &shard, Servers &servers) {
+  MetricsSnapshot before = Metrics::snapshot();
+  std::vector<unsigned short> released = release(shard, servers, "closing.example:80", 2);
+  servers.server_of(released[0]).close();
+  expect(settle(shard, 1) && counted(before, UPSTREAM_POOL_EVICTIONS) == 1,
+    "Connection closed by the server is dropped");
+  boost::asio::write(servers.server_of(released[1]), boost::asio::buffer("x", 1));
+  expect(settle(shard, 0) && counted(before, UPSTREAM_POOL_EVICTIONS) == 2,
+    "Connection the server sends to while idle is dropped");
+
+  // Without running the handlers, the closed connection is only found when it is acquired.
+  released = release(shard, servers, "closing.example:80", 2);
+  servers.server_of(released[1]).close();
+  std::this_thread::sleep_for(CLOSE_POLL_INTERVAL);
+  boost::asio::ip::tcp::socket socket(shard.io);
+  bool acquired = shard.upstreams.acquire("closing.example:80", socket);
+  expect(acquired && socket.local_endpoint().port() == released[0] && counted(before, UPSTREAM_POOL_EVICTIONS) == 3,
+    "Acquire skips a connection the server has closed");
+}
+
+static void check_expiry(Shard &shard, Servers &servers) {
+  MetricsSnapshot before = Metrics::snapshot();
+  ctx.upstream_idle_timeout = IDLE_TIMEOUT;
+  std::vector<unsigned short> released = release(shard, servers, "idle.example:80", 2);
+  shard.wheel.advance(shard.deadline_after(std::chrono::milliseconds(IDLE_TIMEOUT * 1000 / 2)));
+  expect(shard.upstreams.size() == 2, "Connection is kept within the idle timeout");
+  shard.wheel.advance(shard.deadline_after(std::chrono::seconds(IDLE_TIMEOUT)));
+  expect(shard.upstreams.size() == 0 && counted(before, UPSTREAM_POOL_EVICTIONS) == 2,
+    "Connection is dropped once the idle timeout passes");
+  expect(servers.is_closed(released[0]) && servers.is_closed(released[1]), "Expired connections are closed");
+  ctx.upstream_idle_timeout = DEFAULT_UPSTREAM_IDLE_TIMEOUT;
+}
+
+// Returns the releases and acquires of one connection per second.
+static double measure_reuse(Shard &shard, Servers &servers) {
+  boost::asio::ip::tcp::socket socket = servers.connect();
+  size_t reuses = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration elapsed;
+  do {
+    for (int i = 0; i < 1000; i++) {
+      shard.upstreams.release("measured.example:80", std::move(socket));
+      reuses += shard.upstreams.acquire("measured.example:80", socket);
+    }
+    // Runs the cancelled waits of the connections that left the pool.
+    shard.io.restart();
+    shard.io.poll();
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed < MIN_DURATION);
+  return reuses / std::chrono::duration<double>(elapsed).count();
+}
+
+int main() {
+  ctx.logger.set_logging_level(ERROR);
+  {
+    Shard shard(0);
+    Servers servers(shard);
+    check_order(shard, servers);
+    check_limits(shard, servers);
+    check_server_close(shard, servers);
+    check_expiry(shard, servers);
+    printf("Reuses: %.0f/s\n", measure_reuse(shard, servers));
+  }
+  ctx.logger.close();
+  return bench_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+// Checks that directions of tunnels whose receivers stop reading cannot starve the other tunnels of a shard of io_uring
+// buffers. Stalled directions are fed until they stop receiving, and keep being fed next to active directions that
+// relay in both ends. Every direction must stay within its budget of buffers while each active one keeps relaying.
+// Then prints the throughput of the active directions. Channels are relayed between socket pairs, without a proxy.
+// Usage: ./uring_relay_bench [STALLED_COUNT]
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "bench.hpp"
+#include "uring_relay.hpp"
+
+// Enough stalled directions to take every buffer of the ring at the full budget of each.
+#define DEFAULT_STALLED (2 * URING_BUFFER_COUNT / URING_CHANNEL_BUFFERS)
+#define ACTIVE 8
+#define FILL_DURATION std::chrono::milliseconds(300)
+#define MEASURE_DURATION std::chrono::seconds(1)
+#define RELEASE_TIMEOUT std::chrono::seconds(2)
+#define CHUNK_SIZE 65536
+// Each active direction must relay at least this much while the stalled ones hold their buffers.
+#define MIN_ACTIVE_BYTES (1024 * 1024)
+
+// The relay reads input[0] and writes output[0]. The bench writes input[1] and, unless stalled, reads output[1].
+struct Direction {
+  UringChannel channel;
+  int input[2] = {-1, -1};
+  int output[2] = {-1, -1};
+  bool stalled = false;
+  uint64_t sent = 0;
+  size_t peak = 0;
+  bool released = false;
+};
+
+static char chunk[CHUNK_SIZE];
+
+static void handle(UringChannel &channel, UringEvent event, size_t bytes) {
+  Direction *direction = static_cast<Direction*>(channel.owner);
+  if (event == URING_RECEIVED) {
+    direction->peak = std::max(direction->peak, channel.queued);
+  } else if (event == URING_SENT) {
+    direction->sent += bytes;
+  } else if (event == URING_RELEASED) {
+    direction->released = true;
+  }
+}
+
+static bool open_direction(Direction &direction, bool stalled) {
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, direction.input) != 0
+    || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, direction.output) != 0) {
+    return false;
+  }
+  fcntl(direction.input[1], F_SETFL, O_NONBLOCK);
+  fcntl(direction.output[1], F_SETFL, O_NONBLOCK);
+  direction.stalled = stalled;
+  direction.channel.read_fd = direction.input[0];
+  direction.channel.write_fd = direction.output[0];
+  direction.channel.owner = &direction;
+  direction.channel.handle = handle;
+  return true;
+}
+
+// Writes into the direction until its input is full, and drains its output unless it is stalled.
+static void pump(Direction &direction) {
+  while (write(direction.input[1], chunk, CHUNK_SIZE) > 0) {
+  }
+  while (!direction.stalled && read(direction.output[1], chunk, CHUNK_SIZE) > 0) {
+  }
+}
+
+static void run(boost::asio::io_context &io, std::vector<std::unique_ptr<Direction>> &directions,
+  std::chrono::steady_clock::duration duration, bool active) {
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end) {
+    io.poll();
+    for (std::unique_ptr<Direction> &direction : directions) {
+      if (direction->stalled || active) {
+        pump(*direction);
+      }
+    }
+  }
+}
+
+int main(int argc, char * argv[]) {
+  size_t stalled_count = argc > 1 ? atol(argv[1]) : DEFAULT_STALLED;
+  boost::asio::io_context io(1);
+  std::unique_ptr<UringRelay> relay = UringRelay::is_supported() ? UringRelay::create(io) : nullptr;
+  if (!relay) {
+    printf("io_uring relay not supported, skipped\n");
+    return 0;
+  }
+  std::vector<std::unique_ptr<Direction>> directions;
+  for (size_t i = 0; i < stalled_count + ACTIVE; i++) {
+    directions.push_back(std::make_unique<Direction>());
+    if (!open_direction(*directions.back(), i < stalled_count)) {
+      perror("socketpair");
+      return 1;
+    }
+    relay->start(directions.back()->channel);
+  }
+  run(io, directions, FILL_DURATION, false);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  run(io, directions, MEASURE_DURATION, true);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t held = 0;
+  size_t peak = 0;
+  uint64_t active_bytes = 0;
+  uint64_t least_active_bytes = UINT64_MAX;
+  for (std::unique_ptr<Direction> &direction : directions) {
+    peak = std::max(peak, direction->peak);
+    if (direction->stalled) {
+      held += direction->channel.queued;
+    } else {
+      active_bytes += direction->sent;
+      least_active_bytes = std::min(least_active_bytes, direction->sent);
+    }
+  }
+  printf("%zu stalled directions hold %zu of %d buffers, at most %zu each\n", stalled_count, held, URING_BUFFER_COUNT,
+    peak);
+  expect(peak <= URING_CHANNEL_BUFFERS, "Directions hold at most URING_CHANNEL_BUFFERS buffers");
+  // Each stalled direction may have had a single-shot receive armed when only the reserve was left.
+  expect(held <= URING_BUFFER_COUNT - URING_RESERVED_BUFFERS + stalled_count,
+    "Stalled directions leave the reserved buffers");
+  expect(least_active_bytes >= MIN_ACTIVE_BYTES, "Every active direction relays next to the stalled ones");
+
+  for (std::unique_ptr<Direction> &direction : directions) {
+    relay->stop(direction->channel);
+    shutdown(direction->input[0], SHUT_RDWR);
+    shutdown(direction->output[0], SHUT_RDWR);
+  }
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + RELEASE_TIMEOUT;
+  bool released = false;
+  while (!released && std::chrono::steady_clock::now() < deadline) {
+    io.run_for(std::chrono::milliseconds(10));
+    released = std::all_of(directions.begin(), directions.end(), [](const std::unique_ptr<Direction> &direction) {
+      return direction->released;
+    });
+  }
+  expect(released, "Every direction is released once stopped");
+  if (!released) {
+    // The kernel may still write to the channels.
+    relay.release();
+    return 1;
+  }
+  for (std::unique_ptr<Direction> &direction : directions) {
+    for (int fd : {direction->input[0], direction->input[1], direction->output[0], direction->output[1]}) {
+      close(fd);
+    }
+  }
+  printf("%zu active directions: %.0f MB/s\n", (size_t) ACTIVE, active_bytes / elapsed / 1e6);
+  return bench_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+#include "admission.hpp"
+
+Admission::Admission() : shed_policy(PAUSE_ACCEPTING), accept_pauses(0) {
+  for (int slot = 0; slot < ADMISSION_SLOTS; slot++) {
+    this->limits[slot] = NO_LIMIT;
+    this->in_use[slot] = 0;
+    this->shed[slot] = 0;
+  }
+}
+
+void Admission::set_limit(AdmissionSlot slot, size_t limit) {
+  this->limits[slot] = limit;
+}
+
+void Admission::set_policy(ShedPolicy policy) {
+  this->shed_policy = policy;
+}
+
+ShedPolicy Admission::policy() const {
+  return this->shed_policy;
+}
+
+// Takes a slot, or counts the request as shed when the limit is already reached.
+bool Admission::acquire(AdmissionSlot slot) {
+  size_t previous = this->in_use[slot].fetch_add(1, std::memory_order_relaxed);
+  if (this->limits[slot] == NO_LIMIT || previous < this->limits[slot]) {
+    return true;
+  }
+  this->in_use[slot].fetch_sub(1, std::memory_order_relaxed);
+  this->shed[slot].fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void Admission::release(AdmissionSlot slot) {
+  this->in_use[slot].fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Whether any limit is reached, in which case accepting another connection would only lead to it being shed.
+bool Admission::is_saturated() const {
+  for (int slot = 0; slot < ADMISSION_SLOTS; slot++) {
+    if (this->limits[slot] != NO_LIMIT && this->in_use[slot].load(std::memory_order_relaxed) >= this->limits[slot]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Admission::record_pause() {
+  this->accept_pauses.fetch_add(1, std::memory_order_relaxed);
+}
+
+AdmissionStatistics Admission::statistics() const {
+  return AdmissionStatistics {
+    .tunnels = this->in_use[TUNNEL_SLOT],
+    .handshakes = this->in_use[HANDSHAKE_SLOT],
+    .lookups = this->in_use[LOOKUP_SLOT],
+    .shed_tunnels = this->shed[TUNNEL_SLOT],
+    .shed_handshakes = this->shed[HANDSHAKE_SLOT],
+    .shed_lookups = this->shed[LOOKUP_SLOT],
+    .accept_pauses = this->accept_pauses
+  };
+}
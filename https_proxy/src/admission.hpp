@@ -0,0 +1,55 @@
+#ifndef HTTPS_PROXY_ADMISSION_HPP_
+#define HTTPS_PROXY_ADMISSION_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#define NO_LIMIT 0
+// How often a shard that stopped accepting checks whether it may accept again.
+#define ACCEPT_RETRY_INTERVAL std::chrono::milliseconds(10)
+
+enum AdmissionSlot {TUNNEL_SLOT = 0, HANDSHAKE_SLOT = 1, LOOKUP_SLOT = 2, ADMISSION_SLOTS = 3};
+
+// What happens to new connections while a limit is reached. Connections that
+// still get accepted, and requests whose lookup would exceed the lookup limit,
+// are always answered with 503.
+enum ShedPolicy {PAUSE_ACCEPTING = 0, REJECT_REQUESTS = 1};
+
+struct AdmissionStatistics {
+  uint64_t tunnels;
+  uint64_t handshakes;
+  uint64_t lookups;
+  uint64_t shed_tunnels;
+  uint64_t shed_handshakes;
+  uint64_t shed_lookups;
+  uint64_t accept_pauses;
+};
+
+// Limits on the number of open tunnels, of tunnels still waiting for their
+// request header and of pending hostname lookups, shared by all shards. A
+// tunnel holds a slot of each kind while it is in the corresponding state.
+// Slots are taken with a single atomic increment, so the limits are never
+// exceeded even while several shards admit connections at the same time.
+class Admission {
+  public:
+    Admission();
+    void set_limit(AdmissionSlot, size_t);
+    void set_policy(ShedPolicy);
+    ShedPolicy policy() const;
+    bool acquire(AdmissionSlot);
+    void release(AdmissionSlot);
+    bool is_saturated() const;
+    void record_pause();
+    AdmissionStatistics statistics() const;
+
+  private:
+    ShedPolicy shed_policy;
+    size_t limits[ADMISSION_SLOTS];
+    std::atomic<size_t> in_use[ADMISSION_SLOTS];
+    std::atomic<uint64_t> shed[ADMISSION_SLOTS];
+    std::atomic<uint64_t> accept_pauses;
+};
+
+#endif  // HTTPS_PROXY_ADMISSION_HPP_
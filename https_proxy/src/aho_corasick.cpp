@@ -0,0 +1,157 @@
+#include "aho_corasick.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define ROOT_STATE 0
+#define NO_STATE UINT32_MAX
+#define NO_CLASS 0
+
+AhoCorasick::AhoCorasick(const std::vector<std::string> &patterns) : match_all(false) {
+  // Assign an equivalence class to every byte used by a pattern. Bytes outside
+  // the patterns share NO_CLASS, which always leads back to the root.
+  bool used[256] = {false};
+  for (const std::string &pattern : patterns) {
+    if (pattern.empty()) {
+      this->match_all = true;
+    }
+    for (unsigned char byte : pattern) {
+      used[byte] = true;
+    }
+  }
+  uint16_t class_count = 1;
+  for (int byte = 0; byte < 256; byte++) {
+    this->byte_class[byte] = used[byte] ? class_count++ : NO_CLASS;
+  }
+
+  // Build a temporary trie using sibling lists to keep construction memory linear in the number of nodes.
+  std::vector<uint32_t> first_child(1, NO_STATE);
+  std::vector<uint32_t> next_sibling(1, NO_STATE);
+  std::vector<uint16_t> node_class(1, NO_CLASS);
+  std::vector<bool> node_terminal(1, false);
+  for (const std::string &pattern : patterns) {
+    uint32_t node = ROOT_STATE;
+    for (unsigned char byte : pattern) {
+      uint16_t cls = this->byte_class[byte];
+      uint32_t child = first_child[node];
+      while (child != NO_STATE && node_class[child] != cls) {
+        child = next_sibling[child];
+      }
+      if (child == NO_STATE) {
+        child = first_child.size();
+        first_child.push_back(NO_STATE);
+        next_sibling.push_back(first_child[node]);
+        node_class.push_back(cls);
+        node_terminal.push_back(false);
+        first_child[node] = child;
+      }
+      node = child;
+    }
+    node_terminal[node] = true;
+  }
+
+  // Renumber the nodes in breadth-first order, storing the edges of each state contiguously and sorted by class.
+  this->states.resize(first_child.size());
+  this->edge_classes.reserve(first_child.size() - 1);
+  this->edge_targets.reserve(first_child.size() - 1);
+  std::vector<uint32_t> order(1, ROOT_STATE);
+  std::vector<std::pair<uint16_t, uint32_t>> children;
+  for (size_t position = 0; position < order.size(); position++) {
+    uint32_t node = order[position];
+    children.clear();
+    for (uint32_t child = first_child[node]; child != NO_STATE; child = next_sibling[child]) {
+      children.push_back(std::make_pair(node_class[child], child));
+    }
+    std::sort(children.begin(), children.end());
+    State &state = this->states[position];
+    state.first_edge = this->edge_classes.size();
+    state.edge_count = children.size();
+    state.terminal = node_terminal[node];
+    state.fail = ROOT_STATE;
+    for (std::pair<uint16_t, uint32_t> &child : children) {
+      this->edge_classes.push_back(child.first);
+      this->edge_targets.push_back(order.size());
+      order.push_back(child.second);
+    }
+  }
+
+  this->root_transitions.assign(class_count, ROOT_STATE);
+  for (uint32_t edge = 0; edge < this->states[ROOT_STATE].edge_count; edge++) {
+    this->root_transitions[this->edge_classes[edge]] = this->edge_targets[edge];
+  }
+
+  // Compute failure links in breadth-first order, so the failure state of every
+  // state is complete before it is used. A state is terminal if any suffix of
+  // the path leading to it is a pattern.
+  for (uint32_t current = 0; current < this->states.size(); current++) {
+    const State &state = this->states[current];
+    for (uint32_t edge = state.first_edge; edge < state.first_edge + state.edge_count; edge++) {
+      uint16_t cls = this->edge_classes[edge];
+      uint32_t target = this->edge_targets[edge];
+      uint32_t fallback = state.fail;
+      while (fallback != ROOT_STATE && this->find_edge(fallback, cls) == NO_STATE) {
+        fallback = this->states[fallback].fail;
+      }
+      uint32_t fail = this->find_edge(fallback, cls);
+      this->states[target].fail = (fail == NO_STATE || fail == target) ? ROOT_STATE : fail;
+      this->states[target].terminal = this->states[target].terminal || this->states[this->states[target].fail].terminal;
+    }
+  }
+}
+
+bool AhoCorasick::matches(const std::string &text) const {
+  if (this->match_all) {
+    return true;
+  }
+  if (this->states.size() == 1) {
+    return false;
+  }
+  uint32_t state = ROOT_STATE;
+  for (unsigned char byte : text) {
+    uint16_t cls = this->byte_class[byte];
+    if (cls == NO_CLASS) {
+      state = ROOT_STATE;
+      continue;
+    }
+    state = this->next_state(state, cls);
+    if (this->states[state].terminal) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t AhoCorasick::state_count() const {
+  return this->states.size();
+}
+
+size_t AhoCorasick::memory_usage() const {
+  return this->states.size() * sizeof(State) + this->edge_classes.size() * sizeof(uint16_t) +
+    this->edge_targets.size() * sizeof(uint32_t) + this->root_transitions.size() * sizeof(uint32_t);
+}
+
+uint32_t AhoCorasick::find_edge(uint32_t current, uint16_t cls) const {
+  const State &state = this->states[current];
+  const uint16_t *begin = this->edge_classes.data() + state.first_edge;
+  const uint16_t *end = begin + state.edge_count;
+  const uint16_t *found = std::lower_bound(begin, end, cls);
+  if (found == end || *found != cls) {
+    return NO_STATE;
+  }
+  return this->edge_targets[found - this->edge_classes.data()];
+}
+
+uint32_t AhoCorasick::next_state(uint32_t current, uint16_t cls) const {
+  while (current != ROOT_STATE) {
+    uint32_t target = this->find_edge(current, cls);
+    if (target != NO_STATE) {
+      return target;
+    }
+    current = this->states[current].fail;
+  }
+  return this->root_transitions[cls];
+}
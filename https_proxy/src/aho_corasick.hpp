@@ -0,0 +1,39 @@
+#ifndef HTTPS_PROXY_AHO_CORASICK_HPP_
+#define HTTPS_PROXY_AHO_CORASICK_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Multi-pattern substring matcher. The automaton is compiled once into flat
+// arrays: bytes are mapped to equivalence classes of the bytes that occur in
+// the patterns, states are numbered in breadth-first order, and the outgoing
+// edges of each state are stored contiguously and sorted by class. The root
+// state has a dense transition row since most of the scan is spent there.
+class AhoCorasick {
+  public:
+    explicit AhoCorasick(const std::vector<std::string>&);
+    bool matches(const std::string&) const;
+    size_t state_count() const;
+    size_t memory_usage() const;
+
+  private:
+    struct State {
+      uint32_t first_edge;
+      uint32_t fail;
+      uint16_t edge_count;
+      bool terminal;
+    };
+
+    uint16_t byte_class[256];
+    std::vector<State> states;
+    std::vector<uint16_t> edge_classes;
+    std::vector<uint32_t> edge_targets;
+    std::vector<uint32_t> root_transitions;
+    bool match_all;
+
+    uint32_t find_edge(uint32_t, uint16_t) const;
+    uint32_t next_state(uint32_t, uint16_t) const;
+};
+
+#endif  // HTTPS_PROXY_AHO_CORASICK_HPP_
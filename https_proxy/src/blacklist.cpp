@@ -1,24 +1,93 @@
 #include "blacklist.hpp"
 
+#include <atomic>
+#include <fstream>
 #include <memory>
+#include <mutex>
 
-Blacklist::Blacklist() : hostnames(std::make_unique<std::vector<std::string>>()) {
+// Generations are unique across all blacklists so that a thread's cached snapshot is never mistaken for another's.
+static std::atomic<uint64_t> next_generation(1);
+
+struct CachedSnapshot {
+	const void *owner = nullptr;
+	uint64_t generation = 0;
+	std::shared_ptr<const void> snapshot;
+};
+
+static thread_local CachedSnapshot cached_snapshot;
+
+Blacklist::Snapshot::Snapshot(std::unique_ptr<std::vector<std::string>> entries)
+	: generation(next_generation++), hostnames(std::move(entries)), matcher(*(this->hostnames)),
+	cache(this->matcher.state_count() < VERDICT_CACHE_MIN_STATES ? nullptr : std::make_unique<VerdictCache>()) {
+}
+
+Blacklist::Blacklist() : generation(0) {
+	this->publish(std::make_unique<std::vector<std::string>>());
 }
 
 void Blacklist::add_entries(std::unique_ptr<std::vector<std::string>> entries) {
-	this->hostnames = std::move(entries);
+	std::lock_guard<std::mutex> guard(this->update_lock);
+	this->publish(std::move(entries));
 }
 
 void Blacklist::add_entry(std::string entry) {
-	this->hostnames->push_back(entry);
+	std::lock_guard<std::mutex> guard(this->update_lock);
+	std::unique_ptr<std::vector<std::string>> entries = std::make_unique<std::vector<std::string>>(
+		*(std::atomic_load(&(this->snapshot))->hostnames));
+	entries->push_back(entry);
+	this->publish(std::move(entries));
+};
+
+bool Blacklist::is_blocked(const std::string &hostname) {
+	const Snapshot *snapshot = this->current();
+	if (!snapshot->cache) {
+		return snapshot->matcher.matches(hostname);
+	}
+	bool blocked;
+	if (snapshot->cache->lookup(hostname, blocked)) {
+		return blocked;
+	}
+	blocked = snapshot->matcher.matches(hostname);
+	snapshot->cache->store(hostname, blocked);
+	return blocked;
 };
 
-bool Blacklist::is_blocked(std::string hostname) {
-	for (std::vector<std::string>::iterator iter = this->hostnames->begin();
-		iter != this->hostnames->end(); iter++) {
-			if (hostname.find(*iter) != std::string::npos) {
-				return true;
-			}
+size_t Blacklist::size() {
+	return this->current()->hostnames->size();
+}
+
+std::unique_ptr<std::vector<std::string>> Blacklist::read_entries(const std::string &path) {
+	std::ifstream blacklist_file;
+	blacklist_file.open(path, std::ios::in);
+	if (!blacklist_file.is_open()) {
+		return nullptr;
+	}
+	std::unique_ptr<std::vector<std::string>> entries = std::make_unique<std::vector<std::string>>();
+	std::string buffer;
+	while (std::getline(blacklist_file, buffer)) {
+		if (buffer.size() > 0) {
+			entries->push_back(buffer);
 		}
-	return false;
-};
\ No newline at end of file
+	}
+	blacklist_file.close();
+	return entries;
+}
+
+// Returns the latest snapshot, reusing the calling thread's reference while no update has been published.
+// The snapshot is kept alive by that reference until the thread next observes an update.
+const Blacklist::Snapshot *Blacklist::current() {
+	uint64_t generation = this->generation.load(std::memory_order_acquire);
+	if (cached_snapshot.owner != this || cached_snapshot.generation != generation) {
+		std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&(this->snapshot));
+		cached_snapshot.owner = this;
+		cached_snapshot.generation = snapshot->generation;
+		cached_snapshot.snapshot = snapshot;
+	}
+	return static_cast<const Snapshot*>(cached_snapshot.snapshot.get());
+}
+
+void Blacklist::publish(std::unique_ptr<std::vector<std::string>> entries) {
+	std::shared_ptr<const Snapshot> snapshot = std::make_shared<const Snapshot>(std::move(entries));
+	std::atomic_store(&(this->snapshot), snapshot);
+	this->generation.store(snapshot->generation, std::memory_order_release);
+}
@@ -1,19 +1,48 @@
 #ifndef HTTPS_PROXY_BLACKLIST_HPP_
 #define HTTPS_PROXY_BLACKLIST_HPP_
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "aho_corasick.hpp"
+#include "verdict_cache.hpp"
+
+// Automatons smaller than this are scanned directly, as a scan is then cheaper than a cache lookup.
+#define VERDICT_CACHE_MIN_STATES 4096
+
+// Readers check hostnames against an immutable snapshot of the entries. Updates
+// compile a new snapshot on the calling thread and publish it atomically, and
+// each reading thread keeps its own reference to the latest snapshot it has
+// seen, so is_blocked only touches the shared snapshot pointer after an update.
 class Blacklist {
 	public:
 		Blacklist();
 		void add_entries(std::unique_ptr<std::vector<std::string>>);
 		void add_entry(std::string);
-		bool is_blocked(std::string);
+		bool is_blocked(const std::string&);
+		size_t size();
+
+		static std::unique_ptr<std::vector<std::string>> read_entries(const std::string&);
 
 	private:
-		std::unique_ptr<std::vector<std::string>> hostnames;
+		struct Snapshot {
+			explicit Snapshot(std::unique_ptr<std::vector<std::string>>);
+			uint64_t generation;
+			std::unique_ptr<std::vector<std::string>> hostnames;
+			AhoCorasick matcher;
+			std::unique_ptr<VerdictCache> cache;
+		};
+
+		std::shared_ptr<const Snapshot> snapshot;
+		std::atomic<uint64_t> generation;
+		std::mutex update_lock;
+
+		const Snapshot *current();
+		void publish(std::unique_ptr<std::vector<std::string>>);
 };
 
 #endif  // HTTPS_PROXY_BLACKLIST_HPP_
@@ -0,0 +1,96 @@
+#include "blacklist_reloader.hpp"
+
+#include <sys/stat.h>
+
+#include <csignal>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "context.hpp"
+
+BlacklistReloader::BlacklistReloader(Blacklist &blacklist, std::string path, int poll_interval)
+  : blacklist(blacklist), path(path), poll_interval(poll_interval), last_status(),
+    signals(reload_ctx, SIGHUP), poll_timer(reload_ctx) {
+  stat(this->path.c_str(), &(this->last_status));
+}
+
+BlacklistReloader::~BlacklistReloader() {
+  this->stop();
+}
+
+void BlacklistReloader::start() {
+  this->wait_signal();
+  if (this->poll_interval > 0) {
+    this->wait_poll();
+  }
+  this->thread = boost::thread(boost::bind(&boost::asio::io_context::run, &(this->reload_ctx)));
+}
+
+void BlacklistReloader::stop() {
+  this->reload_ctx.stop();
+  if (this->thread.joinable()) {
+    this->thread.join();
+  }
+}
+
+void BlacklistReloader::wait_signal() {
+  this->signals.async_wait(boost::bind(&BlacklistReloader::handle_signal, this,
+    boost::asio::placeholders::error, boost::asio::placeholders::signal_number));
+}
+
+void BlacklistReloader::handle_signal(const boost::system::error_code &error, int) {
+  if (error) {
+    return;
+  }
+  LOG_INFO(ctx.logger, "BlacklistReloader::handle_signal", "Received SIGHUP, reloading blacklist.");
+  struct stat status;
+  this->has_changed(status);
+  this->last_status = status;
+  this->reload();
+  this->wait_signal();
+}
+
+void BlacklistReloader::wait_poll() {
+  this->poll_timer.expires_after(std::chrono::seconds(this->poll_interval));
+  this->poll_timer.async_wait(boost::bind(&BlacklistReloader::handle_poll, this, boost::asio::placeholders::error));
+}
+
+void BlacklistReloader::handle_poll(const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+  struct stat status;
+  if (this->has_changed(status)) {
+    this->last_status = status;
+    LOG_INFO(ctx.logger, "BlacklistReloader::handle_poll", "Blacklist file changed, reloading.");
+    this->reload();
+  }
+  this->wait_poll();
+}
+
+void BlacklistReloader::reload() {
+  std::unique_ptr<std::vector<std::string>> entries = Blacklist::read_entries(this->path);
+  if (!entries) {
+    LOG_WARN(ctx.logger, "BlacklistReloader::reload", "Unable to read blacklist file: ", this->path);
+    return;
+  }
+  size_t size = entries->size();
+  this->blacklist.add_entries(std::move(entries));
+  LOG_INFO(ctx.logger, "BlacklistReloader::reload", "Reloaded blacklist with ", size, " entries.");
+}
+
+bool BlacklistReloader::has_changed(struct stat &status) {
+  if (stat(this->path.c_str(), &status) != 0) {
+    status = this->last_status;
+    return false;
+  }
+  return status.st_mtim.tv_sec != this->last_status.st_mtim.tv_sec ||
+    status.st_mtim.tv_nsec != this->last_status.st_mtim.tv_nsec ||
+    status.st_size != this->last_status.st_size ||
+    status.st_ino != this->last_status.st_ino;
+}
@@ -0,0 +1,43 @@
+#ifndef HTTPS_PROXY_BLACKLIST_RELOADER_HPP_
+#define HTTPS_PROXY_BLACKLIST_RELOADER_HPP_
+
+#include <sys/stat.h>
+
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include "blacklist.hpp"
+
+#define DEFAULT_BLACKLIST_POLL_INTERVAL 5
+
+// Reloads a blacklist from its file on SIGHUP, or when the modification time or
+// size of the file changes. The new entries are read and compiled on the
+// reloader's own thread before being published to the blacklist.
+class BlacklistReloader {
+  public:
+    BlacklistReloader(Blacklist&, std::string, int);
+    ~BlacklistReloader();
+    void start();
+    void stop();
+
+  private:
+    Blacklist &blacklist;
+    std::string path;
+    int poll_interval;
+    struct stat last_status;
+    boost::asio::io_context reload_ctx;
+    boost::asio::signal_set signals;
+    boost::asio::steady_timer poll_timer;
+    boost::thread thread;
+
+    void wait_signal();
+    void handle_signal(const boost::system::error_code&, int);
+    void wait_poll();
+    void handle_poll(const boost::system::error_code&);
+    void reload();
+    bool has_changed(struct stat&);
+};
+
+#endif  // HTTPS_PROXY_BLACKLIST_RELOADER_HPP_
@@ -0,0 +1,124 @@
+#include "buffer_pool.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+// Free lists and counters of one thread. The counters are only written by the
+// owning thread and are summed by BufferPool::statistics.
+struct LocalPool {
+  std::vector<char*> free_buffers[BUFFER_POOL_CLASSES];
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> releases;
+  std::atomic<uint64_t> discards;
+  std::atomic<uint64_t> pooled_buffers;
+  std::atomic<uint64_t> pooled_bytes;
+  std::atomic<uint64_t> acquired_bytes;
+  std::atomic<uint64_t> released_bytes;
+
+  LocalPool();
+  ~LocalPool();
+};
+
+static std::mutex registry_lock;
+static std::vector<LocalPool*> pools;
+// Counters of the threads that have exited.
+static BufferPoolStatistics retired = {0, 0, 0, 0, 0, 0, 0};
+static uint64_t retired_acquired_bytes = 0;
+static uint64_t retired_released_bytes = 0;
+
+static thread_local LocalPool local_pool;
+
+static void increment(std::atomic<uint64_t> &counter, uint64_t amount) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+LocalPool::LocalPool() : hits(0), misses(0), releases(0), discards(0), pooled_buffers(0), pooled_bytes(0),
+  acquired_bytes(0), released_bytes(0) {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  pools.push_back(this);
+}
+
+LocalPool::~LocalPool() {
+  for (std::vector<char*> &buffers : this->free_buffers) {
+    for (char *buffer : buffers) {
+      free(buffer);
+    }
+  }
+  std::lock_guard<std::mutex> guard(registry_lock);
+  retired.hits += this->hits.load(std::memory_order_relaxed);
+  retired.misses += this->misses.load(std::memory_order_relaxed);
+  retired.releases += this->releases.load(std::memory_order_relaxed);
+  retired.discards += this->discards.load(std::memory_order_relaxed);
+  retired_acquired_bytes += this->acquired_bytes.load(std::memory_order_relaxed);
+  retired_released_bytes += this->released_bytes.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < pools.size(); i++) {
+    if (pools[i] == this) {
+      pools.erase(pools.begin() + i);
+      break;
+    }
+  }
+}
+
+char* BufferPool::acquire(int size_class) {
+  LocalPool &pool = local_pool;
+  size_t size = BufferPool::class_size(size_class);
+  increment(pool.acquired_bytes, size);
+  std::vector<char*> &buffers = pool.free_buffers[size_class];
+  if (buffers.empty()) {
+    increment(pool.misses, 1);
+    return reinterpret_cast<char*>(malloc(sizeof(char) * size));
+  }
+  char *buffer = buffers.back();
+  buffers.pop_back();
+  increment(pool.hits, 1);
+  pool.pooled_buffers.store(pool.pooled_buffers.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+  pool.pooled_bytes.store(pool.pooled_bytes.load(std::memory_order_relaxed) - size, std::memory_order_relaxed);
+  return buffer;
+}
+
+void BufferPool::release(char *buffer, int size_class) {
+  if (buffer == nullptr) {
+    return;
+  }
+  LocalPool &pool = local_pool;
+  size_t size = BufferPool::class_size(size_class);
+  increment(pool.released_bytes, size);
+  increment(pool.releases, 1);
+  std::vector<char*> &buffers = pool.free_buffers[size_class];
+  if ((buffers.size() + 1) * size > BUFFER_POOL_CLASS_BYTES) {
+    increment(pool.discards, 1);
+    free(buffer);
+    return;
+  }
+  buffers.push_back(buffer);
+  increment(pool.pooled_buffers, 1);
+  increment(pool.pooled_bytes, size);
+}
+
+size_t BufferPool::class_size(int size_class) {
+  return (size_t) BUFFER_POOL_MIN_SIZE << size_class;
+}
+
+// Sums the counters of all threads. Buffers released on a different thread than they were acquired on are accounted
+// to the releasing thread, so only the totals are meaningful.
+BufferPoolStatistics BufferPool::statistics() {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  BufferPoolStatistics statistics = retired;
+  uint64_t acquired_bytes = retired_acquired_bytes;
+  uint64_t released_bytes = retired_released_bytes;
+  for (LocalPool *pool : pools) {
+    statistics.hits += pool->hits.load(std::memory_order_relaxed);
+    statistics.misses += pool->misses.load(std::memory_order_relaxed);
+    statistics.releases += pool->releases.load(std::memory_order_relaxed);
+    statistics.discards += pool->discards.load(std::memory_order_relaxed);
+    statistics.pooled_buffers += pool->pooled_buffers.load(std::memory_order_relaxed);
+    statistics.pooled_bytes += pool->pooled_bytes.load(std::memory_order_relaxed);
+    acquired_bytes += pool->acquired_bytes.load(std::memory_order_relaxed);
+    released_bytes += pool->released_bytes.load(std::memory_order_relaxed);
+  }
+  statistics.outstanding_bytes = acquired_bytes - released_bytes;
+  return statistics;
+}
@@ -0,0 +1,34 @@
+#ifndef HTTPS_PROXY_BUFFER_POOL_HPP_
+#define HTTPS_PROXY_BUFFER_POOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#define BUFFER_POOL_MIN_SIZE 4096
+#define BUFFER_POOL_CLASSES 7
+#define BUFFER_POOL_CLASS_BYTES (4 * 1024 * 1024)
+
+struct BufferPoolStatistics {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t releases;
+  uint64_t discards;
+  uint64_t pooled_buffers;
+  uint64_t pooled_bytes;
+  uint64_t outstanding_bytes;
+};
+
+// Relay buffers in power of two size classes from BUFFER_POOL_MIN_SIZE up to
+// 64 times that size. Each thread keeps its own free list per size class, so
+// acquiring and releasing a buffer takes no lock. A thread keeps at most
+// BUFFER_POOL_CLASS_BYTES of free buffers per size class and returns any
+// further released buffers to the allocator.
+class BufferPool {
+  public:
+    static char* acquire(int);
+    static void release(char*, int);
+    static size_t class_size(int);
+    static BufferPoolStatistics statistics();
+};
+
+#endif  // HTTPS_PROXY_BUFFER_POOL_HPP_
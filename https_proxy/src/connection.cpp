@@ -1,17 +1,25 @@
 #include "connection.hpp"
 
 #include <algorithm>
+#include <iterator>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <memory>
-#include <unordered_map>
-
-#include <boost/regex.hpp>
+#include <vector>
 
+#include "buffer_pool.hpp"
+#include "connector.hpp"
 #include "context.hpp"
+#include "header_buffer.hpp"
+#include "metrics.hpp"
+#include "request.hpp"
+#include "splice_pipe.hpp"
 
-static boost::regex STANDARD_REQUEST = boost::regex("^[A-Z]+ (\\S)+ HTTP\\/\\S+\\r\\n(\\S+:(\\S| )+\\r\\n)*\\r\\n$");
-static boost::regex REQUEST_LINE = boost::regex("^CONNECT (?<hostname>[^:]+)(?<port>:\\S+)? HTTP/(?<version>\\S+)\\r\\n");
+#define END_OF_MESSAGE "\r\n\r\n"
 
 #define CONNECTION_ESTABLISHED_LENGTH 39
 #define BAD_REQUEST_LENGTH 28
@@ -20,130 +28,746 @@ static boost::regex REQUEST_LINE = boost::regex("^CONNECT (?<hostname>[^:]+)(?<p
 #define METHOD_NOT_ALLOWED_LENGTH 35
 #define VERSION_NOT_SUPPORTED_LENGTH 43
 #define BAD_GATEWAY_LENGTH 28
+#define SERVICE_UNAVAILABLE_LENGTH 36
+#define REJECT_DRAIN_SIZE 4096
+// Offset of the status code in a formatted error response, after "HTTP/1.x ".
+#define STATUS_CODE_OFFSET 9
 
 static const char *const HTTP_CONNECTION_ESTABLISHED = "HTTP/1.%d 200 Connection established\r\n\r\n";
+static const char *const HTTP_CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
 static const char *const HTTP_BAD_REQUEST = "HTTP/1.%d 400 Bad Request\r\n\r\n";
 static const char *const HTTP_FORBIDDEN = "HTTP/1.%d 403 Forbidden\r\n\r\n";
 static const char *const HTTP_NOT_FOUND = "HTTP/1.%d 404 Not Found\r\n\r\n";
 static const char *const HTTP_METHOD_NOT_ALLOWED = "HTTP/1.%d 405 Method Not Allowed\r\n\r\n";
 static const char *const HTTP_VERSION_NOT_SUPPORTED = "HTTP/1.1 505 HTTP Version Not Supported\r\n\r\n";
 static const char *const HTTP_BAD_GATEWAY = "HTTP/1.%d 502 Bad Gateway\r\n\r\n";
+static const char *const HTTP_SERVICE_UNAVAILABLE = "HTTP/1.%d 503 Service Unavailable\r\n\r\n";
+// Methods a proxy may send again on its own when a connection fails before the response (RFC 9110 section 9.2.2).
+static const char *const IDEMPOTENT_METHODS[] = {"GET", "HEAD", "OPTIONS", "TRACE", "PUT", "DELETE"};
+
+Connection::Connection(boost::asio::ip::tcp::socket client_socket, Shard &shard)
+  : client_socket(std::move(client_socket)), server_socket(shard.io), shard(shard), io(shard.io),
+    strand(boost::asio::make_strand(shard.io)) {
+  this->unaccounted_bytes = 0;
+  this->resolve_latency = std::chrono::microseconds(0);
+  this->connect_latency = std::chrono::milliseconds(0);
+  this->connect_attempts = 0;
+  this->close_reason = NOT_CLOSED;
+  this->holds_handshake_slot = true;
+  this->holds_lookup_slot = false;
+  this->deadline.expire = &Connection::expire_deadline;
+  this->deadline.owner = this;
+  this->lifetime_deadline = NO_DEADLINE;
+  this->handshaking = false;
+  this->relay_operations = 0;
+  this->pipelined_start = 0;
+  this->forwarding = false;
+  this->exchanges = 0;
+}
+
+RelayHandler::RelayHandler(Connection *connection, Channel *channel, int index, RelayOperation operation)
+  : connection(connection), channel(channel), index(index), operation(operation) {
+}
+
+// Counts the operation as over once its handler has run, by when the handler has started any operation that follows.
+void RelayHandler::operator()(const boost::system::error_code &error, size_t bytes_transferred) const {
+  Connection *connection = this->connection;
+  switch (this->operation) {
+    case RELAY_READ:
+      connection->handle_read(this->channel, this->index, error);
+      break;
+    case RELAY_WRITE:
+      connection->handle_write(this->channel, this->index, bytes_transferred, error);
+      break;
+    case SPLICE_READ:
+      connection->handle_splice(this->channel, boost::asio::ip::tcp::socket::wait_read, error);
+      break;
+    case SPLICE_WRITE:
+      connection->handle_splice(this->channel, boost::asio::ip::tcp::socket::wait_write, error);
+      break;
+  }
+  if (--connection->relay_operations == 0) {
+    connection->release_relay();
+  }
+}
 
-Connection::Connection(std::shared_ptr<boost::asio::ip::tcp::socket> client_socket, std::string header) {
-  this->client_socket = client_socket;
-  this->total_size = 0;
+RelayHandler::allocator_type RelayHandler::get_allocator() const {
+  return allocator_type(this->connection->handler_memory);
+}
 
-  if (!validate_header(header)) {
+void Connection::parse_header(std::string_view header) {
+  Request request;
+  RequestStatus status = request.parse(header);
+  if (status == MALFORMED_REQUEST) {
     this->write_error_to_client(HTTP_BAD_REQUEST, BAD_REQUEST_LENGTH, header);
     throw BadRequestException("Bad request");
   }
-  if (!(header.find("CONNECT") == 0)) {
+  if (status == UNSUPPORTED_METHOD || (status == FORWARD_REQUEST && !ctx.forward_http)) {
     this->write_error_to_client(HTTP_METHOD_NOT_ALLOWED, METHOD_NOT_ALLOWED_LENGTH, header);
     throw UnsupportedHTTPMethod("HTTP method not supported");
   }
-  boost::smatch request_line_match;
-  if (!boost::regex_search(header, request_line_match, REQUEST_LINE)) {
+  if (status == MALFORMED_REQUEST_LINE) {
     this->write_error_to_client(HTTP_BAD_REQUEST, BAD_REQUEST_LENGTH, header);
     throw BadRequestException("Request line format error");
   }
-  this->hostname = request_line_match["hostname"].str();
-  if (request_line_match["version"].str() == HTTP_VERSION_1) {
+  this->forwarding = status == FORWARD_REQUEST;
+  this->hostname.assign(request.hostname());
+  if (request.version() == HTTP_VERSION_1) {
     this->version = 1;
-  } else if (request_line_match["version"].str() == HTTP_VERSION_0) {
+  } else if (request.version() == HTTP_VERSION_0) {
     this->version = 0;
   } else {
     this->write_error_to_client(HTTP_VERSION_NOT_SUPPORTED, VERSION_NOT_SUPPORTED_LENGTH, header);
     throw UnsupportedHTTPVersionException("HTTP version unsupported");
   }
-  if (request_line_match["port"].str() != "") {
-    this->port = atoi(request_line_match["port"].str().substr(1).c_str());
+  if (!request.port().empty()) {
+    this->port = Request::parse_port(request.port());
   } else {
-    this->port = HTTPS_PORT;
+    this->port = this->forwarding ? HTTP_PORT : HTTPS_PORT;
   }
 
   if (ctx.blacklist.is_blocked(this->hostname)) {
     this->write_error_to_client(HTTP_FORBIDDEN, FORBIDDEN_LENGTH, header);
     throw BlockedException("Website blocked: " + this->hostname);
   }
+  if (this->forwarding) {
+    this->prepare_exchange(request, header);
+  }
+}
 
-  int options_token = header.find("\r\n");
-  std::string raw_options = header.substr(options_token + 2);
-  raw_options.pop_back();
-  raw_options.pop_back();
-  set_options(raw_options);
+// Rewrites the request for the server, with the path as its target and the authority of the URI as its host, and
+// works out how its body ends and whether the client keeps the connection open afterwards.
+void Connection::prepare_exchange(Request &request, std::string_view header) {
+  const HttpHead &head = request.head();
+  BodyFraming framing;
+  uint64_t length;
+  if (!head.body_framing(false, framing, length)) {
+    this->write_error_to_client(HTTP_BAD_REQUEST, BAD_REQUEST_LENGTH, this->version);
+    throw BadRequestException("Request body framing error");
+  }
+  this->exchange.request_body.start(framing, length);
+  this->exchange.head_request = request.method() == "HEAD";
+  this->exchange.idempotent = std::find(std::begin(IDEMPOTENT_METHODS), std::end(IDEMPOTENT_METHODS),
+    request.method()) != std::end(IDEMPOTENT_METHODS);
+  this->exchange.expects_continue = this->version == 1 && head.has_token("Expect", "100-continue");
+  this->exchange.client_keep_alive = head.keeps_alive();
+  std::string_view path = request.path();
+  std::string start_line;
+  start_line.append(request.method()).append(" ").append(path.empty() || path.front() == '?' ? "/" : "");
+  start_line.append(path).append(" HTTP/").append(request.version());
+  this->exchange.request_head.clear();
+  head.write_forwarded(this->exchange.request_head, start_line, request.authority(), false);
+  this->exchange.upstream_key = this->hostname + ":" + std::to_string(this->port);
 }
 
 Connection::~Connection() {
+  // The shard journal has a single writer, which is the shard thread the connection is destroyed on.
   if (this->has_telemetry()) {
-    int duration = std::chrono::duration_cast<std::chrono::milliseconds>(this->end_time - this->start_time).count();
-    std::string telemetry = "Hostname: " + this->hostname + ", Size: " +
-    std::to_string(this->total_size) + " bytes, Time: " + std::to_string(duration/(1000.0)) + " sec";
-    ctx.logger.write_info(telemetry);
-    if (ctx.telemetry) {
-      printf("%s\n", telemetry.c_str());
-    }
+    this->write_telemetry();
+  }
+  if (this->unaccounted_bytes > 0) {
+    ctx.top_talkers.record_bytes(this->hostname, this->client_address, this->unaccounted_bytes);
+  }
+  for (Channel *channel : {&this->upstream, &this->downstream}) {
+    BufferPool::release(channel->buffers[0], channel->buffer_classes[0]);
+    BufferPool::release(channel->buffers[1], channel->buffer_classes[1]);
   }
-  free(this->client_buffer);
-  free(this->server_buffer);
+  HeaderBuffer::release(std::move(this->header_buffer));
+  HeaderBuffer::release(std::move(this->exchange.response_buffer));
+  // The wheel is not locked, so this relies on the connection being destroyed on its shard thread, see destroy.
+  this->shard.wheel.cancel(this->deadline);
+  if (this->upstream.read) {
+    Metrics::increment(CLOSED_TUNNELS);
+  }
+  if (this->holds_handshake_slot) {
+    ctx.admission.release(HANDSHAKE_SLOT);
+  }
+  if (this->holds_lookup_slot) {
+    ctx.admission.release(LOOKUP_SLOT);
+  }
+  ctx.admission.release(TUNNEL_SLOT);
+}
+
+// The connection takes over a tunnel slot and a handshake slot that the caller has acquired.
+std::shared_ptr<Connection> Connection::create(boost::asio::ip::tcp::socket client_socket, Shard &shard) {
+  return std::shared_ptr<Connection>(new Connection(std::move(client_socket), shard), &Connection::destroy);
 }
 
-std::shared_ptr<Connection> Connection::create(std::shared_ptr<boost::asio::ip::tcp::socket> client_socket, std::string header) {
-  return std::shared_ptr<Connection>(new Connection(client_socket, header));
+// Destroys the connection on its shard thread, whichever thread drops the last reference. The shard thread may still be
+// running a handler after the shard has been stopped, so the connection is posted then too. Handlers still pending are
+// destroyed with the event loop once the shard thread has been joined, and the shard declares its wheel and journal
+// before the event loop so that they are destroyed after it.
+void Connection::destroy(Connection *connection) {
+  boost::asio::io_context &io = connection->io;
+  if (io.get_executor().running_in_this_thread()) {
+    delete connection;
+    return;
+  }
+  boost::asio::post(io, [connection = std::unique_ptr<Connection>(connection)]() {});
 }
 
-void Connection::handle_connection(std::string initial_data) {
-  std::shared_ptr<boost::asio::ip::tcp::socket> client_socket = this->client_socket;
-  std::shared_ptr<boost::asio::ip::tcp::socket> server_socket = std::make_shared<boost::asio::ip::tcp::socket>(ctx.ctx);
-  this->server_socket = server_socket;
-  boost::asio::ip::tcp::endpoint server_endpoint;
+void Connection::start_handshake() {
+  if (ctx.max_lifetime > 0) {
+    this->lifetime_deadline = this->shard.deadline_after(std::chrono::seconds(ctx.max_lifetime));
+  }
+  this->handshaking = true;
+  this->shard.wheel.schedule(this->deadline,
+    std::min(this->shard.deadline_after(std::chrono::milliseconds(ctx.header_timeout)), this->lifetime_deadline));
+  this->read_header();
+}
+
+// Reads up to the end of the next request header, after whatever the header buffer already holds.
+void Connection::read_header() {
+  if (!this->header_buffer) {
+    this->header_buffer = HeaderBuffer::acquire();
+  }
+  boost::asio::async_read_until(this->client_socket,
+    boost::asio::dynamic_buffer(*(this->header_buffer), ctx.max_header_size),
+    END_OF_MESSAGE,
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_header,
+        shared_from_this(),
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+// Answers a connection that was not admitted with a 503 without waiting for its request. Whatever part of the request
+// has already arrived is read first, so that closing the socket does not reset the connection before the client has
+// read the answer.
+void Connection::reject(boost::asio::ip::tcp::socket &client_socket) {
+  boost::system::error_code error;
+  char buffer[REJECT_DRAIN_SIZE];
+  client_socket.non_blocking(true, error);
+  for (size_t drained = 0; !error && drained < ctx.max_header_size; ) {
+    drained += client_socket.read_some(boost::asio::buffer(buffer), error);
+  }
+  Metrics::record_response(503);
+  snprintf(buffer, SERVICE_UNAVAILABLE_LENGTH + 1, HTTP_SERVICE_UNAVAILABLE, 1);
+  boost::asio::write(client_socket, boost::asio::buffer(buffer, SERVICE_UNAVAILABLE_LENGTH), error);
+  if (error) {
+    LOG_DEBUG(ctx.logger, "Connection::reject", "Write failed: ", error);
+  }
+  client_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+  client_socket.close(error);
+}
+
+// Pushes the deadline back by the idle timeout, without going past the lifetime of the tunnel. Called for every chunk
+// of data relayed, which only takes a store unless the deadline moves closer.
+void Connection::refresh_deadline() {
+  uint64_t idle_deadline = this->shard.deadline_after(std::chrono::seconds(ctx.idle_timeout));
+  this->shard.wheel.schedule(this->deadline, std::min(idle_deadline, this->lifetime_deadline));
+}
+
+// Runs on the shard thread while the wheel advances, so the connection is closed from its strand instead. A connection
+// whose last reference was dropped on another thread stays on the wheel until destroy's post runs, and is left alone.
+void Connection::expire_deadline(TimerEntry &entry) {
+  Connection *connection = static_cast<Connection*>(entry.owner);
+  std::shared_ptr<Connection> self = connection->weak_from_this().lock();
+  if (!self) {
+    return;
+  }
+  boost::asio::post(connection->strand, boost::bind(&Connection::handle_expiry, self));
+}
+
+void Connection::handle_expiry() {
+  if (this->deadline.is_scheduled()) {
+    // Data was relayed after the deadline expired.
+    return;
+  }
+  MetricCounter reason = this->shard.wheel.now() > this->lifetime_deadline ? LIFETIME_EXPIRIES
+    : this->handshaking ? HANDSHAKE_EXPIRIES : IDLE_EXPIRIES;
+  Metrics::increment(reason);
+  boost::system::error_code error;
+  if (reason == HANDSHAKE_EXPIRIES) {
+    LOG_INFO(ctx.logger, "Connection::handle_expiry", "Request header not received in time.");
+    this->client_socket.close(error);
+    return;
+  }
+  LOG_INFO(ctx.logger, "Connection::handle_expiry", "Closing ", reason == IDLE_EXPIRIES ? "idle" : "expired",
+    " tunnel to: ", this->hostname, ":", this->port);
+  if (this->server_socket.is_open()) {
+    this->teardown(reason == IDLE_EXPIRIES ? IDLE_TIMEOUT : LIFETIME_EXPIRED);
+  } else {
+    this->client_socket.close(error);
+  }
+}
+
+void Connection::handle_header(size_t bytes_transferred, const boost::system::error_code &error) {
+  this->handshaking = false;
+  this->refresh_deadline();
+  if (this->holds_handshake_slot) {
+    this->holds_handshake_slot = false;
+    ctx.admission.release(HANDSHAKE_SLOT);
+  }
+  if (error == boost::asio::error::not_found) {
+    this->write_error_to_client(HTTP_BAD_REQUEST, BAD_REQUEST_LENGTH, *(this->header_buffer));
+    LOG_WARN(ctx.logger, "Connection::handle_header", "Request header too large");
+    return;
+  }
+  if (error && this->exchanges > 0 && this->header_buffer->empty()) {
+    LOG_DEBUG(ctx.logger, "Connection::handle_header", "Client connection closed after ", this->exchanges,
+      " request(s): ", error);
+    return;
+  }
+  if (error == boost::asio::error::operation_aborted) {
+    // The header timeout closed the socket, and handle_expiry has logged it.
+    LOG_DEBUG(ctx.logger, "Connection::handle_header", error);
+    return;
+  }
+  if (error) {
+    LOG_ERROR(ctx.logger, "Connection::handle_header", error);
+    return;
+  }
+  std::string_view message(this->header_buffer->data(), bytes_transferred);
+  LOG_DEBUG(ctx.logger, "", message);
+  std::chrono::steady_clock::time_point parse_start = std::chrono::steady_clock::now();
   try {
-    server_endpoint = Connection::resolve(this->hostname + ".", std::to_string(this->port));
-  } catch (NameResolutionError &e) {
-    std::string message = e.what();
-    ctx.logger.write_warn("Failed to resolve: " + this->hostname + "|" + message, "Connection::handle_connection");
+    this->parse_header(message);
+    // Only accepted requests are timed, since rejecting one includes writing the response.
+    Metrics::record(PARSE_TIME, std::chrono::steady_clock::now() - parse_start);
+  } catch (BadRequestException &e) {
+    LOG_WARN(ctx.logger, "Connection::handle_header", e.what());
+    return;
+  } catch (UnsupportedHTTPMethod &e) {
+    LOG_WARN(ctx.logger, "Connection::handle_header", e.what());
+    return;
+  } catch (UnsupportedHTTPVersionException &e) {
+    LOG_WARN(ctx.logger, "Connection::handle_header", e.what());
+    return;
+  } catch (BlockedException &e) {
+    LOG_INFO(ctx.logger, "Connection::handle_header", e.what());
+    return;
+  }
+  if (this->forwarding) {
+    this->forward_request(bytes_transferred);
+    return;
+  }
+  if (this->header_buffer->size() > bytes_transferred) {
+    // The client sent data behind the request header without waiting for the response, e.g. a TLS ClientHello.
+    this->pipelined_start = bytes_transferred;
+  } else {
+    HeaderBuffer::release(std::move(this->header_buffer));
+  }
+  this->handle_connection();
+}
+
+// An address given as the hostname is connected to as it is, without going through the resolver.
+void Connection::handle_connection() {
+  boost::system::error_code literal_error;
+  boost::asio::ip::address address = boost::asio::ip::make_address(this->hostname, literal_error);
+  if (!literal_error) {
+    this->resolve_latency = std::chrono::microseconds(0);
+    this->connect_server(AddressList(1, address));
+    return;
+  }
+  if (!ctx.admission.acquire(LOOKUP_SLOT)) {
+    LOG_WARN(ctx.logger, "Connection::handle_connection", "Lookup limit reached, shedding request for ", this->hostname);
+    this->write_error_to_client(HTTP_SERVICE_UNAVAILABLE, SERVICE_UNAVAILABLE_LENGTH, this->version);
+    return;
+  }
+  this->holds_lookup_slot = true;
+  this->phase_start = std::chrono::steady_clock::now();
+  std::shared_ptr<Connection> self = shared_from_this();
+  ctx.resolver.resolve(this->hostname + ".",
+    [self = std::move(self)](const boost::system::error_code &error, std::shared_ptr<const AddressList> addresses)
+      mutable {
+      // The reference moves into the posted handler, so that the resolver thread holds none once it has been posted.
+      auto &strand = self->strand;
+      boost::asio::post(strand, boost::bind(&Connection::handle_resolve, std::move(self), error, addresses));
+    });
+}
+
+void Connection::handle_resolve(const boost::system::error_code &error, std::shared_ptr<const AddressList> addresses) {
+  this->holds_lookup_slot = false;
+  ctx.admission.release(LOOKUP_SLOT);
+  this->resolve_latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()
+    - this->phase_start);
+  Metrics::record(RESOLVE_TIME, this->resolve_latency);
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_resolve", "Failed to resolve: ", this->hostname, "|", error);
     this->write_error_to_client(HTTP_NOT_FOUND, NOT_FOUND_LENGTH, this->version);
-    client_socket->close();
-    server_socket->close();
     return;
   }
-  ctx.logger.write_info("Connecting to: " + hostname + ":" + std::to_string(port));
+  this->connect_server(*addresses);
+}
+
+void Connection::connect_server(const AddressList &addresses) {
+  std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+  for (const boost::asio::ip::address &address : addresses) {
+    endpoints.push_back(boost::asio::ip::tcp::endpoint(address, this->port));
+  }
+  LOG_INFO(ctx.logger, "", "Connecting to: ", this->hostname, ":", this->port);
   this->start();
-  try {
-    server_socket->open(server_endpoint.protocol());
-    server_socket->connect(server_endpoint);
-  } catch (boost::system::system_error &e) {
-    std::string message = e.what();
-    ctx.logger.write_error("Failed to connect: " + this->hostname + "|" + message, "Connection::handle_connection");
+  this->phase_start = std::chrono::steady_clock::now();
+  Connector::create(this->strand, endpoints,
+    boost::bind(&Connection::handle_connect, shared_from_this(),
+      boost::placeholders::_1, boost::placeholders::_2, boost::placeholders::_3, boost::placeholders::_4))->start();
+}
+
+void Connection::handle_connect(
+  const boost::system::error_code &error,
+  std::shared_ptr<boost::asio::ip::tcp::socket> server_socket,
+  std::chrono::milliseconds latency,
+  int attempts
+) {
+  this->connect_attempts = attempts;
+  if (error) {
+    LOG_ERROR(ctx.logger, "Connection::handle_connect", "Failed to connect: ", this->hostname, "|", error);
     this->write_error_to_client(HTTP_BAD_GATEWAY, BAD_GATEWAY_LENGTH, this->version);
-    client_socket->close();
-    server_socket->close();
+    return;
+  }
+  this->server_socket = std::move(*server_socket);
+  this->connect_latency = latency;
+  Metrics::record(CONNECT_TIME, std::chrono::steady_clock::now() - this->phase_start);
+  LOG_INFO(ctx.logger, "Connection::handle_connect", "Connected to: ", this->hostname, ":", this->port, " in ",
+    latency.count(), " ms after ", attempts, " attempt(s)");
+  if (this->forwarding) {
+    this->send_request();
     return;
   }
   char message[CONNECTION_ESTABLISHED_LENGTH + 1] = {0};
   snprintf(message, CONNECTION_ESTABLISHED_LENGTH + 1,
     HTTP_CONNECTION_ESTABLISHED, this->version);
   try {
-    boost::asio::write(*client_socket, boost::asio::buffer(message, CONNECTION_ESTABLISHED_LENGTH));
+    boost::asio::write(this->client_socket, boost::asio::buffer(message, CONNECTION_ESTABLISHED_LENGTH));
   } catch (boost::system::system_error &e) {
-    ctx.logger.write_error("Write failed: " + std::string(e.what()), "Connection::handle_connection");
+    LOG_ERROR(ctx.logger, "Connection::handle_connect", "Write failed: ", e.what());
+    return;
+  }
+  if (this->header_buffer) {
+    this->forward_pipelined();
     return;
   }
+  this->start_relay();
+}
 
-  client_socket->async_receive(boost::asio::buffer(this->client_buffer, BUFFER_SIZE),
-    boost::bind(&Connection::handle_read,
-      shared_from_this(),
-      client_socket, server_socket,
-      this->client_buffer,
-      false,
-      boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error));
-  server_socket->async_receive(boost::asio::buffer(this->server_buffer, BUFFER_SIZE),
-    boost::bind(&Connection::handle_read,
-      shared_from_this(),
-      server_socket, client_socket,
-      this->server_buffer,
-      true,
-      boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error));
-  return;
+// Writes the bytes pipelined behind the request header upstream straight from the header buffer, before relaying
+// anything else the client sends.
+void Connection::forward_pipelined() {
+  boost::asio::async_write(this->server_socket,
+    boost::asio::buffer(this->header_buffer->data() + this->pipelined_start,
+      this->header_buffer->size() - this->pipelined_start),
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_pipelined,
+        shared_from_this(),
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+void Connection::handle_pipelined(size_t bytes_transferred, const boost::system::error_code &error) {
+  HeaderBuffer::release(std::move(this->header_buffer));
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_pipelined", "Write failed: ", error);
+    this->teardown(WRITE_FAILED);
+    return;
+  }
+  LOG_DEBUG(ctx.logger, "Connection::handle_pipelined", "Forwarded ", bytes_transferred, " pipelined bytes to: ",
+    this->hostname);
+  this->record_transfer(this->upstream, bytes_transferred);
+  this->start_relay();
+}
+
+// Sends the request on an idle connection to the server from the pool of the shard, or on a new one. Request body
+// bytes that came with the header are sent along with it.
+void Connection::forward_request(size_t header_length) {
+  this->header_buffer->erase(0, header_length);
+  this->exchange.buffered_body = this->exchange.request_body.consume(this->header_buffer->data(),
+    this->header_buffer->size());
+  if (this->exchange.request_body.has_failed()) {
+    this->write_error_to_client(HTTP_BAD_REQUEST, BAD_REQUEST_LENGTH, this->version);
+    LOG_WARN(ctx.logger, "Connection::forward_request", "Malformed chunked request body");
+    return;
+  }
+  Metrics::increment(FORWARDED_REQUESTS);
+  if (this->client_address.empty()) {
+    boost::system::error_code endpoint_error;
+    boost::asio::ip::tcp::endpoint client_endpoint = this->client_socket.remote_endpoint(endpoint_error);
+    if (!endpoint_error) {
+      this->client_address = client_endpoint.address().to_string();
+    }
+  }
+  ctx.top_talkers.record_tunnel(this->hostname, this->client_address);
+  this->downstream.transfer_counter = DOWNSTREAM_BYTES;
+  this->exchange.responded = false;
+  if (this->shard.upstreams.acquire(this->exchange.upstream_key, this->server_socket)) {
+    LOG_DEBUG(ctx.logger, "Connection::forward_request", "Reusing connection to: ", this->exchange.upstream_key);
+    this->exchange.retryable = this->exchange.idempotent && this->exchange.request_body.is_done();
+    this->start();
+    this->send_request();
+    return;
+  }
+  this->exchange.retryable = false;
+  this->handle_connection();
+}
+
+void Connection::send_request() {
+  std::array<boost::asio::const_buffer, 2> buffers = {
+    boost::asio::buffer(this->exchange.request_head),
+    boost::asio::buffer(this->header_buffer->data(), this->exchange.buffered_body)
+  };
+  boost::asio::async_write(this->server_socket, buffers,
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_request_sent,
+        shared_from_this(),
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+void Connection::handle_request_sent(size_t bytes_transferred, const boost::system::error_code &error) {
+  if (error) {
+    this->fail_exchange("Write failed", error, WRITE_FAILED);
+    return;
+  }
+  this->refresh_deadline();
+  this->record_transfer(this->upstream, bytes_transferred);
+  if (!this->exchange.request_body.is_done()) {
+    if (this->exchange.expects_continue) {
+      // The server's own 100 Continue would only be read after the body, so the client is told to go ahead here.
+      this->exchange.expects_continue = false;
+      boost::asio::async_write(this->client_socket, boost::asio::buffer(HTTP_CONTINUE, strlen(HTTP_CONTINUE)),
+        boost::asio::bind_executor(this->strand,
+          boost::bind(&Connection::handle_continue_sent,
+            shared_from_this(),
+            boost::asio::placeholders::error)));
+      return;
+    }
+    this->read_body(this->upstream);
+    return;
+  }
+  this->read_response_head();
+}
+
+void Connection::handle_continue_sent(const boost::system::error_code &error) {
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_continue_sent", "Write failed: ", error);
+    this->teardown(WRITE_FAILED);
+    return;
+  }
+  this->read_body(this->upstream);
+}
+
+void Connection::read_response_head() {
+  if (!this->exchange.response_buffer) {
+    this->exchange.response_buffer = HeaderBuffer::acquire();
+  }
+  boost::asio::async_read_until(this->server_socket,
+    boost::asio::dynamic_buffer(*(this->exchange.response_buffer), ctx.max_header_size),
+    END_OF_MESSAGE,
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_response_head,
+        shared_from_this(),
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+// Passes the response head on without its hop-by-hop headers, asking the client to close the connection if it cannot
+// be kept open after the response. Interim responses, e.g. 100 Continue, are passed on before the final one.
+void Connection::handle_response_head(size_t bytes_transferred, const boost::system::error_code &error) {
+  if (error == boost::asio::error::not_found) {
+    this->fail_exchange("Response header too large", error, CLOSED_BY_SERVER);
+    return;
+  }
+  if (error) {
+    this->fail_exchange("Read failed", error, CLOSED_BY_SERVER);
+    return;
+  }
+  this->refresh_deadline();
+  HttpHead head;
+  BodyFraming framing;
+  uint64_t length;
+  std::string_view text(this->exchange.response_buffer->data(), bytes_transferred);
+  if (!head.parse(text) || head.status() == 0 || head.status() == 101) {
+    this->exchange.retryable = false;
+    this->fail_exchange("Malformed response", error, CLOSED_BY_SERVER);
+    return;
+  }
+  head.body_framing(this->exchange.head_request, framing, length);
+  this->exchange.interim_response = head.status() / 100 == 1;
+  if (!this->exchange.interim_response) {
+    this->exchange.response_body.start(framing, length);
+    this->exchange.server_keep_alive = head.keeps_alive() && framing != CLOSE_DELIMITED_BODY;
+    this->exchange.client_keep_alive = this->exchange.client_keep_alive && framing != CLOSE_DELIMITED_BODY;
+  }
+  this->exchange.response_head.clear();
+  head.write_forwarded(this->exchange.response_head, head.start_line(), "",
+    !this->exchange.interim_response && !this->exchange.client_keep_alive);
+  this->exchange.response_buffer->erase(0, bytes_transferred);
+  this->exchange.buffered_response = this->exchange.interim_response ? 0
+    : this->exchange.response_body.consume(this->exchange.response_buffer->data(),
+      this->exchange.response_buffer->size());
+  this->exchange.retryable = false;
+  this->exchange.responded = true;
+  std::array<boost::asio::const_buffer, 2> buffers = {
+    boost::asio::buffer(this->exchange.response_head),
+    boost::asio::buffer(this->exchange.response_buffer->data(), this->exchange.buffered_response)
+  };
+  boost::asio::async_write(this->client_socket, buffers,
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_response_sent,
+        shared_from_this(),
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+void Connection::handle_response_sent(size_t bytes_transferred, const boost::system::error_code &error) {
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_response_sent", "Write failed: ", error);
+    this->teardown(WRITE_FAILED);
+    return;
+  }
+  this->refresh_deadline();
+  this->record_transfer(this->downstream, bytes_transferred);
+  this->exchange.response_buffer->erase(0, this->exchange.buffered_response);
+  if (this->exchange.interim_response) {
+    this->read_response_head();
+    return;
+  }
+  if (this->exchange.response_body.has_failed()) {
+    LOG_WARN(ctx.logger, "Connection::handle_response_sent", "Malformed chunked response body from: ",
+      this->hostname);
+    this->teardown(CLOSED_BY_SERVER);
+    return;
+  }
+  if (!this->exchange.response_body.is_done()) {
+    HeaderBuffer::release(std::move(this->exchange.response_buffer));
+    this->read_body(this->downstream);
+    return;
+  }
+  if (!this->exchange.response_buffer->empty()) {
+    // The server sent more than the response, so the connection is out of step with its requests.
+    this->exchange.server_keep_alive = false;
+  }
+  this->finish_exchange();
+}
+
+// Reads the next part of a body, the request body from the client on the upstream channel or the response body from
+// the server on the downstream channel. Only one buffer is used at a time, and it is returned to the pool once written.
+void Connection::read_body(Channel &channel) {
+  bool request = &channel == &this->upstream;
+  BodyFramer &body = request ? this->exchange.request_body : this->exchange.response_body;
+  channel.buffers[0] = BufferPool::acquire(channel.size_class);
+  channel.buffer_classes[0] = channel.size_class;
+  size_t capacity = BufferPool::class_size(channel.size_class);
+  (request ? this->client_socket : this->server_socket).async_read_some(
+    boost::asio::buffer(channel.buffers[0], body.wanted(capacity)),
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_body_read,
+        shared_from_this(), &channel,
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+void Connection::handle_body_read(Channel *channel, size_t bytes_transferred, const boost::system::error_code &error) {
+  bool request = channel == &this->upstream;
+  BodyFramer &body = request ? this->exchange.request_body : this->exchange.response_body;
+  if (error) {
+    BufferPool::release(channel->buffers[0], channel->buffer_classes[0]);
+    channel->buffers[0] = nullptr;
+    if (!request && error == boost::asio::error::eof && body.framing() == CLOSE_DELIMITED_BODY) {
+      this->finish_exchange();
+      return;
+    }
+    LOG_DEBUG(ctx.logger, "Connection::handle_body_read", "Read failed: ", error);
+    if (error != boost::asio::error::operation_aborted) {
+      this->teardown(request ? CLOSED_BY_CLIENT : CLOSED_BY_SERVER);
+    }
+    return;
+  }
+  this->refresh_deadline();
+  char *data = channel->buffers[0];
+  size_t length = body.consume(data, bytes_transferred);
+  if (body.has_failed()) {
+    BufferPool::release(channel->buffers[0], channel->buffer_classes[0]);
+    channel->buffers[0] = nullptr;
+    LOG_WARN(ctx.logger, "Connection::handle_body_read", "Malformed chunked ", request ? "request" : "response",
+      " body for: ", this->hostname);
+    this->teardown(request ? CLOSED_BY_CLIENT : CLOSED_BY_SERVER);
+    return;
+  }
+  if (length < bytes_transferred && request) {
+    // The client pipelined its next request behind the body.
+    this->header_buffer->append(data + length, bytes_transferred - length);
+  } else if (length < bytes_transferred) {
+    this->exchange.server_keep_alive = false;
+  }
+  this->adapt_buffer_size(*channel, bytes_transferred, BufferPool::class_size(channel->buffer_classes[0]));
+  boost::asio::async_write(request ? this->server_socket : this->client_socket, boost::asio::buffer(data, length),
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_body_written,
+        shared_from_this(), channel,
+        boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error)));
+}
+
+void Connection::handle_body_written(Channel *channel, size_t bytes_transferred,
+  const boost::system::error_code &error) {
+  BufferPool::release(channel->buffers[0], channel->buffer_classes[0]);
+  channel->buffers[0] = nullptr;
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_body_written", "Write failed: ", error);
+    this->teardown(WRITE_FAILED);
+    return;
+  }
+  this->refresh_deadline();
+  this->record_transfer(*channel, bytes_transferred);
+  bool request = channel == &this->upstream;
+  if (!(request ? this->exchange.request_body : this->exchange.response_body).is_done()) {
+    this->read_body(*channel);
+  } else if (request) {
+    this->read_response_head();
+  } else {
+    this->finish_exchange();
+  }
+}
+
+// A pooled connection that the server closed just as it was reused fails before any of the response arrives, in
+// which case the request is sent again on a new connection. Otherwise the client gets a 502 if it has not received
+// any of the response yet.
+void Connection::fail_exchange(const char *reason, const boost::system::error_code &error, CloseReason close_reason) {
+  boost::system::error_code close_error;
+  if (this->exchange.retryable && (!this->exchange.response_buffer || this->exchange.response_buffer->empty())) {
+    LOG_DEBUG(ctx.logger, "Connection::fail_exchange", "Reused connection to ", this->exchange.upstream_key,
+      " failed, retrying on a new connection: ", error);
+    this->exchange.retryable = false;
+    this->server_socket.close(close_error);
+    this->handle_connection();
+    return;
+  }
+  LOG_WARN(ctx.logger, "Connection::fail_exchange", "Forwarding to ", this->exchange.upstream_key, " failed | ", reason,
+    " | ", error);
+  if (!this->exchange.responded) {
+    this->write_error_to_client(HTTP_BAD_GATEWAY, BAD_GATEWAY_LENGTH, this->version, close_reason);
+    return;
+  }
+  this->teardown(close_reason);
+}
+
+// Records the exchange, returns the server connection to the pool if it can carry another request, and waits for the
+// next request if the client keeps the connection open.
+void Connection::finish_exchange() {
+  HeaderBuffer::release(std::move(this->exchange.response_buffer));
+  this->exchanges++;
+  this->close_reason = REQUEST_COMPLETED;
+  this->end();
+  this->write_telemetry();
+  this->start_time = std::chrono::system_clock::time_point();
+  this->end_time = std::chrono::system_clock::time_point();
+  this->close_reason = NOT_CLOSED;
+  this->upstream.transferred = 0;
+  this->downstream.transferred = 0;
+  this->resolve_latency = std::chrono::microseconds(0);
+  this->connect_latency = std::chrono::milliseconds(0);
+  this->connect_attempts = 0;
+  if (this->unaccounted_bytes > 0) {
+    ctx.top_talkers.record_bytes(this->hostname, this->client_address, this->unaccounted_bytes);
+    this->unaccounted_bytes = 0;
+  }
+  boost::system::error_code error;
+  if (this->exchange.server_keep_alive) {
+    this->shard.upstreams.release(this->exchange.upstream_key, std::move(this->server_socket));
+  } else {
+    this->server_socket.close(error);
+  }
+  this->header_buffer->erase(0, this->exchange.buffered_body);
+  if (!this->exchange.client_keep_alive) {
+    this->client_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, error);
+    this->client_socket.close(error);
+    return;
+  }
+  this->read_header();
 }
 
 std::shared_ptr<Connection> Connection::shared_ptr() {
@@ -154,103 +778,364 @@ bool Connection::has_telemetry() {
   return this->start_time != std::chrono::system_clock::time_point() && this->end_time != std::chrono::system_clock::time_point();
 }
 
-void Connection::set_options(std::string& options) {
-  while (options.find("\r\n") != std::string::npos) {
-    int key_token = options.find(":");
-    int next_token = options.find("\r\n");
-    std::string key = options.substr(0, key_token - 1);
-    std::string value = options.substr(key_token + 1, next_token - key_token + 1);
-    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-    (this->options)[key] = value;
-    options = options.substr(next_token + 2);
+// Records the tunnel in the journal of the shard if it has one, and formats it as a line otherwise. The journal decoder
+// prints the same lines from the journal.
+void Connection::write_telemetry() {
+  if (this->shard.journal) {
+    TunnelRecord record = {};
+    record.port = this->port;
+    record.upstream_bytes = this->upstream.transferred;
+    record.downstream_bytes = this->downstream.transferred;
+    record.start_time = std::chrono::duration_cast<std::chrono::nanoseconds>(this->start_time.time_since_epoch()).count();
+    record.end_time = std::chrono::duration_cast<std::chrono::nanoseconds>(this->end_time.time_since_epoch()).count();
+    record.resolve_latency = this->resolve_latency.count();
+    record.connect_latency = std::chrono::duration_cast<std::chrono::microseconds>(this->connect_latency).count();
+    record.connect_attempts = this->connect_attempts;
+    record.close_reason = this->close_reason;
+    if (this->shard.journal->record(this->hostname, record)) {
+      return;
+    }
+    LOG_WARN(ctx.logger, "Connection::write_telemetry", "Unable to write to the telemetry journal.");
+  }
+  int duration = std::chrono::duration_cast<std::chrono::milliseconds>(this->end_time - this->start_time).count();
+  LOG_INFO(ctx.logger, "", "Hostname: ", this->hostname, ", Size: ", this->downstream.transferred, " bytes, Sent: ",
+    this->upstream.transferred, " bytes, Time: ", duration/(1000.0), " sec, Connect: ",
+    this->connect_latency.count()/(1000.0), " sec (", this->connect_attempts, " attempts)");
+  if (ctx.telemetry) {
+    printf("Hostname: %s, Size: %" PRIu64 " bytes, Sent: %" PRIu64 " bytes, Time: %f sec, Connect: %f sec "
+      "(%d attempts)\n", this->hostname.c_str(), this->downstream.transferred, this->upstream.transferred,
+      duration/(1000.0), this->connect_latency.count()/(1000.0), this->connect_attempts);
+  }
+}
+
+void Connection::start_relay() {
+  this->upstream.read = &this->client_socket;
+  this->upstream.write = &this->server_socket;
+  this->downstream.read = &this->server_socket;
+  this->downstream.write = &this->client_socket;
+  this->downstream.transfer_counter = DOWNSTREAM_BYTES;
+  Metrics::increment(OPENED_TUNNELS);
+  boost::system::error_code endpoint_error;
+  boost::asio::ip::tcp::endpoint client_endpoint = this->client_socket.remote_endpoint(endpoint_error);
+  if (!endpoint_error) {
+    this->client_address = client_endpoint.address().to_string();
+  }
+  ctx.top_talkers.record_tunnel(this->hostname, this->client_address);
+  this->relay_self = shared_from_this();
+  if (ctx.relay_mode == SPLICE_RELAY && this->start_splice()) {
+    return;
+  }
+  if (ctx.relay_mode == URING_RELAY && this->start_uring()) {
+    return;
+  }
+  for (Channel *channel : {&this->upstream, &this->downstream}) {
+    boost::system::error_code error;
+    channel->read->non_blocking(true, error);
+    this->start_read(*channel);
   }
 }
 
-void Connection::handle_read(
-  std::shared_ptr<boost::asio::ip::tcp::socket> read,
-  std::shared_ptr<boost::asio::ip::tcp::socket> write,
-  char* buffer,
-  bool record_transfer,
-  size_t bytes_transferred,
+// Drops the reference the connection holds to itself while relaying. The handler that gave up the last relay
+// operation may still be running, so the reference is released from the event loop.
+void Connection::release_relay() {
+  boost::asio::post(this->io, [self = std::move(this->relay_self)]() {});
+}
+
+// Waits until the socket is readable without holding a buffer, so an idle tunnel keeps no relay buffers.
+void Connection::start_read(Channel &channel) {
+  int index = channel.writing == 0 || channel.pending == 0 ? 1 : 0;
+  channel.reading = index;
+  this->relay_operations++;
+  channel.read->async_wait(boost::asio::ip::tcp::socket::wait_read,
+    boost::asio::bind_executor(this->strand, RelayHandler(this, &channel, index, RELAY_READ)));
+}
+
+// Borrows a buffer from the pool only once data has arrived. The buffer is
+// returned as soon as its contents have been written to the other side.
+void Connection::handle_read(Channel *channel, int index, const boost::system::error_code &error) {
+  channel->reading = NO_BUFFER;
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (error) {
+    LOG_DEBUG(ctx.logger, "Connection::handle_read", "Wait failed: ", error);
+    this->close_channel(*channel);
+    return;
+  }
+  channel->buffers[index] = BufferPool::acquire(channel->size_class);
+  channel->buffer_classes[index] = channel->size_class;
+  size_t capacity = BufferPool::class_size(channel->size_class);
+  boost::system::error_code read_error;
+  size_t bytes_transferred = channel->read->read_some(boost::asio::buffer(channel->buffers[index], capacity), read_error);
+  if (read_error) {
+    BufferPool::release(channel->buffers[index], channel->buffer_classes[index]);
+    channel->buffers[index] = nullptr;
+    if (read_error == boost::asio::error::would_block || read_error == boost::asio::error::try_again) {
+      this->start_read(*channel);
+      return;
+    }
+    LOG_DEBUG(ctx.logger, "Connection::handle_read", "Read failed: ", read_error);
+    this->close_channel(*channel);
+    return;
+  }
+  channel->lengths[index] = bytes_transferred;
+  this->refresh_deadline();
+  this->adapt_buffer_size(*channel, bytes_transferred, capacity);
+  if (channel->writing != NO_BUFFER) {
+    // Both buffers are in use, resume reading once the write completes.
+    channel->pending = index;
+    return;
+  }
+  this->start_write(*channel, index);
+  this->start_read(*channel);
+}
+
+void Connection::adapt_buffer_size(Channel &channel, size_t bytes_transferred, size_t capacity) {
+  if (bytes_transferred == capacity) {
+    channel.short_reads = 0;
+    if (++channel.full_reads >= RELAY_GROW_AFTER && channel.size_class < BUFFER_POOL_CLASSES - 1) {
+      channel.size_class++;
+      channel.full_reads = 0;
+    }
+  } else if (bytes_transferred < capacity / RELAY_SHRINK_RATIO) {
+    channel.full_reads = 0;
+    if (++channel.short_reads >= RELAY_SHRINK_AFTER && channel.size_class > 0) {
+      channel.size_class--;
+      channel.short_reads = 0;
+    }
+  } else {
+    channel.full_reads = 0;
+    channel.short_reads = 0;
+  }
+}
+
+void Connection::start_write(Channel &channel, int index) {
+  channel.writing = index;
+  this->relay_operations++;
+  boost::asio::async_write(*(channel.write), boost::asio::buffer(channel.buffers[index], channel.lengths[index]),
+    boost::asio::bind_executor(this->strand, RelayHandler(this, &channel, index, RELAY_WRITE)));
+}
+
+void Connection::handle_write(Channel *channel, int index, size_t bytes_transferred, const boost::system::error_code &error) {
+  channel->writing = NO_BUFFER;
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_write", "Write failed: ", error);
+    this->teardown(WRITE_FAILED);
+    return;
+  }
+  this->record_transfer(*channel, bytes_transferred);
+  BufferPool::release(channel->buffers[index], channel->buffer_classes[index]);
+  channel->buffers[index] = nullptr;
+  if (channel->pending != NO_BUFFER) {
+    int pending = channel->pending;
+    channel->pending = NO_BUFFER;
+    this->start_write(*channel, pending);
+  }
+  if (channel->closed) {
+    this->close_channel(*channel);
+  } else if (channel->reading == NO_BUFFER) {
+    this->start_read(*channel);
+  }
+}
+
+bool Connection::start_splice() {
+  this->upstream.pipe = SplicePipe::create();
+  this->downstream.pipe = SplicePipe::create();
+  if (!this->upstream.pipe || !this->downstream.pipe) {
+    LOG_WARN(ctx.logger, "Connection::start_splice", "Unable to create pipes, falling back to copy relay.");
+    this->upstream.pipe.reset();
+    this->downstream.pipe.reset();
+    return false;
+  }
+  this->client_socket.native_non_blocking(true);
+  this->server_socket.native_non_blocking(true);
+  this->wait_splice(this->upstream, boost::asio::ip::tcp::socket::wait_read);
+  this->wait_splice(this->downstream, boost::asio::ip::tcp::socket::wait_read);
+  return true;
+}
+
+void Connection::wait_splice(Channel &channel, boost::asio::ip::tcp::socket::wait_type type) {
+  boost::asio::ip::tcp::socket *socket = type == boost::asio::ip::tcp::socket::wait_read ? channel.read : channel.write;
+  RelayOperation operation = type == boost::asio::ip::tcp::socket::wait_read ? SPLICE_READ : SPLICE_WRITE;
+  this->relay_operations++;
+  socket->async_wait(type, boost::asio::bind_executor(this->strand, RelayHandler(this, &channel, 0, operation)));
+}
+
+// Moves data through the channel's pipe. The receiving socket is only waited on
+// again once the pipe has been fully drained into the sending socket.
+void Connection::handle_splice(
+  Channel *channel,
+  boost::asio::ip::tcp::socket::wait_type type,
   const boost::system::error_code &error
 ) {
-  boost::lock_guard<boost::mutex> lock(this->lock);
-  if ((error == boost::asio::error::eof) ||
-  (error == boost::asio::error::connection_reset) ||
-  (error == boost::asio::error::connection_aborted)) {
-    ctx.logger.write_debug("Read failed: " + error.message(), "Connection::handle_read");
-    this->end();
-    read->close();
-    write->close();
+  if (error == boost::asio::error::operation_aborted) {
     return;
   }
-  if (!write->is_open()) {
+  if (error) {
+    LOG_DEBUG(ctx.logger, "Connection::handle_splice", "Wait failed: ", error);
+    this->teardown(type == boost::asio::ip::tcp::socket::wait_write ? WRITE_FAILED
+      : channel == &this->upstream ? CLOSED_BY_CLIENT : CLOSED_BY_SERVER);
     return;
   }
-  try {
-    boost::asio::write(*write, boost::asio::buffer(buffer, bytes_transferred));
-  } catch (boost::system::system_error &e) {
-    ctx.logger.write_warn("Write failed: " + std::string(e.what()), "Connection::handle_read");
+  SplicePipe *pipe = channel->pipe.get();
+  if (type == boost::asio::ip::tcp::socket::wait_read) {
+    ssize_t bytes_transferred = pipe->fill(channel->read->native_handle(), SPLICE_PIPE_SIZE);
+    if (bytes_transferred == 0 || (bytes_transferred < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      LOG_DEBUG(ctx.logger, "Connection::handle_splice", "Read failed: ",
+        bytes_transferred == 0 ? "End of file" : strerror(errno));
+      this->teardown(channel == &this->upstream ? CLOSED_BY_CLIENT : CLOSED_BY_SERVER);
+      return;
+    }
+    if (bytes_transferred > 0) {
+      this->refresh_deadline();
+      this->record_transfer(*channel, bytes_transferred);
+    }
+  }
+  while (pipe->pending() > 0) {
+    if (pipe->drain(channel->write->native_handle()) >= 0) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      this->wait_splice(*channel, boost::asio::ip::tcp::socket::wait_write);
+      return;
+    }
+    LOG_WARN(ctx.logger, "Connection::handle_splice", "Write failed: ", strerror(errno));
+    this->teardown(WRITE_FAILED);
     return;
   }
-  if (record_transfer) {
-    this->record_payload(bytes_transferred);
+  this->wait_splice(*channel, boost::asio::ip::tcp::socket::wait_read);
+}
+
+// Relays both channels through the ring of the shard, which runs its handlers on
+// the shard thread. The ring holds no reference to the connection, which keeps
+// itself alive until the ring has released both channels.
+bool Connection::start_uring() {
+  if (!this->shard.uring) {
+    return false;
+  }
+  for (Channel *channel : {&this->upstream, &this->downstream}) {
+    channel->uring = std::make_unique<UringChannel>();
+    channel->uring->read_fd = channel->read->native_handle();
+    channel->uring->write_fd = channel->write->native_handle();
+    channel->uring->handle = &Connection::handle_uring;
+    channel->uring->owner = this;
+  }
+  this->shard.uring->start(*this->upstream.uring);
+  this->shard.uring->start(*this->downstream.uring);
+  return true;
+}
+
+void Connection::handle_uring(UringChannel &uring, UringEvent event, size_t bytes_transferred) {
+  Connection *connection = static_cast<Connection*>(uring.owner);
+  Channel &channel = &uring == connection->upstream.uring.get() ? connection->upstream : connection->downstream;
+  switch (event) {
+    case URING_RECEIVED:
+      connection->refresh_deadline();
+      break;
+    case URING_SENT:
+      connection->record_transfer(channel, bytes_transferred);
+      break;
+    case URING_CLOSED:
+      LOG_DEBUG(ctx.logger, "Connection::handle_uring", "Channel closed by the ", &channel == &connection->upstream ?
+        "client" : "server");
+      connection->teardown(&channel == &connection->upstream ? CLOSED_BY_CLIENT : CLOSED_BY_SERVER);
+      break;
+    case URING_RELEASED:
+      if (connection->upstream.uring->released && connection->downstream.uring->released) {
+        connection->release_relay();
+      }
+      break;
+  }
+}
+
+// Marks the channel as finished. The tunnel is torn down once any data already
+// read on the channel has been written out.
+void Connection::close_channel(Channel &channel) {
+  channel.closed = true;
+  if (channel.writing == NO_BUFFER && channel.pending == NO_BUFFER) {
+    this->teardown(&channel == &this->upstream ? CLOSED_BY_CLIENT : CLOSED_BY_SERVER);
+  }
+}
+
+// Closes both sockets, keeping the first reason the tunnel was closed for.
+void Connection::teardown(CloseReason reason) {
+  if (this->close_reason == NOT_CLOSED) {
+    this->close_reason = reason;
+  }
+  this->end();
+  boost::system::error_code error;
+  if (this->upstream.uring) {
+    // Shutting the sockets down completes the operations the ring still has in flight on them.
+    this->shard.uring->stop(*this->upstream.uring);
+    this->shard.uring->stop(*this->downstream.uring);
+    this->client_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+    this->server_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
   }
-  read->async_read_some(boost::asio::buffer(buffer, BUFFER_SIZE),
-    boost::bind(&Connection::handle_read,
-      shared_from_this(),
-      read, write, buffer, record_transfer,
-      boost::asio::placeholders::bytes_transferred, boost::asio::placeholders::error));
+  this->client_socket.close(error);
+  this->server_socket.close(error);
 }
 
 void Connection::start() {
   this->start_time = std::chrono::system_clock::now();
 }
 
-void Connection::record_payload(int payload_size) {
-  this->total_size += payload_size;
+// Counts the data relayed by the channel, and adds it to the top talkers once enough has accumulated.
+void Connection::record_transfer(Channel &channel, size_t bytes_transferred) {
+  channel.transferred += bytes_transferred;
+  Metrics::increment(channel.transfer_counter, bytes_transferred);
+  this->unaccounted_bytes += bytes_transferred;
+  if (this->unaccounted_bytes >= TOP_TALKERS_FLUSH_BYTES) {
+    ctx.top_talkers.record_bytes(this->hostname, this->client_address, this->unaccounted_bytes);
+    this->unaccounted_bytes = 0;
+  }
 }
 
 void Connection::end() {
   if (this->start_time == std::chrono::system_clock::time_point()) {
-    ctx.logger.write_error("Attempting to closed unstarted connection.");
+    LOG_ERROR(ctx.logger, "", "Attempting to closed unstarted connection.");
   }
   if (this->end_time == std::chrono::system_clock::time_point()) {
     this->end_time = std::chrono::system_clock::now();
   }
 }
 
-void Connection::write_error_to_client(const char *const message, int length, int version) {
-  char buffer[length + 1] = {0};
-  snprintf(buffer, length + 1, message, version);
-  try {
-    boost::asio::write(*(this->client_socket), boost::asio::buffer(buffer, length));
-  } catch (boost::system::system_error &e) {
-    ctx.logger.write_error("Write failed: " + std::string(e.what()), "Connection::write_error_to_client");
+// Answers the client with an error and closes the connection once the response has been written, tearing it down for
+// the given reason if it was relaying or forwarding. A client that does not read the response is closed by its deadline.
+void Connection::write_error_to_client(const char *const message, int length, int version, CloseReason reason) {
+  this->error_response.resize(length + 1);
+  snprintf(&this->error_response[0], length + 1, message, version);
+  this->error_response.resize(length);
+  Metrics::record_response(atoi(this->error_response.c_str() + STATUS_CODE_OFFSET));
+  boost::asio::async_write(this->client_socket, boost::asio::buffer(this->error_response),
+    boost::asio::bind_executor(this->strand,
+      boost::bind(&Connection::handle_error_sent,
+        shared_from_this(), reason,
+        boost::asio::placeholders::error)));
+}
+
+void Connection::handle_error_sent(CloseReason reason, const boost::system::error_code &error) {
+  if (error) {
+    LOG_WARN(ctx.logger, "Connection::handle_error_sent", "Write failed: ", error);
   }
+  if (reason != NOT_CLOSED) {
+    this->teardown(reason);
+    return;
+  }
+  boost::system::error_code close_error;
+  this->client_socket.close(close_error);
 }
 
-void Connection::write_error_to_client(const char *const message, int length, std::string &header) {
+void Connection::write_error_to_client(const char *const message, int length, std::string_view header) {
   int version = 1;
   if (size_t token = header.find("HTTP/1.") ) {
     if (header.size() > token + 8) {
-      version = atoi(header.substr(token + 7, 1).c_str());
+      char digit = header[token + 7];
+      version = digit >= '0' && digit <= '9' ? digit - '0' : 0;
     }
   }
   this->write_error_to_client(message, length, version);
 }
 
-bool Connection::validate_header(std::string& header) {
-  return boost::regex_match(header, STANDARD_REQUEST);
-}
-
-boost::asio::ip::tcp::endpoint Connection::resolve(std::string hostname, std::string port) {
-  boost::lock_guard<boost::mutex> guard(ctx.resolver_mutex);
-  try {
-    boost::asio::ip::tcp::resolver::query query(hostname, port);
-    boost::asio::ip::tcp::resolver::iterator results = ctx.resolver.resolve(query);
-    return results->endpoint();
-  } catch (boost::system::system_error &e) {
-    throw NameResolutionError(e.what());
-  }
-}
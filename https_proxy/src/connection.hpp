@@ -4,13 +4,30 @@
 #include <chrono>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 
-#define BUFFER_SIZE 8192
+#include "buffer_pool.hpp"
+#include "connector.hpp"
+#include "handler_memory.hpp"
+#include "http_message.hpp"
+#include "journal.hpp"
+#include "metrics.hpp"
+#include "request.hpp"
+#include "resolver.hpp"
+#include "shard.hpp"
+#include "splice_pipe.hpp"
+#include "timing_wheel.hpp"
+#include "uring_relay.hpp"
+
+#define RELAY_GROW_AFTER 2
+#define RELAY_SHRINK_AFTER 8
+#define RELAY_SHRINK_RATIO 4
+#define NO_BUFFER -1
 #define HTTPS_PORT 443
+#define HTTP_PORT 80
 #define HTTP_VERSION_1 "1.1"
 #define HTTP_VERSION_0 "1.0"
 
@@ -26,52 +43,196 @@ struct UnsupportedHTTPVersionException : public std::runtime_error {
   using runtime_error::runtime_error;
 };
 
-struct NameResolutionError : public std::runtime_error {
+struct BlockedException : public std::runtime_error {
   using runtime_error::runtime_error;
 };
 
-struct BlockedException : public std::runtime_error {
-  using runtime_error::runtime_error;
+// One direction of a tunnel. Each channel owns two buffers so that reading into
+// one buffer can overlap writing out the other. A channel stops reading while
+// both buffers are waiting to be written, so a peer that is not draining its
+// socket applies backpressure to the sender instead of tying up a thread.
+// Buffers are only held while they contain data that has not been written yet.
+// They come from the BufferPool and start at the smallest size class. The
+// channel moves up a size class after RELAY_GROW_AFTER reads in a row fill the
+// buffer, and back down after RELAY_SHRINK_AFTER reads in a row use less than
+// 1/RELAY_SHRINK_RATIO of it. The splice and io_uring relays keep their own
+// state for the channel instead.
+struct Channel {
+  boost::asio::ip::tcp::socket *read = nullptr;
+  boost::asio::ip::tcp::socket *write = nullptr;
+  char* buffers[2] = {nullptr, nullptr};
+  int buffer_classes[2] = {0, 0};
+  size_t lengths[2] = {0, 0};
+  int size_class = 0;
+  int full_reads = 0;
+  int short_reads = 0;
+  int reading = NO_BUFFER;
+  int writing = NO_BUFFER;
+  int pending = NO_BUFFER;
+  bool closed = false;
+  uint64_t transferred = 0;
+  MetricCounter transfer_counter = UPSTREAM_BYTES;
+  std::unique_ptr<SplicePipe> pipe;
+  std::unique_ptr<UringChannel> uring;
+};
+
+// A request forwarded in plain HTTP mode and its response. Bodies are passed
+// through a buffer at a time as they arrive. The request body bytes read along
+// with the request header stay at the front of the header buffer until the
+// exchange is over, and the rewritten request head is kept as well, so that a
+// request sent on a pooled connection the server had already closed can be
+// sent again on a new connection if none of its body has to be read again.
+struct Exchange {
+  std::string upstream_key;
+  std::string request_head;
+  std::string response_head;
+  size_t buffered_body = 0;
+  size_t buffered_response = 0;
+  BodyFramer request_body;
+  BodyFramer response_body;
+  bool head_request = false;
+  bool idempotent = false;
+  bool expects_continue = false;
+  bool client_keep_alive = false;
+  bool server_keep_alive = false;
+  bool interim_response = false;
+  bool retryable = false;
+  bool responded = false;
+  std::unique_ptr<std::string> response_buffer;
+};
+
+class Connection;
+
+enum RelayOperation {RELAY_READ = 0, RELAY_WRITE = 1, SPLICE_READ = 2, SPLICE_WRITE = 3};
+
+// Completion handler of a relay operation. It only holds plain pointers, as the
+// connection keeps itself alive while relay operations are pending, so relaying
+// a chunk takes no reference counting. asio allocates the operations started
+// with it from the HandlerMemory of the connection.
+class RelayHandler {
+  public:
+    typedef HandlerAllocator<void> allocator_type;
+    RelayHandler(Connection*, Channel*, int, RelayOperation);
+    void operator()(const boost::system::error_code&, size_t = 0) const;
+    allocator_type get_allocator() const;
+
+  private:
+    Connection *connection;
+    Channel *channel;
+    int index;
+    RelayOperation operation;
 };
 
 class Connection : public std::enable_shared_from_this<Connection> {
+  friend class RelayHandler;
+
   public:
     ~Connection();
-    static std::shared_ptr<Connection> create(std::shared_ptr<boost::asio::ip::tcp::socket>, std::string);
-    void handle_connection(std::string);
+    static std::shared_ptr<Connection> create(boost::asio::ip::tcp::socket, Shard&);
+    void start_handshake();
+    static void reject(boost::asio::ip::tcp::socket&);
     std::shared_ptr<Connection> shared_ptr();
 
   private:
     // Connection information
-    std::shared_ptr<boost::asio::ip::tcp::socket> client_socket;
-    std::shared_ptr<boost::asio::ip::tcp::socket> server_socket;
+    boost::asio::ip::tcp::socket client_socket;
+    boost::asio::ip::tcp::socket server_socket;
     std::string hostname;
     int port;
     int version;
-    std::unordered_map<std::string, std::string> options;
+    // Error response to the client, kept until it has been written
+    std::string error_response;
 
     // Connection statistics
     std::chrono::_V2::system_clock::time_point start_time;
     std::chrono::_V2::system_clock::time_point end_time;
-    int total_size;
-    
-    boost::mutex lock;
-    char* client_buffer = reinterpret_cast<char*>(malloc(sizeof(char) * BUFFER_SIZE));
-    char* server_buffer = reinterpret_cast<char*>(malloc(sizeof(char) * BUFFER_SIZE));
+    std::string client_address;
+    uint64_t unaccounted_bytes;
+    std::chrono::microseconds resolve_latency;
+    std::chrono::milliseconds connect_latency;
+    int connect_attempts;
+    CloseReason close_reason;
+
+    // Admission slots held besides the tunnel slot, which is held for the whole lifetime of the connection
+    bool holds_handshake_slot;
+    bool holds_lookup_slot;
+
+    // Handshake and relay state, only accessed from handlers running on the strand of the shard serving the connection
+    Shard &shard;
+    boost::asio::io_context &io;
+    Strand strand;
+    TimerEntry deadline;
+    uint64_t lifetime_deadline;
+    bool handshaking;
+    std::chrono::steady_clock::time_point phase_start;
+    // Bytes the client sent after the request header, kept in the header buffer from pipelined_start until forwarded
+    std::unique_ptr<std::string> header_buffer;
+    size_t pipelined_start;
+    Channel upstream;
+    Channel downstream;
+
+    // Plain HTTP forwarding state. The client connection is kept open between
+    // requests when both the client and the response allow it.
+    bool forwarding;
+    int exchanges;
+    Exchange exchange;
+
+    // Relay handlers do not own the connection, which holds a reference to itself until its relay operations are over.
+    std::shared_ptr<Connection> relay_self;
+    int relay_operations;
+    HandlerMemory handler_memory;
 
-    Connection(std::shared_ptr<boost::asio::ip::tcp::socket>, std::string);
+    Connection(boost::asio::ip::tcp::socket, Shard&);
+    static void destroy(Connection*);
+    void read_header();
+    void refresh_deadline();
+    void handle_expiry();
+    void handle_header(size_t, const boost::system::error_code&);
+    void parse_header(std::string_view);
+    void prepare_exchange(Request&, std::string_view);
+    void handle_connection();
+    void handle_resolve(const boost::system::error_code&, std::shared_ptr<const AddressList>);
+    void connect_server(const AddressList&);
+    void handle_connect(const boost::system::error_code&, std::shared_ptr<boost::asio::ip::tcp::socket>,
+      std::chrono::milliseconds, int);
     bool has_telemetry();
-    void set_options(std::string&);
-    void handle_read(std::shared_ptr<boost::asio::ip::tcp::socket>, std::shared_ptr<boost::asio::ip::tcp::socket>,
-      char*, bool, size_t, const boost::system::error_code&);
+    void write_telemetry();
+    void forward_pipelined();
+    void handle_pipelined(size_t, const boost::system::error_code&);
+    void forward_request(size_t);
+    void send_request();
+    void handle_request_sent(size_t, const boost::system::error_code&);
+    void handle_continue_sent(const boost::system::error_code&);
+    void read_response_head();
+    void handle_response_head(size_t, const boost::system::error_code&);
+    void handle_response_sent(size_t, const boost::system::error_code&);
+    void read_body(Channel&);
+    void handle_body_read(Channel*, size_t, const boost::system::error_code&);
+    void handle_body_written(Channel*, size_t, const boost::system::error_code&);
+    void fail_exchange(const char*, const boost::system::error_code&, CloseReason);
+    void finish_exchange();
+    void start_relay();
+    void release_relay();
+    void start_read(Channel&);
+    void handle_read(Channel*, int, const boost::system::error_code&);
+    void adapt_buffer_size(Channel&, size_t, size_t);
+    void start_write(Channel&, int);
+    void handle_write(Channel*, int, size_t, const boost::system::error_code&);
+    bool start_splice();
+    void wait_splice(Channel&, boost::asio::ip::tcp::socket::wait_type);
+    void handle_splice(Channel*, boost::asio::ip::tcp::socket::wait_type, const boost::system::error_code&);
+    bool start_uring();
+    void close_channel(Channel&);
+    void teardown(CloseReason);
     void start();
-    void record_payload(int);
+    void record_transfer(Channel&, size_t);
     void end();
-    void write_error_to_client(const char *const, int, int);
-    void write_error_to_client(const char *const, int, std::string&);
+    void write_error_to_client(const char *const, int, int, CloseReason = NOT_CLOSED);
+    void write_error_to_client(const char *const, int, std::string_view);
+    void handle_error_sent(CloseReason, const boost::system::error_code&);
 
-    static bool validate_header(std::string&);
-    static boost::asio::ip::tcp::endpoint resolve(std::string, std::string);
+    static void expire_deadline(TimerEntry&);
+    static void handle_uring(UringChannel&, UringEvent, size_t);
 };
 
 #endif  // HTTPS_PROXY_CONNECTION_HPP_
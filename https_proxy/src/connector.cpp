@@ -0,0 +1,176 @@
+#include "connector.hpp"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+#include "context.hpp"
+
+Connector::Connector(Strand strand, const std::vector<boost::asio::ip::tcp::endpoint> &endpoints, ConnectHandler handler)
+  : strand(strand), handler(handler), stagger_timer(strand.get_inner_executor().context()), started(0), finished(false),
+    last_error(boost::asio::error::host_not_found) {
+  for (const boost::asio::ip::tcp::endpoint &endpoint : Connector::interleave(endpoints)) {
+    Attempt attempt;
+    attempt.endpoint = endpoint;
+    this->attempts.push_back(std::move(attempt));
+  }
+}
+
+std::shared_ptr<Connector> Connector::create(
+  Strand strand,
+  const std::vector<boost::asio::ip::tcp::endpoint> &endpoints,
+  ConnectHandler handler
+) {
+  return std::shared_ptr<Connector>(new Connector(strand, endpoints, handler));
+}
+
+void Connector::start() {
+  boost::asio::dispatch(this->strand, boost::bind(&Connector::start_attempt, shared_from_this()));
+}
+
+void Connector::start_attempt() {
+  if (this->finished) {
+    return;
+  }
+  if (this->started == this->attempts.size()) {
+    if (!this->has_active_attempts()) {
+      this->finish(this->last_error, nullptr, std::chrono::milliseconds(0));
+    }
+    return;
+  }
+  size_t index = this->started++;
+  Attempt &attempt = this->attempts[index];
+  attempt.socket = std::make_shared<boost::asio::ip::tcp::socket>(this->strand.get_inner_executor().context());
+  attempt.timer = std::make_unique<boost::asio::steady_timer>(this->strand.get_inner_executor().context());
+  attempt.started = std::chrono::steady_clock::now();
+  boost::system::error_code error;
+  attempt.socket->open(attempt.endpoint.protocol(), error);
+  if (error) {
+    this->handle_connect(index, error);
+    return;
+  }
+  boost::system::error_code tuning_error = ctx.socket_tuning.apply(attempt.socket->native_handle(), UPSTREAM_SOCKET);
+  if (tuning_error) {
+    LOG_DEBUG(ctx.logger, "Connector::start_attempt", "Unable to tune upstream socket | ", tuning_error);
+  }
+  if (ctx.socket_tuning.is_first(UPSTREAM_SOCKET)) {
+    LOG_INFO(ctx.logger, "", "Upstream socket options: ",
+      SocketTuning::describe(attempt.socket->native_handle(), UPSTREAM_SOCKET));
+  }
+  attempt.socket->async_connect(attempt.endpoint, boost::asio::bind_executor(this->strand,
+    boost::bind(&Connector::handle_connect, shared_from_this(), index, boost::asio::placeholders::error)));
+  attempt.timer->expires_after(std::chrono::milliseconds(ctx.connect_timeout));
+  attempt.timer->async_wait(boost::asio::bind_executor(this->strand,
+    boost::bind(&Connector::handle_timeout, shared_from_this(), index, boost::asio::placeholders::error)));
+  if (this->started < this->attempts.size()) {
+    this->stagger_timer.expires_after(std::chrono::milliseconds(ctx.connect_stagger));
+    this->stagger_timer.async_wait(boost::asio::bind_executor(this->strand,
+      boost::bind(&Connector::handle_stagger, shared_from_this(), boost::asio::placeholders::error)));
+  }
+}
+
+void Connector::handle_stagger(const boost::system::error_code &error) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  this->start_attempt();
+}
+
+void Connector::handle_timeout(size_t index, const boost::system::error_code &error) {
+  Attempt &attempt = this->attempts[index];
+  if (error == boost::asio::error::operation_aborted || attempt.done) {
+    return;
+  }
+  attempt.timed_out = true;
+  boost::system::error_code close_error;
+  attempt.socket->close(close_error);
+}
+
+void Connector::handle_connect(size_t index, const boost::system::error_code &connect_error) {
+  Attempt &attempt = this->attempts[index];
+  if (attempt.done) {
+    return;
+  }
+  attempt.done = true;
+  if (attempt.timer) {
+    attempt.timer->cancel();
+  }
+  boost::system::error_code error = attempt.timed_out ? boost::asio::error::timed_out : connect_error;
+  std::chrono::milliseconds latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - attempt.started);
+  if (this->finished) {
+    return;
+  }
+  if (!error) {
+    LOG_DEBUG(ctx.logger, "Connector::handle_connect", "Connected to ", attempt.endpoint.address(), ":",
+      attempt.endpoint.port(), " in ", latency.count(), " ms");
+    this->finish(error, attempt.socket, latency);
+    return;
+  }
+  LOG_INFO(ctx.logger, "Connector::handle_connect", "Failed to connect to ", attempt.endpoint.address(), ":",
+    attempt.endpoint.port(), " after ", latency.count(), " ms|", error);
+  this->last_error = error;
+  // Start the next attempt without waiting for the stagger delay.
+  this->stagger_timer.cancel();
+  this->start_attempt();
+}
+
+bool Connector::has_active_attempts() {
+  for (size_t i = 0; i < this->started; i++) {
+    if (!this->attempts[i].done) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Connector::finish(
+  const boost::system::error_code &error,
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+  std::chrono::milliseconds latency
+) {
+  if (this->finished) {
+    return;
+  }
+  this->finished = true;
+  this->stagger_timer.cancel();
+  for (size_t i = 0; i < this->started; i++) {
+    Attempt &attempt = this->attempts[i];
+    if (attempt.socket != socket) {
+      boost::system::error_code close_error;
+      attempt.socket->close(close_error);
+    }
+    attempt.timer->cancel();
+  }
+  ConnectHandler handler = std::move(this->handler);
+  handler(error, socket, latency, this->started);
+}
+
+// Orders the endpoints by alternating address families, starting with the family of the first endpoint.
+std::vector<boost::asio::ip::tcp::endpoint> Connector::interleave(
+  const std::vector<boost::asio::ip::tcp::endpoint> &endpoints
+) {
+  std::vector<boost::asio::ip::tcp::endpoint> preferred;
+  std::vector<boost::asio::ip::tcp::endpoint> other;
+  for (const boost::asio::ip::tcp::endpoint &endpoint : endpoints) {
+    if (endpoint.protocol() == endpoints.front().protocol()) {
+      preferred.push_back(endpoint);
+    } else {
+      other.push_back(endpoint);
+    }
+  }
+  std::vector<boost::asio::ip::tcp::endpoint> ordered;
+  for (size_t i = 0; i < preferred.size() || i < other.size(); i++) {
+    if (i < preferred.size()) {
+      ordered.push_back(preferred[i]);
+    }
+    if (i < other.size()) {
+      ordered.push_back(other[i]);
+    }
+  }
+  return ordered;
+}
@@ -0,0 +1,59 @@
+#ifndef HTTPS_PROXY_CONNECTOR_HPP_
+#define HTTPS_PROXY_CONNECTOR_HPP_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#define DEFAULT_CONNECT_STAGGER 250
+#define DEFAULT_CONNECT_TIMEOUT 5000
+
+typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
+// Invoked with the connected socket, the latency of the successful attempt and the number of attempts started.
+typedef std::function<void(const boost::system::error_code&, std::shared_ptr<boost::asio::ip::tcp::socket>,
+  std::chrono::milliseconds, int)> ConnectHandler;
+
+// Establishes a TCP connection to any of the given endpoints. Attempts are
+// started one stagger delay apart, or immediately after the previous attempt
+// fails, and run in parallel until the first one connects, at which point the
+// remaining attempts are cancelled. Endpoints are interleaved by address family
+// so that a broken IPv6 or IPv4 path does not delay the other.
+class Connector : public std::enable_shared_from_this<Connector> {
+  public:
+    static std::shared_ptr<Connector> create(Strand, const std::vector<boost::asio::ip::tcp::endpoint>&, ConnectHandler);
+    void start();
+
+  private:
+    struct Attempt {
+      boost::asio::ip::tcp::endpoint endpoint;
+      std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+      std::unique_ptr<boost::asio::steady_timer> timer;
+      std::chrono::steady_clock::time_point started;
+      bool timed_out = false;
+      bool done = false;
+    };
+
+    Connector(Strand, const std::vector<boost::asio::ip::tcp::endpoint>&, ConnectHandler);
+    Strand strand;
+    ConnectHandler handler;
+    std::vector<Attempt> attempts;
+    boost::asio::steady_timer stagger_timer;
+    size_t started;
+    bool finished;
+    boost::system::error_code last_error;
+
+    void start_attempt();
+    void handle_stagger(const boost::system::error_code&);
+    void handle_timeout(size_t, const boost::system::error_code&);
+    void handle_connect(size_t, const boost::system::error_code&);
+    bool has_active_attempts();
+    void finish(const boost::system::error_code&, std::shared_ptr<boost::asio::ip::tcp::socket>,
+      std::chrono::milliseconds);
+
+    static std::vector<boost::asio::ip::tcp::endpoint> interleave(const std::vector<boost::asio::ip::tcp::endpoint>&);
+};
+
+#endif  // HTTPS_PROXY_CONNECTOR_HPP_
@@ -3,13 +3,35 @@
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 
+#include "connector.hpp"
 #include "logger/logger.hpp"
+#include "upstream_pool.hpp"
 
 #define LOG_FILE_PATH "./proxy.log"
+#define DEFAULT_HEADER_TIMEOUT 10000
+#define DEFAULT_MAX_HEADER_SIZE 16384
+#define DEFAULT_IDLE_TIMEOUT 900
+#define DEFAULT_MAX_LIFETIME 0
+#define DEFAULT_JOURNAL_SIZE (64 * 1024 * 1024)
 
 context ctx = {
-    .resolver = boost::asio::ip::tcp::resolver(ctx.ctx),
+    .shard_count = 0,
+    .pin_shards = false,
+    .listen_backlog = boost::asio::socket_base::max_listen_connections,
+    .metrics_port = 0,
     .logger = Logger(LOG_FILE_PATH),
     .telemetry = false,
+    .journal_path = "",
+    .journal_size = DEFAULT_JOURNAL_SIZE,
+    .relay_mode = COPY_RELAY,
+    .forward_http = false,
+    .upstream_pool_size = DEFAULT_UPSTREAM_POOL_SIZE,
+    .upstream_idle_timeout = DEFAULT_UPSTREAM_IDLE_TIMEOUT,
+    .header_timeout = DEFAULT_HEADER_TIMEOUT,
+    .idle_timeout = DEFAULT_IDLE_TIMEOUT,
+    .max_lifetime = DEFAULT_MAX_LIFETIME,
+    .max_header_size = DEFAULT_MAX_HEADER_SIZE,
+    .connect_stagger = DEFAULT_CONNECT_STAGGER,
+    .connect_timeout = DEFAULT_CONNECT_TIMEOUT,
     .blacklist = Blacklist()
 };
@@ -5,15 +5,38 @@
 #include <boost/thread.hpp>
 
 #include "logger/logger.hpp"
+#include "admission.hpp"
 #include "blacklist.hpp"
+#include "resolver.hpp"
+#include "socket_tuning.hpp"
+#include "top_talkers.hpp"
+
+enum RelayMode {COPY_RELAY = 0, SPLICE_RELAY = 1, URING_RELAY = 2};
 
 struct context {
-    boost::asio::io_context ctx;
-    boost::asio::io_context accept_ctx;
-    boost::asio::ip::tcp::resolver resolver;
-    boost::mutex resolver_mutex;
+    boost::asio::io_context control_ctx;
+    size_t shard_count;
+    bool pin_shards;
+    int listen_backlog;
+    int metrics_port;
+    Resolver resolver;
+    Admission admission;
+    SocketTuning socket_tuning;
+    TopTalkers top_talkers;
     Logger logger;
     bool telemetry;
+    std::string journal_path;
+    size_t journal_size;
+    RelayMode relay_mode;
+    bool forward_http;
+    size_t upstream_pool_size;
+    int upstream_idle_timeout;
+    int header_timeout;
+    int idle_timeout;
+    int max_lifetime;
+    size_t max_header_size;
+    int connect_stagger;
+    int connect_timeout;
     Blacklist blacklist;
 };
 
@@ -0,0 +1,31 @@
+#include "handler_memory.hpp"
+
+#include <new>
+
+HandlerMemory::HandlerMemory() {
+  for (int slot = 0; slot < HANDLER_MEMORY_SLOTS; slot++) {
+    this->used[slot] = false;
+  }
+}
+
+void *HandlerMemory::allocate(size_t size) {
+  if (size <= HANDLER_MEMORY_SLOT_SIZE) {
+    for (int slot = 0; slot < HANDLER_MEMORY_SLOTS; slot++) {
+      if (!this->used[slot]) {
+        this->used[slot] = true;
+        return this->slots[slot];
+      }
+    }
+  }
+  return ::operator new(size);
+}
+
+void HandlerMemory::deallocate(void *pointer) {
+  for (int slot = 0; slot < HANDLER_MEMORY_SLOTS; slot++) {
+    if (pointer == this->slots[slot]) {
+      this->used[slot] = false;
+      return;
+    }
+  }
+  ::operator delete(pointer);
+}
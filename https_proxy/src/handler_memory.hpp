@@ -0,0 +1,61 @@
+#ifndef HTTPS_PROXY_HANDLER_MEMORY_HPP_
+#define HTTPS_PROXY_HANDLER_MEMORY_HPP_
+
+#include <cstddef>
+
+#define HANDLER_MEMORY_SLOTS 4
+#define HANDLER_MEMORY_SLOT_SIZE 384
+
+// Memory for the completion handlers of one connection, which asio allocates
+// through the associated allocator of a handler for every operation started
+// with it. Each slot holds one handler at a time, so the relay reuses the same
+// slots for every chunk instead of going to the heap. Handlers larger than a
+// slot, or more at once than there are slots, fall back to the heap. Only used
+// from the shard serving the connection, so it needs no locking.
+class HandlerMemory {
+  public:
+    HandlerMemory();
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory &operator=(const HandlerMemory&) = delete;
+    void *allocate(size_t);
+    void deallocate(void*);
+
+  private:
+    alignas(std::max_align_t) unsigned char slots[HANDLER_MEMORY_SLOTS][HANDLER_MEMORY_SLOT_SIZE];
+    bool used[HANDLER_MEMORY_SLOTS];
+};
+
+template <typename T>
+class HandlerAllocator {
+  public:
+    typedef T value_type;
+
+    explicit HandlerAllocator(HandlerMemory &memory) : memory(&memory) {
+    }
+
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U> &other) : memory(other.memory) {
+    }
+
+    T *allocate(size_t count) {
+      return static_cast<T*>(this->memory->allocate(count * sizeof(T)));
+    }
+
+    void deallocate(T *pointer, size_t) {
+      this->memory->deallocate(pointer);
+    }
+
+    bool operator==(const HandlerAllocator &other) const {
+      return this->memory == other.memory;
+    }
+
+    bool operator!=(const HandlerAllocator &other) const {
+      return this->memory != other.memory;
+    }
+
+  private:
+    template <typename> friend class HandlerAllocator;
+    HandlerMemory *memory;
+};
+
+#endif  // HTTPS_PROXY_HANDLER_MEMORY_HPP_
@@ -0,0 +1,26 @@
+#include "header_buffer.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+static thread_local std::vector<std::unique_ptr<std::string>> free_buffers;
+
+std::unique_ptr<std::string> HeaderBuffer::acquire() {
+  if (free_buffers.empty()) {
+    std::unique_ptr<std::string> buffer = std::make_unique<std::string>();
+    buffer->reserve(HEADER_BUFFER_CAPACITY);
+    return buffer;
+  }
+  std::unique_ptr<std::string> buffer = std::move(free_buffers.back());
+  free_buffers.pop_back();
+  return buffer;
+}
+
+void HeaderBuffer::release(std::unique_ptr<std::string> buffer) {
+  if (!buffer || free_buffers.size() >= HEADER_BUFFER_POOL_SIZE) {
+    return;
+  }
+  buffer->clear();
+  free_buffers.push_back(std::move(buffer));
+}
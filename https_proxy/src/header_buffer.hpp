@@ -0,0 +1,19 @@
+#ifndef HTTPS_PROXY_HEADER_BUFFER_HPP_
+#define HTTPS_PROXY_HEADER_BUFFER_HPP_
+
+#include <memory>
+#include <string>
+
+#define HEADER_BUFFER_CAPACITY 1024
+#define HEADER_BUFFER_POOL_SIZE 256
+
+// Storage for request headers read during the handshake. Released buffers keep
+// their capacity and are handed out again by the thread that released them, so
+// accepting a connection does not allocate a new buffer in steady state.
+class HeaderBuffer {
+  public:
+    static std::unique_ptr<std::string> acquire();
+    static void release(std::unique_ptr<std::string>);
+};
+
+#endif  // HTTPS_PROXY_HEADER_BUFFER_HPP_
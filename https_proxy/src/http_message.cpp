@@ -0,0 +1,343 @@
+#include "http_message.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#define CRLF "\r\n"
+#define STATUS_LINE_PREFIX "HTTP/1."
+#define STATUS_LINE_PREFIX_LENGTH 7
+
+// Headers that only apply to one connection, which are not passed on to the next hop.
+static const char *const HOP_BY_HOP_HEADERS[] = {"Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+  "Proxy-Authorization", "TE", "Upgrade"};
+
+// Compares ASCII case-insensitively, as header names, tokens and the URI scheme are.
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    char x = a[i] >= 'A' && a[i] <= 'Z' ? a[i] - 'A' + 'a' : a[i];
+    char y = b[i] >= 'A' && b[i] <= 'Z' ? b[i] - 'A' + 'a' : b[i];
+    if (x != y) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string_view trim(std::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+    value.remove_suffix(1);
+  }
+  return value;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Splits the head, which ends with an empty line. Returns false if a header line has no name or is folded onto the
+// previous one.
+bool HttpHead::parse(std::string_view text) {
+  this->headers.clear();
+  size_t end = text.find(CRLF);
+  if (end == 0 || end == std::string_view::npos) {
+    return false;
+  }
+  this->start = text.substr(0, end);
+  for (size_t start = end + 2; ; start = end + 2) {
+    end = text.find(CRLF, start);
+    if (end == std::string_view::npos) {
+      return false;
+    }
+    if (end == start) {
+      return true;
+    }
+    std::string_view line = text.substr(start, end - start);
+    size_t colon = line.find(':');
+    if (colon == 0 || colon == std::string_view::npos || line.front() == ' ' || line.front() == '\t') {
+      return false;
+    }
+    this->headers.emplace_back(line.substr(0, colon), trim(line.substr(colon + 1)));
+  }
+}
+
+std::string_view HttpHead::start_line() const {
+  return this->start;
+}
+
+// The status code of a response head, or 0 for a request.
+int HttpHead::status() const {
+  if (this->start.size() < STATUS_LINE_PREFIX_LENGTH + 5
+    || this->start.substr(0, STATUS_LINE_PREFIX_LENGTH) != STATUS_LINE_PREFIX
+    || this->start[STATUS_LINE_PREFIX_LENGTH + 1] != ' ') {
+    return 0;
+  }
+  int status = 0;
+  for (size_t i = STATUS_LINE_PREFIX_LENGTH + 2; i < STATUS_LINE_PREFIX_LENGTH + 5; i++) {
+    if (this->start[i] < '0' || this->start[i] > '9') {
+      return 0;
+    }
+    status = status * 10 + this->start[i] - '0';
+  }
+  return status;
+}
+
+// The minor version of HTTP/1 the head was sent with, or -1.
+int HttpHead::minor_version() const {
+  std::string_view version;
+  if (this->status() > 0) {
+    version = this->start.substr(0, STATUS_LINE_PREFIX_LENGTH + 1);
+  } else if (this->start.size() > STATUS_LINE_PREFIX_LENGTH) {
+    version = this->start.substr(this->start.size() - STATUS_LINE_PREFIX_LENGTH - 1);
+  }
+  if (version.size() != STATUS_LINE_PREFIX_LENGTH + 1
+    || version.substr(0, STATUS_LINE_PREFIX_LENGTH) != STATUS_LINE_PREFIX || version.back() < '0' || version.back() > '9') {
+    return -1;
+  }
+  return version.back() - '0';
+}
+
+// Returns the value of the first header with the given name, compared case-insensitively, or an empty view.
+std::string_view HttpHead::header(std::string_view name) const {
+  for (const std::pair<std::string_view, std::string_view> &header : this->headers) {
+    if (equals_ignore_case(header.first, name)) {
+      return header.second;
+    }
+  }
+  return std::string_view();
+}
+
+// Whether the comma-separated lists of the headers with the given name contain the token.
+bool HttpHead::has_token(std::string_view name, std::string_view token) const {
+  for (const std::pair<std::string_view, std::string_view> &header : this->headers) {
+    if (!equals_ignore_case(header.first, name)) {
+      continue;
+    }
+    std::string_view list = header.second;
+    while (!list.empty()) {
+      size_t comma = std::min(list.find(','), list.size());
+      if (equals_ignore_case(trim(list.substr(0, comma)), token)) {
+        return true;
+      }
+      list.remove_prefix(std::min(comma + 1, list.size()));
+    }
+  }
+  return false;
+}
+
+// Decides how the body following the head ends. The response to a HEAD request has no body, whatever its headers say.
+// Returns false for a request whose body cannot be delimited, which has a transfer coding other than chunked last, an
+// invalid or conflicting Content-Length, or both, as the next hop might delimit it differently. A response in that case
+// is read until the server closes the connection.
+bool HttpHead::body_framing(bool head_request, BodyFraming &framing, uint64_t &length) const {
+  int status = this->status();
+  bool response = status > 0;
+  length = 0;
+  if (response && (head_request || status / 100 == 1 || status == 204 || status == 304)) {
+    framing = NO_BODY;
+    return true;
+  }
+  bool has_transfer_encoding = false;
+  std::string_view last_coding;
+  bool has_length = false;
+  for (const std::pair<std::string_view, std::string_view> &header : this->headers) {
+    if (equals_ignore_case(header.first, "Transfer-Encoding")) {
+      has_transfer_encoding = true;
+      std::string_view list = header.second;
+      last_coding = trim(list.substr(list.rfind(',') == std::string_view::npos ? 0 : list.rfind(',') + 1));
+    } else if (equals_ignore_case(header.first, "Content-Length")) {
+      std::string_view value = header.second;
+      if (value.empty() || value.size() > MAX_CONTENT_LENGTH_DIGITS
+        || value.find_first_not_of("0123456789") != std::string_view::npos) {
+        framing = CLOSE_DELIMITED_BODY;
+        return response;
+      }
+      uint64_t parsed = 0;
+      for (char c : value) {
+        parsed = parsed * 10 + c - '0';
+      }
+      if (has_length && parsed != length) {
+        framing = CLOSE_DELIMITED_BODY;
+        return response;
+      }
+      has_length = true;
+      length = parsed;
+    }
+  }
+  if (has_transfer_encoding) {
+    length = 0;
+    framing = equals_ignore_case(last_coding, "chunked") ? CHUNKED_BODY : CLOSE_DELIMITED_BODY;
+    return response || (framing == CHUNKED_BODY && !has_length);
+  }
+  if (has_length) {
+    framing = length > 0 ? LENGTH_BODY : NO_BODY;
+  } else {
+    framing = response ? CLOSE_DELIMITED_BODY : NO_BODY;
+  }
+  return true;
+}
+
+// Whether the peer keeps the connection open after the message, which HTTP/1.1 does unless it asks to close it, and
+// HTTP/1.0 only does when it asks to. Clients talking to a proxy may ask in Proxy-Connection instead.
+bool HttpHead::keeps_alive() const {
+  for (std::string_view name : {"Connection", "Proxy-Connection"}) {
+    if (this->has_token(name, "close")) {
+      return false;
+    }
+  }
+  for (std::string_view name : {"Connection", "Proxy-Connection"}) {
+    if (this->has_token(name, "keep-alive")) {
+      return true;
+    }
+  }
+  return this->minor_version() >= 1;
+}
+
+// Appends the head with the given start line, leaving out hop-by-hop headers. A non-empty host replaces the Host header
+// of a request, and the next hop is asked to close the connection after the message if requested.
+void HttpHead::write_forwarded(std::string &out, std::string_view start_line, std::string_view host, bool close) const {
+  out.append(start_line).append(CRLF);
+  if (!host.empty()) {
+    out.append("Host: ").append(host).append(CRLF);
+  }
+  for (const std::pair<std::string_view, std::string_view> &header : this->headers) {
+    if (this->is_hop_by_hop(header.first) || (!host.empty() && equals_ignore_case(header.first, "Host"))) {
+      continue;
+    }
+    out.append(header.first).append(": ").append(header.second).append(CRLF);
+  }
+  if (close) {
+    out.append("Connection: close" CRLF);
+  }
+  out.append(CRLF);
+}
+
+// Includes the headers the Connection header lists.
+bool HttpHead::is_hop_by_hop(std::string_view name) const {
+  for (const char *hop_by_hop : HOP_BY_HOP_HEADERS) {
+    if (equals_ignore_case(name, hop_by_hop)) {
+      return true;
+    }
+  }
+  return this->has_token("Connection", name);
+}
+
+void BodyFramer::start(BodyFraming framing, uint64_t length) {
+  this->body_framing = framing;
+  this->remaining = length;
+  this->size_digits = 0;
+  switch (framing) {
+    case NO_BODY:
+      this->state = BODY_DONE;
+      break;
+    case LENGTH_BODY:
+      this->state = length > 0 ? BODY_DATA : BODY_DONE;
+      break;
+    case CHUNKED_BODY:
+      this->state = CHUNK_SIZE;
+      break;
+    case CLOSE_DELIMITED_BODY:
+      this->state = BODY_UNTIL_CLOSE;
+      break;
+  }
+}
+
+// Returns how many of the bytes belong to the body, stopping at its end. Stops early if the chunked framing is broken.
+size_t BodyFramer::consume(const char *data, size_t size) {
+  size_t used = 0;
+  while (used < size && this->state != BODY_DONE && this->state != BODY_FAILED) {
+    if (this->state == BODY_UNTIL_CLOSE) {
+      used = size;
+    } else if (this->state == BODY_DATA || this->state == CHUNK_DATA) {
+      uint64_t taken = std::min<uint64_t>(this->remaining, size - used);
+      used += taken;
+      this->remaining -= taken;
+      if (this->remaining == 0) {
+        this->state = this->state == BODY_DATA ? BODY_DONE : CHUNK_DATA_CR;
+      }
+    } else {
+      this->step(data[used++]);
+    }
+  }
+  return used;
+}
+
+// Bytes to read next out of a buffer of the given capacity, so that reading a body of known length does not read
+// into the message after it.
+size_t BodyFramer::wanted(size_t capacity) const {
+  return this->state == BODY_DATA ? std::min<uint64_t>(this->remaining, capacity) : capacity;
+}
+
+BodyFraming BodyFramer::framing() const {
+  return this->body_framing;
+}
+
+bool BodyFramer::is_done() const {
+  return this->state == BODY_DONE;
+}
+
+bool BodyFramer::has_failed() const {
+  return this->state == BODY_FAILED;
+}
+
+// Advances over one byte of the chunk framing: "SIZE[;extensions]\r\n", the chunk data and its "\r\n", and after the
+// last chunk of size 0, the trailer lines and an empty line.
+void BodyFramer::step(char c) {
+  switch (this->state) {
+    case CHUNK_SIZE:
+      if (hex_value(c) >= 0 && this->size_digits < MAX_CHUNK_SIZE_DIGITS) {
+        this->remaining = this->remaining * 16 + hex_value(c);
+        this->size_digits++;
+      } else if (this->size_digits > 0 && (c == ';' || c == ' ' || c == '\t')) {
+        this->state = CHUNK_EXTENSION;
+      } else if (this->size_digits > 0 && c == '\r') {
+        this->state = CHUNK_SIZE_LF;
+      } else {
+        this->state = BODY_FAILED;
+      }
+      break;
+    case CHUNK_EXTENSION:
+      this->state = c == '\r' ? CHUNK_SIZE_LF : c == '\n' ? BODY_FAILED : CHUNK_EXTENSION;
+      break;
+    case CHUNK_SIZE_LF:
+      this->state = c != '\n' ? BODY_FAILED : this->remaining > 0 ? CHUNK_DATA : TRAILER_START;
+      break;
+    case CHUNK_DATA_CR:
+      this->state = c == '\r' ? CHUNK_DATA_LF : BODY_FAILED;
+      break;
+    case CHUNK_DATA_LF:
+      this->state = c == '\n' ? CHUNK_SIZE : BODY_FAILED;
+      this->size_digits = 0;
+      break;
+    case TRAILER_START:
+      this->state = c == '\r' ? FINAL_LF : TRAILER_LINE;
+      break;
+    case TRAILER_LINE:
+      this->state = c == '\r' ? TRAILER_LF : TRAILER_LINE;
+      break;
+    case TRAILER_LF:
+      this->state = c == '\n' ? TRAILER_START : BODY_FAILED;
+      break;
+    case FINAL_LF:
+      this->state = c == '\n' ? BODY_DONE : BODY_FAILED;
+      break;
+    default:
+      break;
+  }
+}
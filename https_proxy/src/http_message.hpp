@@ -0,0 +1,71 @@
+#ifndef HTTPS_PROXY_HTTP_MESSAGE_HPP_
+#define HTTPS_PROXY_HTTP_MESSAGE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Longest chunk size accepted in a chunked body, in hexadecimal digits, which keeps the size within 60 bits.
+#define MAX_CHUNK_SIZE_DIGITS 15
+// Longest Content-Length accepted, in decimal digits.
+#define MAX_CONTENT_LENGTH_DIGITS 18
+
+bool equals_ignore_case(std::string_view, std::string_view);
+
+// How the end of a message body is found.
+enum BodyFraming {NO_BODY = 0, LENGTH_BODY = 1, CHUNKED_BODY = 2, CLOSE_DELIMITED_BODY = 3};
+
+// Head of a request or response being forwarded: a start line, "Name: value"
+// lines and an empty line. The fields are views into the parsed text, which
+// must outlive the head. Heads are only parsed as far as forwarding needs, to
+// decide how the body ends, whether the connection stays open afterwards, and
+// which headers are passed on.
+class HttpHead {
+  public:
+    bool parse(std::string_view);
+    std::string_view start_line() const;
+    int status() const;
+    int minor_version() const;
+    std::string_view header(std::string_view) const;
+    bool has_token(std::string_view, std::string_view) const;
+    bool body_framing(bool, BodyFraming&, uint64_t&) const;
+    bool keeps_alive() const;
+    void write_forwarded(std::string&, std::string_view, std::string_view, bool) const;
+
+  private:
+    std::string_view start;
+    std::vector<std::pair<std::string_view, std::string_view>> headers;
+
+    bool is_hop_by_hop(std::string_view) const;
+};
+
+// Follows a message body as its bytes pass through, without keeping them, to
+// find where the body ends. A chunked body is passed on as it is, with its
+// chunk sizes, extensions and trailer, so only the bytes between chunks are
+// looked at one by one, and chunk data is skipped over in a single step.
+class BodyFramer {
+  public:
+    void start(BodyFraming, uint64_t = 0);
+    size_t consume(const char*, size_t);
+    size_t wanted(size_t) const;
+    BodyFraming framing() const;
+    bool is_done() const;
+    bool has_failed() const;
+
+  private:
+    enum State {
+      BODY_DATA, BODY_UNTIL_CLOSE, CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_SIZE_LF, CHUNK_DATA, CHUNK_DATA_CR, CHUNK_DATA_LF,
+      TRAILER_START, TRAILER_LINE, TRAILER_LF, FINAL_LF, BODY_DONE, BODY_FAILED
+    };
+    BodyFraming body_framing = NO_BODY;
+    State state = BODY_DONE;
+    uint64_t remaining = 0;
+    int size_digits = 0;
+
+    void step(char);
+};
+
+#endif  // HTTPS_PROXY_HTTP_MESSAGE_HPP_
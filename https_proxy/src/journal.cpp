@@ -0,0 +1,153 @@
+#include "journal.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+
+// Records following a hostname record that hold the rest of a name of the given length.
+static size_t continuation_records(size_t length) {
+  return length <= JOURNAL_HOSTNAME_LENGTH ? 0
+    : (length - JOURNAL_HOSTNAME_LENGTH + JOURNAL_RECORD_SIZE - 1) / JOURNAL_RECORD_SIZE;
+}
+
+TelemetryJournal::TelemetryJournal(const std::string &path, size_t shard, size_t size, uint64_t sequence)
+  : path(path), shard(shard), size(size), sequence(sequence), fd(-1), mapping(nullptr), offset(0) {
+}
+
+TelemetryJournal::~TelemetryJournal() {
+  this->close_file();
+}
+
+// Continues after the files left by earlier runs of the shard, or returns nullptr if the first file cannot be
+// created.
+std::unique_ptr<TelemetryJournal> TelemetryJournal::create(const std::string &path, size_t shard, size_t size) {
+  std::filesystem::path prefix(TelemetryJournal::file_name(path, shard, 0));
+  std::string stem = prefix.filename().string();
+  stem.pop_back();
+  std::filesystem::path directory = prefix.has_parent_path() ? prefix.parent_path() : std::filesystem::path(".");
+  uint64_t sequence = 0;
+  std::error_code error;
+  for (const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(directory, error)) {
+    std::string name = entry.path().filename().string();
+    if (name.size() > stem.size() && name.compare(0, stem.size(), stem) == 0
+      && name.find_first_not_of("0123456789", stem.size()) == std::string::npos) {
+      sequence = std::max<uint64_t>(sequence, std::stoull(name.substr(stem.size())) + 1);
+    }
+  }
+  std::unique_ptr<TelemetryJournal> journal(new TelemetryJournal(path, shard,
+    size / JOURNAL_RECORD_SIZE * JOURNAL_RECORD_SIZE, sequence));
+  if (!journal->open_file()) {
+    return nullptr;
+  }
+  return journal;
+}
+
+std::string TelemetryJournal::file_name(const std::string &path, size_t shard, uint64_t sequence) {
+  return path + "." + std::to_string(shard) + "." + std::to_string(sequence);
+}
+
+// Writes the tunnel with the id of its hostname, giving the hostname an id first if the file has not seen it yet.
+// Returns false if the record could not be written because no journal file could be opened.
+bool TelemetryJournal::record(const std::string &hostname, TunnelRecord &record) {
+  size_t length = std::min<size_t>(hostname.size(), UINT16_MAX);
+  std::unordered_map<std::string, uint32_t>::iterator found = this->hostnames.find(hostname);
+  size_t needed = found == this->hostnames.end() ? 2 + continuation_records(length) : 1;
+  if (this->mapping == nullptr || this->offset + needed * JOURNAL_RECORD_SIZE > this->size) {
+    if (!this->rotate()) {
+      return false;
+    }
+    found = this->hostnames.end();
+    needed = 2 + continuation_records(length);
+    if (this->offset + needed * JOURNAL_RECORD_SIZE > this->size) {
+      return false;
+    }
+  }
+  if (found == this->hostnames.end()) {
+    HostnameRecord definition = {};
+    definition.type = JOURNAL_HOSTNAME;
+    definition.length = length;
+    definition.hostname = this->hostnames.size();
+    memcpy(definition.name, hostname.data(), std::min<size_t>(length, JOURNAL_HOSTNAME_LENGTH));
+    if (length > JOURNAL_HOSTNAME_LENGTH) {
+      memcpy(this->mapping + this->offset + JOURNAL_RECORD_SIZE, hostname.data() + JOURNAL_HOSTNAME_LENGTH,
+        length - JOURNAL_HOSTNAME_LENGTH);
+    }
+    this->append(&definition);
+    this->offset += continuation_records(length) * JOURNAL_RECORD_SIZE;
+    found = this->hostnames.emplace(hostname, definition.hostname).first;
+  }
+  record.type = JOURNAL_TUNNEL;
+  record.hostname = found->second;
+  this->append(&record);
+  return true;
+}
+
+// Copies the record after the last one, storing its type last. The continuation records of a hostname are written
+// before the hostname record itself.
+void TelemetryJournal::append(const void *record) {
+  char *destination = this->mapping + this->offset;
+  memcpy(destination + sizeof(uint16_t), static_cast<const char*>(record) + sizeof(uint16_t),
+    JOURNAL_RECORD_SIZE - sizeof(uint16_t));
+  __atomic_store_n(reinterpret_cast<uint16_t*>(destination), *static_cast<const uint16_t*>(record), __ATOMIC_RELEASE);
+  this->offset += JOURNAL_RECORD_SIZE;
+}
+
+// The file is allocated up front, so that writing to the mapping cannot fail once the disk fills up.
+bool TelemetryJournal::open_file() {
+  std::string name = TelemetryJournal::file_name(this->path, this->shard, this->sequence);
+  this->fd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (this->fd < 0) {
+    return false;
+  }
+  void *mapping = MAP_FAILED;
+  if (posix_fallocate(this->fd, 0, this->size) == 0) {
+    mapping = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    close(this->fd);
+    this->fd = -1;
+    unlink(name.c_str());
+    return false;
+  }
+  this->mapping = static_cast<char*>(mapping);
+  JournalHeader header = {};
+  memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+  header.version = JOURNAL_VERSION;
+  header.record_size = JOURNAL_RECORD_SIZE;
+  header.shard = this->shard;
+  header.sequence = this->sequence;
+  memcpy(this->mapping, &header, sizeof(header));
+  this->offset = JOURNAL_RECORD_SIZE;
+  if (this->sequence >= JOURNAL_KEPT_FILES) {
+    unlink(TelemetryJournal::file_name(this->path, this->shard, this->sequence - JOURNAL_KEPT_FILES).c_str());
+  }
+  return true;
+}
+
+// Truncates the file to the records it holds.
+void TelemetryJournal::close_file() {
+  if (this->mapping == nullptr) {
+    return;
+  }
+  munmap(this->mapping, this->size);
+  this->mapping = nullptr;
+  if (ftruncate(this->fd, this->offset) != 0) {
+    // Left at its full size, the file still ends at its first unwritten record.
+  }
+  close(this->fd);
+  this->fd = -1;
+}
+
+bool TelemetryJournal::rotate() {
+  if (this->mapping != nullptr) {
+    this->close_file();
+    this->sequence++;
+  }
+  this->hostnames.clear();
+  return this->open_file();
+}
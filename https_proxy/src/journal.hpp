@@ -0,0 +1,102 @@
+#ifndef HTTPS_PROXY_JOURNAL_HPP_
+#define HTTPS_PROXY_JOURNAL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#define JOURNAL_MAGIC "HPJRNL01"
+#define JOURNAL_VERSION 1
+#define JOURNAL_RECORD_SIZE 64
+// Rotated journal files kept for each shard, including the one being written.
+#define JOURNAL_KEPT_FILES 8
+#define JOURNAL_HOSTNAME_LENGTH 56
+
+// How a tunnel ended. A tunnel closed by one side may have failed to read from
+// it rather than reached the end of its stream. Each request forwarded in plain
+// HTTP mode is recorded as a tunnel of its own, which ends with its response.
+enum CloseReason {
+  NOT_CLOSED = 0, CLOSED_BY_CLIENT = 1, CLOSED_BY_SERVER = 2, WRITE_FAILED = 3, IDLE_TIMEOUT = 4, LIFETIME_EXPIRED = 5,
+  REQUEST_COMPLETED = 6
+};
+
+enum JournalRecordType {JOURNAL_END = 0, JOURNAL_HOSTNAME = 1, JOURNAL_TUNNEL = 2};
+
+// First record of every journal file.
+struct JournalHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t shard;
+  uint64_t sequence;
+  uint8_t reserved[32];
+};
+
+// Gives a hostname its id within the file, before the first tunnel to it. Names
+// longer than JOURNAL_HOSTNAME_LENGTH continue over as many of the following
+// records as they need.
+struct HostnameRecord {
+  uint16_t type;
+  uint16_t length;
+  uint32_t hostname;
+  char name[JOURNAL_HOSTNAME_LENGTH];
+};
+
+// A finished tunnel. Times are in nanoseconds since the Unix epoch, latencies
+// in microseconds, and bytes are counted from the client (upstream) and from
+// the server (downstream).
+struct TunnelRecord {
+  uint16_t type;
+  uint16_t port;
+  uint32_t hostname;
+  uint64_t upstream_bytes;
+  uint64_t downstream_bytes;
+  int64_t start_time;
+  int64_t end_time;
+  uint32_t resolve_latency;
+  uint32_t connect_latency;
+  uint16_t connect_attempts;
+  uint8_t close_reason;
+  uint8_t reserved[13];
+};
+
+static_assert(sizeof(JournalHeader) == JOURNAL_RECORD_SIZE, "journal header must fill one record");
+static_assert(sizeof(HostnameRecord) == JOURNAL_RECORD_SIZE, "hostname record must be fixed width");
+static_assert(sizeof(TunnelRecord) == JOURNAL_RECORD_SIZE, "tunnel record must be fixed width");
+
+// Fixed-width binary records of finished tunnels, written by one shard into a
+// memory-mapped file, so that recording a tunnel takes a hash lookup and a copy
+// instead of formatting a line. Files are named PATH.SHARD.SEQUENCE and are
+// created at their full size. Once a file is full it is truncated to the
+// records it holds and the shard moves on to the next sequence number, keeping
+// the last JOURNAL_KEPT_FILES files. Every file starts with its own hostname
+// ids, so it can be decoded on its own. The type of a record is stored last,
+// so a reader never sees a partly written record, and a file left at its full
+// size ends at the first record of type JOURNAL_END.
+class TelemetryJournal {
+  public:
+    ~TelemetryJournal();
+    static std::unique_ptr<TelemetryJournal> create(const std::string&, size_t, size_t);
+    static std::string file_name(const std::string&, size_t, uint64_t);
+    bool record(const std::string&, TunnelRecord&);
+
+  private:
+    TelemetryJournal(const std::string&, size_t, size_t, uint64_t);
+    std::string path;
+    size_t shard;
+    size_t size;
+    uint64_t sequence;
+    int fd;
+    char *mapping;
+    size_t offset;
+    std::unordered_map<std::string, uint32_t> hostnames;
+
+    bool open_file();
+    void close_file();
+    bool rotate();
+    void append(const void*);
+};
+
+#endif  // HTTPS_PROXY_JOURNAL_HPP_
@@ -1,21 +1,45 @@
 #include "logger.hpp"
 
 #include <time.h>
-#include <string>
 
-#include <boost/regex.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
 
-static boost::regex CR = boost::regex("\r");
-static std::string CR_REPLACEMENT = R"(\\r)";
-static boost::regex LF = boost::regex("\n");
-static std::string LF_REPLACEMENT = R"(\\n)";
+#define LOG_BATCH_CAPACITY 65536
 
-Logger::Logger(std::string path) {
+Logger::Logger(std::string path)
+  : log_level(DISABLED), overflow_policy(DROP_RECORDS), slots(new Slot[LOG_QUEUE_CAPACITY]), enqueue_position(0),
+    dequeue_position(0), dropped(0), flusher_waiting(false), closed(false), stopping(false) {
   this->log_file.open(path, std::ios::app);
-  this->log_level = DISABLED;
+  for (size_t i = 0; i < LOG_QUEUE_CAPACITY; i++) {
+    this->slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  this->flusher = std::thread(&Logger::flush_records, this);
+}
+
+Logger::~Logger() {
+  this->close();
 }
 
+// Stops accepting records, waits for the flusher to write out everything already queued and closes the file.
 void Logger::close() {
+  if (this->closed.exchange(true)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(this->wakeup_lock);
+    this->stopping = true;
+  }
+  this->wakeup.notify_one();
+  if (this->flusher.joinable()) {
+    this->flusher.join();
+  }
   this->log_file.close();
 }
 
@@ -23,13 +47,133 @@ void Logger::set_logging_level(Level lvl) {
   this->log_level = lvl;
 }
 
+void Logger::set_overflow_policy(OverflowPolicy policy) {
+  this->overflow_policy = policy;
+}
+
+uint64_t Logger::dropped_count() {
+  return this->dropped.load(std::memory_order_relaxed);
+}
+
 void Logger::write(Level lvl, std::string message) {
-  std::string trimmed = boost::regex_replace(message, CR, CR_REPLACEMENT);
-  trimmed = boost::regex_replace(trimmed, LF, LF_REPLACEMENT);
-  std::string timestamp = Logger::current_timestamp();
-  std::string lvl_string = Logger::level_to_string(lvl);
-  std::string formatted_message = timestamp + "|" + lvl_string + "|" + trimmed + "\n";
-  this->log_file << formatted_message;
+  this->log(lvl, nullptr, message);
+}
+
+// Claims the next slot of the ring for a writer. Returns nullptr, and counts the record as dropped, if the logger is
+// closed or the queue is full and the overflow policy drops records.
+Logger::Slot* Logger::claim(size_t &position) {
+  if (this->closed.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  position = this->enqueue_position.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot *slot = &(this->slots[position % LOG_QUEUE_CAPACITY]);
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+    if (difference == 0) {
+      if (this->enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        return slot;
+      }
+    } else if (difference < 0) {
+      if (this->overflow_policy == DROP_RECORDS || this->closed.load(std::memory_order_relaxed)) {
+        this->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      this->wake_flusher();
+      std::this_thread::yield();
+      position = this->enqueue_position.load(std::memory_order_relaxed);
+    } else {
+      position = this->enqueue_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+// Hands a filled slot to the flusher and wakes it if it is waiting for records.
+void Logger::publish(Slot *slot, size_t position, Level lvl, const char *function) {
+  slot->level = lvl;
+  slot->timestamp = time(0);
+  slot->function = function;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (this->flusher_waiting.load(std::memory_order_relaxed)) {
+    this->wake_flusher();
+  }
+}
+
+void Logger::wake_flusher() {
+  {
+    std::lock_guard<std::mutex> guard(this->wakeup_lock);
+  }
+  this->wakeup.notify_one();
+}
+
+// Body of the flusher thread. Drains every published record into one batch and writes it with a single call, then
+// sleeps until a writer wakes it or the flush interval elapses.
+void Logger::flush_records() {
+  std::string batch;
+  batch.reserve(LOG_BATCH_CAPACITY);
+  std::string timestamp;
+  time_t formatted_at = -1;
+  uint64_t reported_drops = 0;
+  for (;;) {
+    size_t count = this->drain(batch, formatted_at, timestamp);
+    uint64_t drops = this->dropped.load(std::memory_order_relaxed);
+    if (drops != reported_drops) {
+      Logger::format_timestamp(time(0), timestamp);
+      formatted_at = -1;
+      batch += timestamp + "|WARN|Logger|Dropped " + std::to_string(drops - reported_drops) +
+        " records because the queue was full\n";
+      reported_drops = drops;
+    }
+    if (!batch.empty()) {
+      this->log_file.write(batch.data(), batch.size());
+      this->log_file.flush();
+      batch.clear();
+    }
+    if (count > 0) {
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(this->wakeup_lock);
+    if (this->stopping) {
+      return;
+    }
+    this->flusher_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Slot &next = this->slots[this->dequeue_position % LOG_QUEUE_CAPACITY];
+    if (next.sequence.load(std::memory_order_acquire) != this->dequeue_position + 1) {
+      this->wakeup.wait_for(guard, LOG_FLUSH_INTERVAL);
+    }
+    this->flusher_waiting.store(false, std::memory_order_relaxed);
+  }
+}
+
+// Formats every published record into the batch and hands the slots back to the writers. The timestamp is only
+// reformatted when the second changes. Returns the number of records drained.
+size_t Logger::drain(std::string &batch, time_t &formatted_at, std::string &timestamp) {
+  size_t count = 0;
+  for (;;) {
+    Slot &slot = this->slots[this->dequeue_position % LOG_QUEUE_CAPACITY];
+    if (slot.sequence.load(std::memory_order_acquire) != this->dequeue_position + 1) {
+      return count;
+    }
+    if (slot.timestamp != formatted_at) {
+      Logger::format_timestamp(slot.timestamp, timestamp);
+      formatted_at = slot.timestamp;
+    }
+    batch += timestamp;
+    batch += '|';
+    batch += Logger::level_to_string(slot.level);
+    batch += '|';
+    if (slot.function != nullptr && slot.function[0] != '\0') {
+      batch += slot.function;
+      batch += '|';
+    }
+    Logger::format_payload(batch, slot.payload);
+    batch += '\n';
+    slot.sequence.store(this->dequeue_position + LOG_QUEUE_CAPACITY, std::memory_order_release);
+    this->dequeue_position++;
+    count++;
+  }
 }
 
 void Logger::write_debug(std::string message, std::string function) {
@@ -82,13 +226,97 @@ void Logger::write_fatal(std::string message, std::string function) {
   this->write(FATAL, message);
 }
 
-std::string Logger::current_timestamp() {
-  time_t timestamp = time(0);
+void Logger::format_timestamp(time_t timestamp, std::string &formatted) {
   struct tm tstruct;
   char buf[80];
   localtime_r(&timestamp, &tstruct);
   strftime(buf, sizeof(buf), "%Y-%m-%d.%X", &tstruct);
-  return buf;
+  formatted.assign(buf);
+}
+
+// Decodes the arguments captured by Logger::encode and appends their text to the batch.
+void Logger::format_payload(std::string &batch, const std::string &payload) {
+  const char *cursor = payload.data();
+  const char *end = cursor + payload.size();
+  while (cursor < end) {
+    ArgumentType type = static_cast<ArgumentType>(*cursor);
+    cursor++;
+    switch (type) {
+      case STRING_ARGUMENT: {
+        size_t length;
+        memcpy(&length, cursor, sizeof(length));
+        cursor += sizeof(length);
+        Logger::append_escaped(batch, std::string_view(cursor, length));
+        cursor += length;
+        break;
+      }
+      case SIGNED_ARGUMENT: {
+        int64_t value;
+        memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        batch += std::to_string(value);
+        break;
+      }
+      case UNSIGNED_ARGUMENT: {
+        uint64_t value;
+        memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        batch += std::to_string(value);
+        break;
+      }
+      case FLOAT_ARGUMENT: {
+        double value;
+        memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        batch += std::to_string(value);
+        break;
+      }
+      case BOOL_ARGUMENT:
+        batch += *cursor ? "true" : "false";
+        cursor += sizeof(bool);
+        break;
+      case CHAR_ARGUMENT:
+        Logger::append_escaped(batch, std::string_view(cursor, 1));
+        cursor += sizeof(char);
+        break;
+      case ERROR_ARGUMENT: {
+        const boost::system::error_category *category;
+        int value;
+        memcpy(&category, cursor, sizeof(category));
+        cursor += sizeof(category);
+        memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        Logger::append_escaped(batch, category->message(value));
+        break;
+      }
+      case OBJECT_ARGUMENT: {
+        ObjectFormatter formatter;
+        size_t size;
+        memcpy(&formatter, cursor, sizeof(formatter));
+        cursor += sizeof(formatter);
+        memcpy(&size, cursor, sizeof(size));
+        cursor += sizeof(size);
+        formatter(batch, cursor);
+        cursor += size;
+        break;
+      }
+    }
+  }
+}
+
+// Replaces carriage returns and line feeds with their escape sequences so that every record stays on one line.
+void Logger::append_escaped(std::string &batch, std::string_view message) {
+  size_t start = 0;
+  for (size_t i = 0; i < message.size(); i++) {
+    char c = message[i];
+    if (c != '\r' && c != '\n') {
+      continue;
+    }
+    batch.append(message.substr(start, i - start));
+    batch += c == '\r' ? "\\r" : "\\n";
+    start = i + 1;
+  }
+  batch.append(message.substr(start));
 }
 
 std::string Logger::level_to_string(Level lvl) {
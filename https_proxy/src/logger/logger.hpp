@@ -1,31 +1,185 @@
 #ifndef HTTPS_PROXY_LOGGER_HPP_
 #define HTTPS_PROXY_LOGGER_HPP_
 
+#include <time.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/system/error_code.hpp>
+
+#define LOG_QUEUE_CAPACITY 8192
+#define LOG_FLUSH_INTERVAL std::chrono::milliseconds(100)
 
 enum Level {DEBUG = 0, INFO = 1, WARN = 2, ERROR = 3, FATAL = 4, DISABLED = 5};
 
+// Records below this level are compiled out entirely, e.g. with -DLOGGER_MIN_LEVEL=INFO.
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL DEBUG
+#endif
+
+// Logs a record made of the concatenation of the arguments. The arguments are
+// only evaluated when the level is enabled, and are captured by type and
+// formatted on the flusher thread.
+#define LOG_AT(logger, lvl, function, ...) \
+  do { \
+    if ((lvl) >= LOGGER_MIN_LEVEL && (logger).is_enabled(lvl)) { \
+      (logger).log((lvl), (function), __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define LOG_DEBUG(logger, function, ...) LOG_AT(logger, DEBUG, function, __VA_ARGS__)
+#define LOG_INFO(logger, function, ...) LOG_AT(logger, INFO, function, __VA_ARGS__)
+#define LOG_WARN(logger, function, ...) LOG_AT(logger, WARN, function, __VA_ARGS__)
+#define LOG_ERROR(logger, function, ...) LOG_AT(logger, ERROR, function, __VA_ARGS__)
+#define LOG_FATAL(logger, function, ...) LOG_AT(logger, FATAL, function, __VA_ARGS__)
+
+// What a writer does when the queue of records waiting to be flushed is full.
+enum OverflowPolicy {DROP_RECORDS = 0, BLOCK_WRITERS = 1};
+
+// Writers append records to a bounded multi-producer ring without taking a
+// lock, and a dedicated flusher thread formats the records and writes them to
+// the log file in batches. A record holds its arguments in a compact binary
+// encoding, and each slot keeps the capacity of its encoding buffer, so
+// steady-state logging does not allocate.
 class Logger {
   public:
     explicit Logger(std::string);
+    ~Logger();
     void close();
     void set_logging_level(Level);
+    void set_overflow_policy(OverflowPolicy);
+    uint64_t dropped_count();
+
+    bool is_enabled(Level lvl) const {
+      return lvl >= this->log_level;
+    }
+
+    // Captures the arguments into the next slot of the queue. The function name must outlive the logger, normally
+    // it is a string literal.
+    template <typename... Arguments>
+    void log(Level lvl, const char *function, const Arguments&... arguments) {
+      size_t position;
+      Slot *slot = this->claim(position);
+      if (slot == nullptr) {
+        return;
+      }
+      slot->payload.clear();
+      (Logger::encode(slot->payload, arguments), ...);
+      this->publish(slot, position, lvl, function);
+    }
+
     void write_debug(std::string, std::string = "");
     void write_info(std::string, std::string = "");
     void write_warn(std::string, std::string = "");
     void write_error(std::string, std::string = "");
     void write_fatal(std::string, std::string = "");
 
+    static void format_timestamp(time_t, std::string&);
+
   protected:
     void write(Level, std::string);
 
   private:
+    enum ArgumentType : char {
+      STRING_ARGUMENT, SIGNED_ARGUMENT, UNSIGNED_ARGUMENT, FLOAT_ARGUMENT, BOOL_ARGUMENT, CHAR_ARGUMENT,
+      ERROR_ARGUMENT, OBJECT_ARGUMENT
+    };
+
+    typedef void (*ObjectFormatter)(std::string&, const char*);
+
+    struct Slot {
+      std::atomic<size_t> sequence;
+      Level level;
+      time_t timestamp;
+      const char *function;
+      std::string payload;
+    };
+
     std::ofstream log_file;
     Level log_level;
+    OverflowPolicy overflow_policy;
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> enqueue_position;
+    alignas(64) size_t dequeue_position;
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> flusher_waiting;
+    std::atomic<bool> closed;
+    bool stopping;
+    std::mutex wakeup_lock;
+    std::condition_variable wakeup;
+    std::thread flusher;
 
-    static std::string current_timestamp();
+    Slot* claim(size_t&);
+    void publish(Slot*, size_t, Level, const char*);
+    void wake_flusher();
+    void flush_records();
+    size_t drain(std::string&, time_t&, std::string&);
+
+    static void format_payload(std::string&, const std::string&);
+    static void append_escaped(std::string&, std::string_view);
     static std::string level_to_string(Level);
+
+    template <typename Value>
+    static void append_value(std::string &payload, ArgumentType type, const Value &value) {
+      payload.push_back(type);
+      payload.append(reinterpret_cast<const char*>(&value), sizeof(Value));
+    }
+
+    template <typename Object>
+    static void format_object(std::string &batch, const char *bytes) {
+      typename std::aligned_storage<sizeof(Object), alignof(Object)>::type storage;
+      memcpy(&storage, bytes, sizeof(Object));
+      std::ostringstream stream;
+      stream << *reinterpret_cast<const Object*>(&storage);
+      Logger::append_escaped(batch, stream.str());
+    }
+
+    template <typename Argument>
+    static void encode(std::string &payload, const Argument &argument) {
+      if constexpr (std::is_same_v<Argument, bool>) {
+        Logger::append_value(payload, BOOL_ARGUMENT, argument);
+      } else if constexpr (std::is_same_v<Argument, char>) {
+        Logger::append_value(payload, CHAR_ARGUMENT, argument);
+      } else if constexpr (std::is_integral_v<Argument> && std::is_signed_v<Argument>) {
+        Logger::append_value(payload, SIGNED_ARGUMENT, static_cast<int64_t>(argument));
+      } else if constexpr (std::is_integral_v<Argument>) {
+        Logger::append_value(payload, UNSIGNED_ARGUMENT, static_cast<uint64_t>(argument));
+      } else if constexpr (std::is_floating_point_v<Argument>) {
+        Logger::append_value(payload, FLOAT_ARGUMENT, static_cast<double>(argument));
+      } else if constexpr (std::is_convertible_v<const Argument&, std::string_view>) {
+        std::string_view text = argument;
+        Logger::append_value(payload, STRING_ARGUMENT, text.size());
+        payload.append(text.data(), text.size());
+      } else if constexpr (std::is_same_v<Argument, boost::system::error_code>) {
+        int value = argument.value();
+        Logger::append_value(payload, ERROR_ARGUMENT, &(argument.category()));
+        payload.append(reinterpret_cast<const char*>(&value), sizeof(int));
+      } else if constexpr (std::is_same_v<Argument, boost::asio::ip::address>) {
+        // Addresses are not trivially copyable, so they are formatted as they are captured.
+        Logger::encode(payload, argument.to_string());
+      } else {
+        // The bytes of the argument are copied now and formatted as an object later, which only a trivially copyable
+        // type allows.
+        static_assert(std::is_trivially_copyable_v<Argument>, "Log arguments must be trivially copyable");
+        ObjectFormatter formatter = &Logger::format_object<Argument>;
+        size_t size = sizeof(Argument);
+        Logger::append_value(payload, OBJECT_ARGUMENT, formatter);
+        payload.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        payload.append(reinterpret_cast<const char*>(&argument), sizeof(Argument));
+      }
+    }
 };
 
 #endif  // HTTPS_PROXY_LOGGER_HPP_
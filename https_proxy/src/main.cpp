@@ -1,18 +1,55 @@
-#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "blacklist_reloader.hpp"
 #include "context.hpp"
 #include "server.hpp"
+#include "shard.hpp"
+#include "splice_pipe.hpp"
+#include "uring_relay.hpp"
+
+#define USAGE "Usage: ./proxy PORT [TELEMETRY_FLAG [PATH_TO_BLACKLIST [LOGGING_LEVEL]]] [--relay=copy|splice|uring] " \
+  "[--header-timeout=MILLISECONDS] [--max-header-size=BYTES] [--dns-ttl=SECONDS] [--dns-negative-ttl=SECONDS] " \
+  "[--connect-stagger=MILLISECONDS] [--connect-timeout=MILLISECONDS] [--blacklist-poll=SECONDS] [--log-overflow=drop|block] " \
+  "[--shards=COUNT] [--pin-cpus] [--max-tunnels=COUNT] [--max-handshakes=COUNT] [--max-lookups=COUNT] " \
+  "[--shed=pause|reject] [--backlog=COUNT] [--idle-timeout=SECONDS] [--max-lifetime=SECONDS] " \
+  "[--metrics-port=PORT] [--top-talkers=COUNT] [--socket-profile=default|latency|bulk] [--socket-config=PATH] " \
+  "[--socket-options=NAME=VALUE[,NAME=VALUE...]] [--journal=PATH] [--journal-size=MEGABYTES] [--forward-http] " \
+  "[--upstream-pool=COUNT] [--upstream-idle-timeout=SECONDS]"
+
+// Separates "--name=value" flags from the positional arguments.
+static std::unordered_map<std::string, std::string> parse_flags(int argc, char * argv[], std::vector<std::string> &positional) {
+  std::unordered_map<std::string, std::string> flags;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = std::string(argv[i]);
+    if (argument.find("--") != 0) {
+      positional.push_back(argument);
+      continue;
+    }
+    size_t separator = argument.find("=");
+    if (separator == std::string::npos) {
+      flags[argument.substr(2)] = "";
+    } else {
+      flags[argument.substr(2, separator - 2)] = argument.substr(separator + 1);
+    }
+  }
+  return flags;
+}
 
 int main(int argc, char * argv[]) {
-  if (argc < 2 || argc > 5) {
-    std::cout << "Usage: ./proxy PORT [TELEMETRY_FLAG [PATH_TO_BLACKLIST]]`" << std::endl;
+  std::vector<std::string> args;
+  std::unordered_map<std::string, std::string> flags = parse_flags(argc, argv, args);
+  if (args.size() < 1 || args.size() > 4) {
+    std::cout << USAGE << std::endl;
     return 1;
   }
-  if (argc >= 3) {
-    std::string telemetry_flag = std::string(argv[2]);
+  if (args.size() >= 2) {
+    std::string telemetry_flag = args[1];
     if (telemetry_flag == "0") {
       ctx.telemetry = false;
     } else if (telemetry_flag == "1") {
@@ -22,8 +59,8 @@ int main(int argc, char * argv[]) {
       return 2;
     }
   }
-  if (argc == 5) {
-    std::string level = std::string(argv[4]);
+  if (args.size() == 4) {
+    std::string level = args[3];
     if (level == "debug") {
       ctx.logger.set_logging_level(DEBUG);
     } else if (level == "info") {
@@ -37,26 +74,216 @@ int main(int argc, char * argv[]) {
       return 2;
     }
   }
-  if (argc >= 4 && access(argv[3], F_OK) == 0) {
-    std::ifstream blacklist_file;
-    blacklist_file.open(argv[3], std::ios::in);
-    std::unique_ptr<std::vector<std::string>> entries = std::make_unique<std::vector<std::string>>();
-    std::string buffer;
-    while (std::getline(blacklist_file, buffer)) {
-      if (buffer.size() > 0) {
-        entries->push_back(buffer);
+  int dns_ttl = DEFAULT_POSITIVE_TTL;
+  int dns_negative_ttl = DEFAULT_NEGATIVE_TTL;
+  int blacklist_poll_interval = DEFAULT_BLACKLIST_POLL_INTERVAL;
+  std::string socket_profile = DEFAULT_SOCKET_PROFILE;
+  std::string socket_config;
+  std::string socket_options;
+  for (std::pair<const std::string, std::string> &flag : flags) {
+    if (flag.first == "relay") {
+      if (flag.second == "copy") {
+        ctx.relay_mode = COPY_RELAY;
+      } else if (flag.second == "splice" && SplicePipe::is_supported()) {
+        ctx.relay_mode = SPLICE_RELAY;
+      } else if (flag.second == "uring" && UringRelay::is_supported()) {
+        ctx.relay_mode = URING_RELAY;
+      } else {
+        std::cout << "Invalid options\n" << "Relay = copy | splice (Linux only) | uring (Linux 6.0 or later)" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "header-timeout") {
+      ctx.header_timeout = atoi(flag.second.c_str());
+      if (ctx.header_timeout <= 0) {
+        std::cout << "Invalid options\n" << "Header timeout must be a positive number of milliseconds" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "idle-timeout") {
+      ctx.idle_timeout = atoi(flag.second.c_str());
+      if (ctx.idle_timeout <= 0) {
+        std::cout << "Invalid options\n" << "Idle timeout must be a positive number of seconds" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "max-lifetime") {
+      ctx.max_lifetime = atoi(flag.second.c_str());
+      if (ctx.max_lifetime < 0) {
+        std::cout << "Invalid options\n" << "Maximum lifetime must be a non-negative number of seconds" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "max-header-size") {
+      int max_header_size = atoi(flag.second.c_str());
+      if (max_header_size <= 0) {
+        std::cout << "Invalid options\n" << "Maximum header size must be a positive number of bytes" << std::endl;
+        return 2;
+      }
+      ctx.max_header_size = max_header_size;
+    } else if (flag.first == "dns-ttl") {
+      dns_ttl = atoi(flag.second.c_str());
+    } else if (flag.first == "dns-negative-ttl") {
+      dns_negative_ttl = atoi(flag.second.c_str());
+    } else if (flag.first == "connect-stagger" || flag.first == "connect-timeout") {
+      int milliseconds = atoi(flag.second.c_str());
+      if (milliseconds <= 0) {
+        std::cout << "Invalid options\n" << "Connect stagger and timeout must be a positive number of milliseconds" << std::endl;
+        return 2;
+      }
+      (flag.first == "connect-stagger" ? ctx.connect_stagger : ctx.connect_timeout) = milliseconds;
+    } else if (flag.first == "blacklist-poll") {
+      blacklist_poll_interval = atoi(flag.second.c_str());
+      if (blacklist_poll_interval < 0) {
+        std::cout << "Invalid options\n" << "Blacklist poll interval must be a non-negative number of seconds" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "log-overflow") {
+      if (flag.second == "drop") {
+        ctx.logger.set_overflow_policy(DROP_RECORDS);
+      } else if (flag.second == "block") {
+        ctx.logger.set_overflow_policy(BLOCK_WRITERS);
+      } else {
+        std::cout << "Invalid options\n" << "Log overflow = drop | block" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "shards") {
+      int shard_count = atoi(flag.second.c_str());
+      if (shard_count <= 0) {
+        std::cout << "Invalid options\n" << "Shard count must be a positive number" << std::endl;
+        return 2;
+      }
+      ctx.shard_count = shard_count;
+    } else if (flag.first == "pin-cpus") {
+      ctx.pin_shards = true;
+    } else if (flag.first == "max-tunnels" || flag.first == "max-handshakes" || flag.first == "max-lookups") {
+      int limit = atoi(flag.second.c_str());
+      if (limit <= 0) {
+        std::cout << "Invalid options\n" << "Tunnel, handshake and lookup limits must be a positive number" << std::endl;
+        return 2;
+      }
+      AdmissionSlot slot = flag.first == "max-tunnels" ? TUNNEL_SLOT
+        : flag.first == "max-handshakes" ? HANDSHAKE_SLOT : LOOKUP_SLOT;
+      ctx.admission.set_limit(slot, limit);
+    } else if (flag.first == "shed") {
+      if (flag.second == "pause") {
+        ctx.admission.set_policy(PAUSE_ACCEPTING);
+      } else if (flag.second == "reject") {
+        ctx.admission.set_policy(REJECT_REQUESTS);
+      } else {
+        std::cout << "Invalid options\n" << "Shed = pause | reject" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "metrics-port") {
+      ctx.metrics_port = atoi(flag.second.c_str());
+      if (ctx.metrics_port <= 0 || ctx.metrics_port > 65535) {
+        std::cout << "Invalid options\n" << "Metrics port must be between 1 and 65535" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "top-talkers") {
+      int top_talkers = atoi(flag.second.c_str());
+      if (top_talkers <= 0) {
+        std::cout << "Invalid options\n" << "Number of top talkers must be a positive number" << std::endl;
+        return 2;
       }
+      ctx.top_talkers.set_capacity(top_talkers);
+    } else if (flag.first == "socket-profile") {
+      socket_profile = flag.second;
+    } else if (flag.first == "socket-config") {
+      socket_config = flag.second;
+    } else if (flag.first == "socket-options") {
+      socket_options = flag.second;
+    } else if (flag.first == "journal") {
+      if (flag.second.empty()) {
+        std::cout << "Invalid options\n" << "Journal path must not be empty" << std::endl;
+        return 2;
+      }
+      ctx.journal_path = flag.second;
+    } else if (flag.first == "journal-size") {
+      int megabytes = atoi(flag.second.c_str());
+      if (megabytes <= 0) {
+        std::cout << "Invalid options\n" << "Journal size must be a positive number of megabytes" << std::endl;
+        return 2;
+      }
+      ctx.journal_size = static_cast<size_t>(megabytes) * 1024 * 1024;
+    } else if (flag.first == "forward-http") {
+      ctx.forward_http = true;
+    } else if (flag.first == "upstream-pool") {
+      int pool_size = atoi(flag.second.c_str());
+      if (pool_size < 0) {
+        std::cout << "Invalid options\n" << "Upstream pool size must be a non-negative number of connections" << std::endl;
+        return 2;
+      }
+      ctx.upstream_pool_size = pool_size;
+    } else if (flag.first == "upstream-idle-timeout") {
+      ctx.upstream_idle_timeout = atoi(flag.second.c_str());
+      if (ctx.upstream_idle_timeout <= 0) {
+        std::cout << "Invalid options\n" << "Upstream idle timeout must be a positive number of seconds" << std::endl;
+        return 2;
+      }
+    } else if (flag.first == "backlog") {
+      ctx.listen_backlog = atoi(flag.second.c_str());
+      if (ctx.listen_backlog <= 0) {
+        std::cout << "Invalid options\n" << "Backlog must be a positive number of connections" << std::endl;
+        return 2;
+      }
+    } else {
+      std::cout << "Unknown option: --" << flag.first << "\n" << USAGE << std::endl;
+      return 2;
+    }
+  }
+  if (dns_ttl < 0 || dns_negative_ttl < 0) {
+    std::cout << "Invalid options\n" << "DNS TTLs must be a non-negative number of seconds" << std::endl;
+    return 2;
+  }
+  // Options from the config file override the profile, and options from the command line override both.
+  if (!ctx.socket_tuning.use_profile(socket_profile)) {
+    std::cout << "Invalid options\n" << "Socket profile = default | latency | bulk" << std::endl;
+    return 2;
+  }
+  std::string socket_error;
+  if (!socket_config.empty() && !ctx.socket_tuning.read_options(socket_config, socket_error)) {
+    std::cout << "Invalid socket config\n" << socket_error << std::endl;
+    return 2;
+  }
+  std::stringstream socket_option_list(socket_options);
+  std::string socket_option;
+  while (std::getline(socket_option_list, socket_option, ',')) {
+    size_t separator = socket_option.find("=");
+    if (separator == std::string::npos
+      || !ctx.socket_tuning.set_option(socket_option.substr(0, separator), socket_option.substr(separator + 1))) {
+      std::cout << "Invalid options\n" << "Unknown or invalid socket option: " << socket_option << std::endl;
+      return 2;
+    }
+  }
+  if (ctx.shard_count == 0) {
+    ctx.shard_count = Shard::default_count();
+  }
+#ifndef SO_REUSEPORT
+  if (ctx.shard_count > 1) {
+    std::cout << "Invalid options\n" << "Multiple shards require SO_REUSEPORT" << std::endl;
+    return 2;
+  }
+#endif
+  ctx.resolver.set_ttl(dns_ttl, dns_negative_ttl);
+  std::unique_ptr<BlacklistReloader> reloader;
+  if (args.size() >= 3 && access(args[2].c_str(), F_OK) == 0) {
+    std::unique_ptr<std::vector<std::string>> entries = Blacklist::read_entries(args[2]);
+    if (!entries) {
+      LOG_ERROR(ctx.logger, "", "Unable to read blacklist file: ", args[2]);
+      std::cout << "Unable to read specified file: " << args[2] << std::endl;
+      return 3;
     }
-    blacklist_file.close();
     ctx.blacklist.add_entries(std::move(entries));
-  } else if (argc >= 4) {
-    ctx.logger.write_info("Blacklist file not found: " + std::string(argv[3]));
-    std::cout << "Specified file not found: " << std::string(argv[3]) << std::endl;
+    reloader = std::make_unique<BlacklistReloader>(ctx.blacklist, args[2], blacklist_poll_interval);
+    reloader->start();
+  } else if (args.size() >= 3) {
+    LOG_INFO(ctx.logger, "", "Blacklist file not found: ", args[2]);
+    std::cout << "Specified file not found: " << args[2] << std::endl;
     return 3;
   }
-  std::shared_ptr<Server> server = Server::create(atoi(argv[1]));
+  std::shared_ptr<Server> server = Server::create(atoi(args[0].c_str()));
   server->listen();
-  ctx.logger.write_info("Gracefully stopped proxy.");
+  if (reloader) {
+    reloader->stop();
+  }
+  LOG_INFO(ctx.logger, "", "Gracefully stopped proxy.");
   ctx.logger.close();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,289 @@
+#include "metrics.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "context.hpp"
+
+// Histograms are exported with a bucket per power of two of nanoseconds in this range.
+#define EXPORTED_MIN_EXPONENT 7
+#define EXPORTED_MAX_EXPONENT 36
+
+// Values of one thread, only written by that thread.
+struct LocalMetrics {
+  std::atomic<uint64_t> counters[METRIC_COUNTERS];
+  std::atomic<uint64_t> buckets[METRIC_HISTOGRAMS][HISTOGRAM_BUCKETS];
+  std::atomic<uint64_t> sums[METRIC_HISTOGRAMS];
+
+  LocalMetrics();
+  ~LocalMetrics();
+  void add_to(MetricsSnapshot&) const;
+};
+
+static std::mutex registry_lock;
+static std::vector<LocalMetrics*> registry;
+// Values of the threads that have exited.
+static MetricsSnapshot retired = {};
+
+static thread_local LocalMetrics local_metrics;
+
+static void increment(std::atomic<uint64_t> &counter, uint64_t amount) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+LocalMetrics::LocalMetrics() {
+  for (std::atomic<uint64_t> &counter : this->counters) {
+    counter = 0;
+  }
+  for (int histogram = 0; histogram < METRIC_HISTOGRAMS; histogram++) {
+    for (std::atomic<uint64_t> &bucket : this->buckets[histogram]) {
+      bucket = 0;
+    }
+    this->sums[histogram] = 0;
+  }
+  std::lock_guard<std::mutex> guard(registry_lock);
+  registry.push_back(this);
+}
+
+LocalMetrics::~LocalMetrics() {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  this->add_to(retired);
+  for (size_t i = 0; i < registry.size(); i++) {
+    if (registry[i] == this) {
+      registry.erase(registry.begin() + i);
+      break;
+    }
+  }
+}
+
+void LocalMetrics::add_to(MetricsSnapshot &snapshot) const {
+  for (int counter = 0; counter < METRIC_COUNTERS; counter++) {
+    snapshot.counters[counter] += this->counters[counter].load(std::memory_order_relaxed);
+  }
+  for (int histogram = 0; histogram < METRIC_HISTOGRAMS; histogram++) {
+    HistogramSnapshot &target = snapshot.histograms[histogram];
+    for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+      uint64_t count = this->buckets[histogram][bucket].load(std::memory_order_relaxed);
+      target.buckets[bucket] += count;
+      target.count += count;
+    }
+    target.sum += this->sums[histogram].load(std::memory_order_relaxed);
+  }
+}
+
+void Metrics::increment(MetricCounter counter, uint64_t amount) {
+  ::increment(local_metrics.counters[counter], amount);
+}
+
+void Metrics::record(MetricHistogram histogram, std::chrono::steady_clock::duration duration) {
+  uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  LocalMetrics &metrics = local_metrics;
+  ::increment(metrics.buckets[histogram][Metrics::bucket_index(nanoseconds)], 1);
+  ::increment(metrics.sums[histogram], nanoseconds);
+}
+
+void Metrics::record_response(int status) {
+  switch (status) {
+    case 400: Metrics::increment(BAD_REQUEST_RESPONSES); break;
+    case 403: Metrics::increment(FORBIDDEN_RESPONSES); break;
+    case 404: Metrics::increment(NOT_FOUND_RESPONSES); break;
+    case 405: Metrics::increment(METHOD_NOT_ALLOWED_RESPONSES); break;
+    case 502: Metrics::increment(BAD_GATEWAY_RESPONSES); break;
+    case 503: Metrics::increment(SERVICE_UNAVAILABLE_RESPONSES); break;
+    case 505: Metrics::increment(VERSION_NOT_SUPPORTED_RESPONSES); break;
+  }
+}
+
+MetricsSnapshot Metrics::snapshot() {
+  std::lock_guard<std::mutex> guard(registry_lock);
+  MetricsSnapshot snapshot = retired;
+  for (LocalMetrics *metrics : registry) {
+    metrics->add_to(snapshot);
+  }
+  return snapshot;
+}
+
+// Values below 2^HISTOGRAM_SUB_BUCKET_BITS have a bucket each. Above that, the
+// exponent of the value picks a group of buckets and the bits following its
+// leading bit pick the bucket in the group.
+size_t Metrics::bucket_index(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return value;
+  }
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent >= HISTOGRAM_MAX_EXPONENT) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  size_t sub_bucket = (value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+  return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+// The smallest value above the given bucket.
+uint64_t Metrics::bucket_limit(size_t index) {
+  if (index < HISTOGRAM_SUB_BUCKETS) {
+    return index + 1;
+  }
+  int exponent = index / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+  uint64_t sub_bucket = index % HISTOGRAM_SUB_BUCKETS;
+  return (HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << (exponent - HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+// Number of recorded values below the limit, which is exact when the limit is a bucket boundary.
+uint64_t HistogramSnapshot::count_below(uint64_t limit) const {
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS && Metrics::bucket_limit(bucket) <= limit; bucket++) {
+    count += this->buckets[bucket];
+  }
+  return count;
+}
+
+// Upper bound of the bucket holding the nearest-rank percentile of the recorded values.
+uint64_t HistogramSnapshot::percentile(double fraction) const {
+  uint64_t target = std::ceil(fraction * this->count);
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    count += this->buckets[bucket];
+    if (count > 0 && count >= target) {
+      return Metrics::bucket_limit(bucket) - 1;
+    }
+  }
+  return 0;
+}
+
+static void write_metric(std::string &text, const char *name, const char *type, const char *help) {
+  text.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  text.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+static void write_sample(std::string &text, const char *name, const char *labels, uint64_t value) {
+  text.append(name);
+  if (labels[0] != '\0') {
+    text.append("{").append(labels).append("}");
+  }
+  text.append(" ").append(std::to_string(value)).append("\n");
+}
+
+// Writes one sample per tracked key, labelled with the key escaped as a label value.
+static void write_estimates(std::string &text, const char *name, const char *label,
+  const std::vector<TalkerEstimate> &estimates) {
+  for (const TalkerEstimate &estimate : estimates) {
+    text.append(name).append("{").append(label).append("=\"");
+    for (char c : estimate.key) {
+      if (c == '\\' || c == '"') {
+        text.push_back('\\');
+        text.push_back(c);
+      } else if (c == '\n') {
+        text.append("\\n");
+      } else {
+        text.push_back(c);
+      }
+    }
+    text.append("\"} ").append(std::to_string(estimate.count)).append("\n");
+  }
+}
+
+static void write_histogram(std::string &text, const char *name, const char *help, const HistogramSnapshot &histogram) {
+  char number[32];
+  write_metric(text, name, "histogram", help);
+  for (int exponent = EXPORTED_MIN_EXPONENT; exponent <= EXPORTED_MAX_EXPONENT; exponent++) {
+    snprintf(number, sizeof(number), "%.10g", ((uint64_t) 1 << exponent) / 1e9);
+    text.append(name).append("_bucket{le=\"").append(number).append("\"} ");
+    text.append(std::to_string(histogram.count_below((uint64_t) 1 << exponent))).append("\n");
+  }
+  text.append(name).append("_bucket{le=\"+Inf\"} ").append(std::to_string(histogram.count)).append("\n");
+  snprintf(number, sizeof(number), "%.9f", histogram.sum / 1e9);
+  text.append(name).append("_sum ").append(number).append("\n");
+  text.append(name).append("_count ").append(std::to_string(histogram.count)).append("\n");
+}
+
+// Renders the metrics, along with the statistics kept by the other components, in the Prometheus text format.
+void Metrics::write_prometheus(std::string &text) {
+  MetricsSnapshot metrics = Metrics::snapshot();
+  const uint64_t *counters = metrics.counters;
+  AdmissionStatistics admission = ctx.admission.statistics();
+  ResolverStatistics resolver = ctx.resolver.statistics();
+  BufferPoolStatistics buffers = BufferPool::statistics();
+  TopTalkersSnapshot talkers = ctx.top_talkers.snapshot();
+
+  write_metric(text, "proxy_accepted_connections_total", "counter", "Connections accepted from clients.");
+  write_sample(text, "proxy_accepted_connections_total", "", counters[ACCEPTED_CONNECTIONS]);
+  write_metric(text, "proxy_open_connections", "gauge", "Connections admitted and not yet closed.");
+  write_sample(text, "proxy_open_connections", "", admission.tunnels);
+  write_metric(text, "proxy_pending_handshakes", "gauge", "Connections waiting for their request header.");
+  write_sample(text, "proxy_pending_handshakes", "", admission.handshakes);
+  write_metric(text, "proxy_pending_lookups", "gauge", "Hostname lookups in progress.");
+  write_sample(text, "proxy_pending_lookups", "", admission.lookups);
+  write_metric(text, "proxy_tunnels_opened_total", "counter", "Tunnels that started relaying data.");
+  write_sample(text, "proxy_tunnels_opened_total", "", counters[OPENED_TUNNELS]);
+  write_metric(text, "proxy_active_tunnels", "gauge", "Tunnels relaying data.");
+  write_sample(text, "proxy_active_tunnels", "", counters[OPENED_TUNNELS] - counters[CLOSED_TUNNELS]);
+  write_metric(text, "proxy_relayed_bytes_total", "counter", "Bytes relayed through tunnels.");
+  write_sample(text, "proxy_relayed_bytes_total", "direction=\"upstream\"", counters[UPSTREAM_BYTES]);
+  write_sample(text, "proxy_relayed_bytes_total", "direction=\"downstream\"", counters[DOWNSTREAM_BYTES]);
+
+  write_metric(text, "proxy_error_responses_total", "counter", "Error responses sent to clients.");
+  write_sample(text, "proxy_error_responses_total", "status=\"400\"", counters[BAD_REQUEST_RESPONSES]);
+  write_sample(text, "proxy_error_responses_total", "status=\"403\"", counters[FORBIDDEN_RESPONSES]);
+  write_sample(text, "proxy_error_responses_total", "status=\"404\"", counters[NOT_FOUND_RESPONSES]);
+  write_sample(text, "proxy_error_responses_total", "status=\"405\"", counters[METHOD_NOT_ALLOWED_RESPONSES]);
+  write_sample(text, "proxy_error_responses_total", "status=\"502\"", counters[BAD_GATEWAY_RESPONSES]);
+  write_sample(text, "proxy_error_responses_total", "status=\"503\"", counters[SERVICE_UNAVAILABLE_RESPONSES]);
+  write_sample(text, "proxy_error_responses_total", "status=\"505\"", counters[VERSION_NOT_SUPPORTED_RESPONSES]);
+
+  write_metric(text, "proxy_shed_connections_total", "counter", "Connections and requests shed by admission control.");
+  write_sample(text, "proxy_shed_connections_total", "limit=\"tunnels\"", admission.shed_tunnels);
+  write_sample(text, "proxy_shed_connections_total", "limit=\"handshakes\"", admission.shed_handshakes);
+  write_sample(text, "proxy_shed_connections_total", "limit=\"lookups\"", admission.shed_lookups);
+  write_metric(text, "proxy_accept_pauses_total", "counter", "Times a shard stopped accepting connections.");
+  write_sample(text, "proxy_accept_pauses_total", "", admission.accept_pauses);
+  write_metric(text, "proxy_expired_tunnels_total", "counter", "Tunnels closed when one of their deadlines expired.");
+  write_sample(text, "proxy_expired_tunnels_total", "deadline=\"handshake\"", counters[HANDSHAKE_EXPIRIES]);
+  write_sample(text, "proxy_expired_tunnels_total", "deadline=\"idle\"", counters[IDLE_EXPIRIES]);
+  write_sample(text, "proxy_expired_tunnels_total", "deadline=\"lifetime\"", counters[LIFETIME_EXPIRIES]);
+  write_metric(text, "proxy_forwarded_requests_total", "counter", "Plain HTTP requests forwarded to servers.");
+  write_sample(text, "proxy_forwarded_requests_total", "", counters[FORWARDED_REQUESTS]);
+  write_metric(text, "proxy_upstream_pool_lookups_total", "counter",
+    "Idle server connections looked up for forwarded requests, by whether one was reused.");
+  write_sample(text, "proxy_upstream_pool_lookups_total", "result=\"hit\"", counters[UPSTREAM_POOL_HITS]);
+  write_sample(text, "proxy_upstream_pool_lookups_total", "result=\"miss\"", counters[UPSTREAM_POOL_MISSES]);
+  write_metric(text, "proxy_upstream_pool_evictions_total", "counter",
+    "Idle server connections closed before reuse, when idle too long, closed by the server or replaced.");
+  write_sample(text, "proxy_upstream_pool_evictions_total", "", counters[UPSTREAM_POOL_EVICTIONS]);
+  write_metric(text, "proxy_upstream_pool_idle_connections", "gauge", "Idle server connections kept for reuse.");
+  write_sample(text, "proxy_upstream_pool_idle_connections", "",
+    counters[UPSTREAM_POOL_RELEASES] - counters[UPSTREAM_POOL_HITS] - counters[UPSTREAM_POOL_EVICTIONS]);
+
+  write_histogram(text, "proxy_handshake_parse_seconds", "Time spent parsing and validating request headers.",
+    metrics.histograms[PARSE_TIME]);
+  write_histogram(text, "proxy_dns_lookup_seconds", "Time from requesting a hostname lookup to its answer.",
+    metrics.histograms[RESOLVE_TIME]);
+  write_histogram(text, "proxy_connect_seconds", "Time to establish successful connections to servers.",
+    metrics.histograms[CONNECT_TIME]);
+
+  write_metric(text, "proxy_top_destination_bytes", "gauge",
+    "Estimated bytes relayed for the destinations with the most traffic.");
+  write_estimates(text, "proxy_top_destination_bytes", "host", talkers.destination_bytes);
+  write_metric(text, "proxy_top_destination_tunnels", "gauge", "Estimated tunnels to the most requested destinations.");
+  write_estimates(text, "proxy_top_destination_tunnels", "host", talkers.destination_tunnels);
+  write_metric(text, "proxy_top_client_bytes", "gauge", "Estimated bytes relayed for the clients with the most traffic.");
+  write_estimates(text, "proxy_top_client_bytes", "client", talkers.client_bytes);
+  write_metric(text, "proxy_top_client_tunnels", "gauge", "Estimated tunnels opened by the most active clients.");
+  write_estimates(text, "proxy_top_client_tunnels", "client", talkers.client_tunnels);
+
+  write_metric(text, "proxy_resolver_lookups_total", "counter", "Hostname lookups by how they were answered.");
+  write_sample(text, "proxy_resolver_lookups_total", "result=\"hit\"", resolver.hits);
+  write_sample(text, "proxy_resolver_lookups_total", "result=\"negative_hit\"", resolver.negative_hits);
+  write_sample(text, "proxy_resolver_lookups_total", "result=\"miss\"", resolver.misses);
+  write_sample(text, "proxy_resolver_lookups_total", "result=\"coalesced\"", resolver.coalesced);
+  write_metric(text, "proxy_buffer_pool_outstanding_bytes", "gauge", "Bytes of relay buffers in use.");
+  write_sample(text, "proxy_buffer_pool_outstanding_bytes", "", buffers.outstanding_bytes);
+  write_metric(text, "proxy_buffer_pool_pooled_bytes", "gauge", "Bytes of relay buffers kept for reuse.");
+  write_sample(text, "proxy_buffer_pool_pooled_bytes", "", buffers.pooled_bytes);
+  write_metric(text, "proxy_dropped_log_records_total", "counter", "Log records dropped because the queue was full.");
+  write_sample(text, "proxy_dropped_log_records_total", "", ctx.logger.dropped_count());
+}
@@ -0,0 +1,57 @@
+#ifndef HTTPS_PROXY_METRICS_HPP_
+#define HTTPS_PROXY_METRICS_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Histogram buckets split every power of two into 2^HISTOGRAM_SUB_BUCKET_BITS
+// linear sub-buckets, which bounds the relative error of a recorded value to
+// about 3%, up to HISTOGRAM_MAX_EXPONENT. Larger values go to the last bucket.
+#define HISTOGRAM_SUB_BUCKET_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_EXPONENT 40
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+enum MetricCounter {
+  ACCEPTED_CONNECTIONS, OPENED_TUNNELS, CLOSED_TUNNELS, UPSTREAM_BYTES, DOWNSTREAM_BYTES,
+  BAD_REQUEST_RESPONSES, FORBIDDEN_RESPONSES, NOT_FOUND_RESPONSES, METHOD_NOT_ALLOWED_RESPONSES,
+  BAD_GATEWAY_RESPONSES, SERVICE_UNAVAILABLE_RESPONSES, VERSION_NOT_SUPPORTED_RESPONSES,
+  HANDSHAKE_EXPIRIES, IDLE_EXPIRIES, LIFETIME_EXPIRIES, FORWARDED_REQUESTS, UPSTREAM_POOL_HITS, UPSTREAM_POOL_MISSES,
+  UPSTREAM_POOL_RELEASES, UPSTREAM_POOL_EVICTIONS, METRIC_COUNTERS
+};
+
+// Durations, recorded in nanoseconds.
+enum MetricHistogram {PARSE_TIME, RESOLVE_TIME, CONNECT_TIME, METRIC_HISTOGRAMS};
+
+struct HistogramSnapshot {
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+
+  uint64_t count_below(uint64_t) const;
+  uint64_t percentile(double) const;
+};
+
+struct MetricsSnapshot {
+  uint64_t counters[METRIC_COUNTERS];
+  HistogramSnapshot histograms[METRIC_HISTOGRAMS];
+};
+
+// Counters and histograms kept per thread, so recording a value is a plain
+// store to memory only the calling thread writes. The values of all threads are
+// only summed when a snapshot is taken.
+class Metrics {
+  public:
+    static void increment(MetricCounter, uint64_t = 1);
+    static void record(MetricHistogram, std::chrono::steady_clock::duration);
+    static void record_response(int);
+    static MetricsSnapshot snapshot();
+    static void write_prometheus(std::string&);
+
+    static size_t bucket_index(uint64_t);
+    static uint64_t bucket_limit(size_t);
+};
+
+#endif  // HTTPS_PROXY_METRICS_HPP_
@@ -0,0 +1,93 @@
+#include "metrics_server.hpp"
+
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+
+#include "context.hpp"
+#include "metrics.hpp"
+
+#define END_OF_MESSAGE "\r\n\r\n"
+
+static const char *const HTTP_METRICS = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+  "Connection: close\r\nContent-Length: ";
+static const char *const HTTP_NOT_FOUND = "HTTP/1.1 404 Not Found\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+
+MetricsServer::MetricsServer(boost::asio::io_context &io, int port) : io(io), acceptor(io) {
+  boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+  this->acceptor.open(endpoint.protocol());
+  this->acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  this->acceptor.bind(endpoint);
+  this->acceptor.listen();
+}
+
+// Throws boost::system::system_error if the port cannot be bound.
+std::shared_ptr<MetricsServer> MetricsServer::create(boost::asio::io_context &io, int port) {
+  return std::shared_ptr<MetricsServer>(new MetricsServer(io, port));
+}
+
+void MetricsServer::start() {
+  this->start_accept();
+}
+
+void MetricsServer::stop() {
+  boost::system::error_code error;
+  this->acceptor.close(error);
+}
+
+uint16_t MetricsServer::port() {
+  return this->acceptor.local_endpoint().port();
+}
+
+void MetricsServer::start_accept() {
+  this->acceptor.async_accept(this->io, std::bind(&MetricsServer::handle_accept, shared_from_this(),
+    std::placeholders::_1, std::placeholders::_2));
+}
+
+void MetricsServer::handle_accept(const boost::system::error_code &error, boost::asio::ip::tcp::socket peer_socket) {
+  if (error == boost::asio::error::operation_aborted) {
+    return;
+  }
+  if (error) {
+    LOG_ERROR(ctx.logger, "MetricsServer::handle_accept", error);
+  } else {
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket = std::make_shared<boost::asio::ip::tcp::socket>(std::move(peer_socket));
+    std::shared_ptr<std::string> request = std::make_shared<std::string>();
+    boost::asio::async_read_until(*socket, boost::asio::dynamic_buffer(*request, METRICS_MAX_REQUEST_SIZE),
+      END_OF_MESSAGE,
+      boost::bind(&MetricsServer::handle_request, shared_from_this(), socket, request,
+        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+  }
+  this->start_accept();
+}
+
+void MetricsServer::handle_request(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+  std::shared_ptr<std::string> request, const boost::system::error_code &error, size_t) {
+  if (error) {
+    LOG_DEBUG(ctx.logger, "MetricsServer::handle_request", error);
+    return;
+  }
+  std::shared_ptr<std::string> response = std::make_shared<std::string>();
+  if (request->compare(0, sizeof("GET " METRICS_PATH " ") - 1, "GET " METRICS_PATH " ") == 0) {
+    std::string body;
+    Metrics::write_prometheus(body);
+    response->append(HTTP_METRICS).append(std::to_string(body.size())).append(END_OF_MESSAGE).append(body);
+  } else {
+    response->append(HTTP_NOT_FOUND);
+  }
+  boost::asio::async_write(*socket, boost::asio::buffer(*response),
+    boost::bind(&MetricsServer::handle_response, shared_from_this(), socket, response,
+      boost::asio::placeholders::error));
+}
+
+void MetricsServer::handle_response(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+  std::shared_ptr<std::string>, const boost::system::error_code &error) {
+  if (error) {
+    LOG_DEBUG(ctx.logger, "MetricsServer::handle_response", error);
+  }
+  boost::system::error_code close_error;
+  socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, close_error);
+  socket->close(close_error);
+}
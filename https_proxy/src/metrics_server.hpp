@@ -0,0 +1,35 @@
+#ifndef HTTPS_PROXY_METRICS_SERVER_HPP_
+#define HTTPS_PROXY_METRICS_SERVER_HPP_
+
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#define METRICS_PATH "/metrics"
+#define METRICS_MAX_REQUEST_SIZE 8192
+
+// Serves the metrics in the Prometheus text format on a port of the loopback
+// interface. Requests are served on the IO context the server is created
+// with, and each connection is closed after its response.
+class MetricsServer : public std::enable_shared_from_this<MetricsServer> {
+  public:
+    static std::shared_ptr<MetricsServer> create(boost::asio::io_context&, int);
+    void start();
+    void stop();
+    uint16_t port();
+
+  private:
+    MetricsServer(boost::asio::io_context&, int);
+    boost::asio::io_context &io;
+    boost::asio::ip::tcp::acceptor acceptor;
+
+    void start_accept();
+    void handle_accept(const boost::system::error_code&, boost::asio::ip::tcp::socket);
+    void handle_request(std::shared_ptr<boost::asio::ip::tcp::socket>, std::shared_ptr<std::string>,
+      const boost::system::error_code&, size_t);
+    void handle_response(std::shared_ptr<boost::asio::ip::tcp::socket>, std::shared_ptr<std::string>,
+      const boost::system::error_code&);
+};
+
+#endif  // HTTPS_PROXY_METRICS_SERVER_HPP_
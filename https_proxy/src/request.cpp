@@ -0,0 +1,241 @@
+#include "request.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <string_view>
+
+#define HTTP_PREFIX "HTTP/"
+#define HTTP_PREFIX_LENGTH 5
+#define CONNECT_TARGET_OFFSET 8
+
+// Characters matched by \s, which may not appear in the request line fields.
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Returns the offset of the CRLF ending the line that starts at the given offset, or npos if the next carriage return
+// is not followed by a line feed or there is none.
+static size_t find_line_end(std::string_view text, size_t start) {
+  const void *found = memchr(text.data() + start, '\r', text.size() - start);
+  if (found == nullptr) {
+    return std::string_view::npos;
+  }
+  size_t end = static_cast<const char*>(found) - text.data();
+  if (end + 1 >= text.size() || text[end + 1] != '\n') {
+    return std::string_view::npos;
+  }
+  return end;
+}
+
+RequestStatus Request::parse(std::string_view text) {
+  this->text = text;
+  this->hostname_field = std::string_view();
+  this->port_field = std::string_view();
+  this->authority_field = std::string_view();
+  this->path_field = std::string_view();
+  this->head_split = false;
+  size_t end = find_line_end(text, 0);
+  if (end == std::string_view::npos || this->parse_request_line(text.substr(0, end)) != VALID_REQUEST) {
+    return MALFORMED_REQUEST;
+  }
+  size_t headers_start = end + 2;
+  size_t start = headers_start;
+  for (;;) {
+    end = find_line_end(text, start);
+    if (end == std::string_view::npos) {
+      return MALFORMED_REQUEST;
+    }
+    if (end == start) {
+      break;
+    }
+    if (!this->parse_header_line(text.substr(start, end - start))) {
+      return MALFORMED_REQUEST;
+    }
+    start = end + 2;
+  }
+  if (end + 2 != text.size()) {
+    return MALFORMED_REQUEST;
+  }
+  this->header_lines = text.substr(headers_start, start - headers_start);
+  if (text.substr(0, strlen(CONNECT_METHOD)) != CONNECT_METHOD) {
+    return this->split_absolute_target();
+  }
+  if (this->method_field != CONNECT_METHOD || !this->split_target()) {
+    return MALFORMED_REQUEST_LINE;
+  }
+  return VALID_REQUEST;
+}
+
+std::string_view Request::method() const {
+  return this->method_field;
+}
+
+std::string_view Request::hostname() const {
+  return this->hostname_field;
+}
+
+std::string_view Request::port() const {
+  return this->port_field;
+}
+
+std::string_view Request::version() const {
+  return this->version_field;
+}
+
+std::string_view Request::authority() const {
+  return this->authority_field;
+}
+
+// The target of a forwarded request after its authority, which is empty or starts with '?' if the target has no path.
+std::string_view Request::path() const {
+  return this->path_field;
+}
+
+// The header lines of an accepted request are all "Name:Value" lines, so splitting them cannot fail.
+const HttpHead &Request::head() {
+  if (!this->head_split) {
+    this->head_fields.parse(this->text);
+    this->head_split = true;
+  }
+  return this->head_fields;
+}
+
+// Converts the port the way atoi does, so that malformed ports keep being interpreted as before.
+int Request::parse_port(std::string_view port) {
+  size_t i = 0;
+  while (i < port.size() && is_space(port[i])) {
+    i++;
+  }
+  bool negative = false;
+  if (i < port.size() && (port[i] == '+' || port[i] == '-')) {
+    negative = port[i] == '-';
+    i++;
+  }
+  unsigned long limit = negative ? (unsigned long) LONG_MAX + 1 : LONG_MAX;
+  unsigned long value = 0;
+  for (; i < port.size() && port[i] >= '0' && port[i] <= '9'; i++) {
+    unsigned long digit = port[i] - '0';
+    value = value > (limit - digit) / 10 ? limit : value * 10 + digit;
+  }
+  long result = negative ? (long) (0 - value) : (long) value;
+  return (int) result;
+}
+
+// Checks "METHOD TARGET HTTP/VERSION", where the method is made of capital letters and the target and version contain
+// no whitespace.
+RequestStatus Request::parse_request_line(std::string_view line) {
+  size_t method_end = 0;
+  while (method_end < line.size() && line[method_end] >= 'A' && line[method_end] <= 'Z') {
+    method_end++;
+  }
+  if (method_end == 0 || method_end >= line.size() || line[method_end] != ' ') {
+    return MALFORMED_REQUEST;
+  }
+  size_t target_end = method_end + 1;
+  while (target_end < line.size() && !is_space(line[target_end])) {
+    target_end++;
+  }
+  if (target_end == method_end + 1 || target_end >= line.size() || line[target_end] != ' ') {
+    return MALFORMED_REQUEST;
+  }
+  std::string_view protocol = line.substr(target_end + 1);
+  if (protocol.size() <= HTTP_PREFIX_LENGTH || protocol.substr(0, HTTP_PREFIX_LENGTH) != HTTP_PREFIX) {
+    return MALFORMED_REQUEST;
+  }
+  for (char c : protocol) {
+    if (is_space(c)) {
+      return MALFORMED_REQUEST;
+    }
+  }
+  this->method_field = line.substr(0, method_end);
+  this->target_field = line.substr(method_end + 1, target_end - method_end - 1);
+  this->version_field = protocol.substr(HTTP_PREFIX_LENGTH);
+  return VALID_REQUEST;
+}
+
+// Checks "Name:Value", where the name contains no whitespace and the value may contain spaces but no other whitespace.
+bool Request::parse_header_line(std::string_view line) {
+  size_t colon = std::string_view::npos;
+  bool name_ended = false;
+  for (size_t i = 0; i < line.size(); i++) {
+    char c = line[i];
+    if (c == ' ') {
+      name_ended = true;
+    } else if (is_space(c)) {
+      return false;
+    } else if (c == ':' && i > 0 && !name_ended && colon == std::string_view::npos) {
+      colon = i;
+    }
+  }
+  return colon != std::string_view::npos && colon + 2 <= line.size();
+}
+
+// Splits the CONNECT target into the hostname and port. Returns false if the target has an empty hostname or port.
+bool Request::split_target() {
+  size_t colon = this->target_field.find(':');
+  if (colon != std::string_view::npos) {
+    if (colon == 0 || colon + 1 == this->target_field.size()) {
+      return false;
+    }
+    this->hostname_field = this->target_field.substr(0, colon);
+    this->port_field = this->target_field.substr(colon + 1);
+    return true;
+  }
+  this->hostname_field = this->target_field;
+  if (this->version_field.find(':') != std::string_view::npos || this->header_lines.empty()) {
+    return true;
+  }
+  std::string_view line = this->header_lines.substr(0, this->header_lines.find("\r\n"));
+  size_t name_end = line.find(':');
+  std::string_view value = line.substr(name_end + 1);
+  size_t space = value.find(' ');
+  if (space == 0 || space == std::string_view::npos) {
+    return true;
+  }
+  std::string_view protocol = value.substr(space + 1);
+  if (protocol.size() <= HTTP_PREFIX_LENGTH || protocol.substr(0, HTTP_PREFIX_LENGTH) != HTTP_PREFIX ||
+    protocol.find(' ') != std::string_view::npos) {
+    return true;
+  }
+  size_t line_start = this->header_lines.data() - this->text.data();
+  this->hostname_field = this->text.substr(CONNECT_TARGET_OFFSET, line_start + name_end - CONNECT_TARGET_OFFSET);
+  this->port_field = value.substr(0, space);
+  this->version_field = protocol.substr(HTTP_PREFIX_LENGTH);
+  return true;
+}
+
+// Splits an absolute "http://" target into the authority, hostname, port and path. Any other target is not a request
+// the proxy forwards.
+RequestStatus Request::split_absolute_target() {
+  size_t scheme_length = strlen(HTTP_SCHEME);
+  if (this->target_field.size() < scheme_length
+    || !equals_ignore_case(this->target_field.substr(0, scheme_length), HTTP_SCHEME)) {
+    return UNSUPPORTED_METHOD;
+  }
+  std::string_view rest = this->target_field.substr(scheme_length);
+  size_t authority_end = std::min(rest.find('/'), rest.find('?'));
+  std::string_view authority = rest.substr(0, authority_end);
+  std::string_view hostname = authority;
+  std::string_view port;
+  if (!authority.empty() && authority.front() == '[') {
+    size_t bracket = authority.find(']');
+    if (bracket == std::string_view::npos || (bracket + 1 < authority.size() && authority[bracket + 1] != ':')) {
+      return MALFORMED_REQUEST_LINE;
+    }
+    hostname = authority.substr(1, bracket - 1);
+    port = authority.substr(std::min(bracket + 2, authority.size()));
+  } else if (size_t colon = authority.find(':'); colon != std::string_view::npos) {
+    hostname = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  }
+  if (hostname.empty() || hostname.find_first_of("@[]") != std::string_view::npos
+    || port.find_first_not_of("0123456789") != std::string_view::npos) {
+    return MALFORMED_REQUEST_LINE;
+  }
+  this->authority_field = authority;
+  this->hostname_field = hostname;
+  this->port_field = port;
+  this->path_field = rest.substr(authority.size());
+  return FORWARD_REQUEST;
+}
@@ -0,0 +1,63 @@
+#ifndef HTTPS_PROXY_REQUEST_HPP_
+#define HTTPS_PROXY_REQUEST_HPP_
+
+#include <string_view>
+
+#include "http_message.hpp"
+
+#define CONNECT_METHOD "CONNECT"
+#define HTTP_SCHEME "http://"
+
+enum RequestStatus {
+  VALID_REQUEST = 0, MALFORMED_REQUEST = 1, UNSUPPORTED_METHOD = 2, MALFORMED_REQUEST_LINE = 3, FORWARD_REQUEST = 4
+};
+
+// Request header parsed in a single pass over the bytes read from the client.
+// The parsed fields are views into the parsed text, which must outlive the
+// request. Header lines are only split into an HttpHead the first time the head
+// is asked for.
+//
+// A header is accepted if it is a request line "METHOD TARGET HTTP/VERSION"
+// followed by "Name:Value" lines and an empty line. The target of a CONNECT
+// request is split into the hostname and the port after its first colon. If the
+// target has no port, a first header line of the form "Name:PORT HTTP/VERSION"
+// supplies the port and version, and the hostname extends up to that line's
+// colon, which is how the request line was matched historically.
+//
+// Any other method is only accepted with an absolute "http://" target, as a
+// request to forward. Its authority is split into the hostname, without the
+// brackets of an IPv6 address, and the port, which may be empty, and the rest
+// of the target is the path to request from the server.
+class Request {
+  public:
+    RequestStatus parse(std::string_view);
+    std::string_view method() const;
+    std::string_view hostname() const;
+    std::string_view port() const;
+    std::string_view version() const;
+    std::string_view authority() const;
+    std::string_view path() const;
+    const HttpHead &head();
+
+    static int parse_port(std::string_view);
+
+  private:
+    std::string_view text;
+    std::string_view method_field;
+    std::string_view target_field;
+    std::string_view hostname_field;
+    std::string_view port_field;
+    std::string_view version_field;
+    std::string_view authority_field;
+    std::string_view path_field;
+    std::string_view header_lines;
+    HttpHead head_fields;
+    bool head_split = false;
+
+    RequestStatus parse_request_line(std::string_view);
+    bool parse_header_line(std::string_view);
+    bool split_target();
+    RequestStatus split_absolute_target();
+};
+
+#endif  // HTTPS_PROXY_REQUEST_HPP_
@@ -0,0 +1,180 @@
+#include "resolver.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+Resolver::Resolver()
+  : positive_ttl(DEFAULT_POSITIVE_TTL), negative_ttl(DEFAULT_NEGATIVE_TTL),
+    hits(0), negative_hits(0), misses(0), coalesced(0), refreshes(0), failures(0) {
+}
+
+Resolver::~Resolver() {
+  this->stop();
+}
+
+void Resolver::start() {
+  if (this->work) {
+    return;
+  }
+  this->lookup_ctx.restart();
+  this->work = std::make_unique<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>(
+    this->lookup_ctx.get_executor());
+  for (int i = 0; i < RESOLVER_THREAD_COUNT; i++) {
+    this->threads.create_thread(boost::bind(&boost::asio::io_context::run, &(this->lookup_ctx)));
+  }
+}
+
+void Resolver::stop() {
+  if (!this->work) {
+    return;
+  }
+  this->work.reset();
+  this->lookup_ctx.stop();
+  this->threads.join_all();
+}
+
+void Resolver::set_ttl(int positive_ttl, int negative_ttl) {
+  this->positive_ttl = std::chrono::seconds(positive_ttl);
+  this->negative_ttl = std::chrono::seconds(negative_ttl);
+}
+
+void Resolver::resolve(const std::string &hostname, ResolveHandler handler) {
+  std::unique_lock<std::mutex> guard(this->lock);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::unordered_map<std::string, Entry>::iterator found = this->cache.find(hostname);
+  if (found != this->cache.end() && found->second.expiry > now) {
+    Entry &entry = found->second;
+    entry.hits++;
+    this->recency.splice(this->recency.begin(), this->recency, entry.position);
+    bool refresh = !entry.error && !entry.refreshing && entry.hits >= REFRESH_MIN_HITS &&
+      (entry.expiry - now) * 100 < (entry.expiry - entry.created) * REFRESH_WINDOW_PERCENT;
+    if (refresh) {
+      entry.refreshing = true;
+      // Lookups arriving after the entry expires wait for the refresh instead of starting another query.
+      this->pending.emplace(hostname, std::vector<ResolveHandler>());
+    }
+    boost::system::error_code error = entry.error;
+    std::shared_ptr<const AddressList> addresses = entry.addresses;
+    guard.unlock();
+    if (error) {
+      this->negative_hits++;
+    } else {
+      this->hits++;
+    }
+    if (refresh) {
+      this->refreshes++;
+      this->start_lookup(hostname);
+    }
+    handler(error, addresses);
+    return;
+  }
+  std::unordered_map<std::string, std::vector<ResolveHandler>>::iterator waiting = this->pending.find(hostname);
+  if (waiting != this->pending.end()) {
+    waiting->second.push_back(std::move(handler));
+    this->coalesced++;
+    return;
+  }
+  this->misses++;
+  this->pending[hostname].push_back(std::move(handler));
+  guard.unlock();
+  this->start_lookup(hostname);
+}
+
+ResolverStatistics Resolver::statistics() {
+  return ResolverStatistics {
+    .hits = this->hits,
+    .negative_hits = this->negative_hits,
+    .misses = this->misses,
+    .coalesced = this->coalesced,
+    .refreshes = this->refreshes,
+    .failures = this->failures
+  };
+}
+
+boost::system::error_code Resolver::lookup(const std::string &hostname, AddressList &addresses) {
+  boost::asio::ip::tcp::resolver resolver(this->lookup_ctx);
+  boost::system::error_code error;
+  boost::asio::ip::tcp::resolver::results_type results = resolver.resolve(hostname, "0", error);
+  if (error) {
+    return error;
+  }
+  for (const boost::asio::ip::tcp::resolver::results_type::value_type &result : results) {
+    boost::asio::ip::address address = result.endpoint().address();
+    if (std::find(addresses.begin(), addresses.end(), address) == addresses.end()) {
+      addresses.push_back(address);
+    }
+  }
+  return error;
+}
+
+void Resolver::start_lookup(const std::string &hostname) {
+  boost::asio::post(this->lookup_ctx, std::bind(&Resolver::handle_lookup, this, hostname));
+}
+
+void Resolver::handle_lookup(const std::string &hostname) {
+  std::unique_ptr<AddressList> addresses = std::make_unique<AddressList>();
+  boost::system::error_code error = this->lookup(hostname, *addresses);
+  if (!error && addresses->empty()) {
+    error = boost::asio::error::host_not_found;
+  }
+  if (error) {
+    this->failures++;
+  }
+  std::shared_ptr<const AddressList> result = std::move(addresses);
+  this->store(hostname, error, result);
+  std::vector<ResolveHandler> handlers;
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+    std::unordered_map<std::string, std::vector<ResolveHandler>>::iterator waiting = this->pending.find(hostname);
+    if (waiting != this->pending.end()) {
+      handlers = std::move(waiting->second);
+      this->pending.erase(waiting);
+    }
+  }
+  for (ResolveHandler &handler : handlers) {
+    handler(error, result);
+  }
+  // Drops what the handlers captured before returning, so that the lookup keeps nothing alive once it has answered.
+  handlers.clear();
+}
+
+void Resolver::store(
+  const std::string &hostname,
+  const boost::system::error_code &error,
+  std::shared_ptr<const AddressList> addresses
+) {
+  std::lock_guard<std::mutex> guard(this->lock);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::unordered_map<std::string, Entry>::iterator found = this->cache.find(hostname);
+  if (found == this->cache.end()) {
+    if (this->cache.size() >= RESOLVER_CACHE_CAPACITY) {
+      this->cache.erase(this->recency.back());
+      this->recency.pop_back();
+    }
+    found = this->cache.emplace(hostname, Entry()).first;
+    this->recency.push_front(hostname);
+    found->second.position = this->recency.begin();
+  } else {
+    this->recency.splice(this->recency.begin(), this->recency, found->second.position);
+  }
+  Entry &entry = found->second;
+  if (error && !entry.error && entry.refreshing && entry.expiry > now) {
+    // Keep serving the previous answer until it expires if a refresh fails.
+    entry.refreshing = false;
+    return;
+  }
+  entry.error = error;
+  entry.addresses = addresses;
+  entry.created = now;
+  entry.expiry = now + (error ? this->negative_ttl : this->positive_ttl);
+  entry.refreshing = false;
+}
@@ -0,0 +1,93 @@
+#ifndef HTTPS_PROXY_RESOLVER_HPP_
+#define HTTPS_PROXY_RESOLVER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#define RESOLVER_THREAD_COUNT 4
+#define RESOLVER_CACHE_CAPACITY 65536
+#define DEFAULT_POSITIVE_TTL 60
+#define DEFAULT_NEGATIVE_TTL 5
+// Entries looked up at least this many times are refreshed in the background
+// once less than REFRESH_WINDOW_PERCENT of their TTL remains.
+#define REFRESH_MIN_HITS 2
+#define REFRESH_WINDOW_PERCENT 20
+
+typedef std::vector<boost::asio::ip::address> AddressList;
+typedef std::function<void(const boost::system::error_code&, std::shared_ptr<const AddressList>)> ResolveHandler;
+
+struct ResolverStatistics {
+  uint64_t hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+  uint64_t coalesced;
+  uint64_t refreshes;
+  uint64_t failures;
+};
+
+// Hostname resolver which performs lookups on its own threads and caches both
+// successful and failed answers. Concurrent lookups for the same hostname are
+// coalesced into a single query, and popular entries are refreshed before they
+// expire. Handlers are invoked on a resolver thread, or on the calling thread
+// when the answer is cached. Once the cache is full, each new hostname evicts
+// the least recently used entry.
+class Resolver {
+  public:
+    Resolver();
+    virtual ~Resolver();
+    void start();
+    void stop();
+    void set_ttl(int, int);
+    void resolve(const std::string&, ResolveHandler);
+    ResolverStatistics statistics();
+
+  protected:
+    // Performs a blocking lookup. Overridden to substitute a stub resolver.
+    virtual boost::system::error_code lookup(const std::string&, AddressList&);
+
+  private:
+    struct Entry {
+      boost::system::error_code error;
+      std::shared_ptr<const AddressList> addresses;
+      std::chrono::steady_clock::time_point created;
+      std::chrono::steady_clock::time_point expiry;
+      uint64_t hits;
+      bool refreshing;
+      // Position of the hostname in recency, most recently used first.
+      std::list<std::string>::iterator position;
+    };
+
+    boost::asio::io_context lookup_ctx;
+    std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work;
+    boost::thread_group threads;
+    std::chrono::seconds positive_ttl;
+    std::chrono::seconds negative_ttl;
+
+    std::mutex lock;
+    std::unordered_map<std::string, Entry> cache;
+    std::list<std::string> recency;
+    std::unordered_map<std::string, std::vector<ResolveHandler>> pending;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> negative_hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> coalesced;
+    std::atomic<uint64_t> refreshes;
+    std::atomic<uint64_t> failures;
+
+    void start_lookup(const std::string&);
+    void handle_lookup(const std::string&);
+    void store(const std::string&, const boost::system::error_code&, std::shared_ptr<const AddressList>);
+};
+
+#endif  // HTTPS_PROXY_RESOLVER_HPP_
@@ -2,42 +2,62 @@
 
 #include <csignal>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "buffer_pool.hpp"
 #include "connection.hpp"
 #include "context.hpp"
+#include "metrics.hpp"
+#include "metrics_server.hpp"
+#include "shard.hpp"
 
 #define ALL_INTERFACES {0, 0, 0, 0}
-#define THREAD_COUNT 8
-#define END_OF_MESSAGE "\r\n\r\n"
 
 void interrupt_handler(int) {
-  ctx.logger.write_info("Shutting down.");
-  ctx.ctx.stop();
-  ctx.accept_ctx.stop();
+  LOG_INFO(ctx.logger, "", "Shutting down.");
+  ctx.control_ctx.stop();
 }
 
 Server::Server(int port) : thread_group(std::make_unique<boost::thread_group>()) {
   uint16_t listen_port = boost::lexical_cast<uint16_t>(port);
   boost::asio::ip::address_v4 local_address = boost::asio::ip::address_v4(ALL_INTERFACES);
-  boost::asio::ip::tcp::endpoint listen_endpoint = boost::asio::ip::tcp::endpoint(local_address, listen_port);
-  this->listen_socket = std::make_shared<boost::asio::ip::tcp::acceptor>(ctx.accept_ctx, listen_endpoint.protocol());
-  try {
-    this->listen_socket->bind(listen_endpoint);
-  } catch (boost::system::system_error &e) {
-    ctx.logger.write_fatal(e.what(), "Server::Server");
-    std::cout << "Unable to bind socket to specified port | " << e.what() << std::endl;
-    exit(3);
+  for (size_t i = 0; i < ctx.shard_count; i++) {
+    std::unique_ptr<Shard> shard = std::make_unique<Shard>(i);
+    boost::asio::ip::tcp::endpoint listen_endpoint = boost::asio::ip::tcp::endpoint(local_address, listen_port);
+    try {
+      shard->acceptor.open(listen_endpoint.protocol());
+#ifdef SO_REUSEPORT
+      if (ctx.shard_count > 1) {
+        shard->acceptor.set_option(ReusePort(true));
+      }
+#endif
+      boost::system::error_code tuning_error = ctx.socket_tuning.apply(shard->acceptor.native_handle(), LISTENER_SOCKET);
+      if (tuning_error) {
+        LOG_WARN(ctx.logger, "Server::Server", "Unable to tune listening socket | ", tuning_error);
+      }
+      shard->acceptor.bind(listen_endpoint);
+    } catch (boost::system::system_error &e) {
+      LOG_FATAL(ctx.logger, "Server::Server", e.what());
+      std::cout << "Unable to bind socket to specified port | " << e.what() << std::endl;
+      exit(3);
+    }
+    // Binds the remaining shards to the port picked for the first one when the port is 0.
+    listen_port = shard->acceptor.local_endpoint().port();
+    this->shards.push_back(std::move(shard));
   }
-  ctx.logger.write_info("Server created.");
+  LOG_INFO(ctx.logger, "", "Server created.");
 }
 
 Server::~Server() {
-  this->listen_socket->close();
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    boost::system::error_code error;
+    shard->acceptor.close(error);
+  }
 }
 
 std::shared_ptr<Server> Server::create(int port) {
@@ -45,62 +65,147 @@ std::shared_ptr<Server> Server::create(int port) {
 }
 
 void Server::listen() {
-  ctx.accept_ctx.reset();
-  ctx.ctx.reset();
+  ctx.control_ctx.restart();
   try {
-    this->listen_socket->listen();
+    for (std::unique_ptr<Shard> &shard : this->shards) {
+      shard->io.restart();
+      shard->acceptor.listen(ctx.listen_backlog);
+    }
   } catch (boost::system::system_error &e) {
-    ctx.logger.write_fatal(e.what(), "Server::listen");
+    LOG_FATAL(ctx.logger, "Server::listen", e.what());
     std::cout << "Unable to listen for connections | " << e.what() << std::endl;
     exit(4);
   }
-  ctx.logger.write_info("Listening on port " + std::to_string(this->listen_socket->local_endpoint().port()));
-  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(ctx.ctx.get_executor());
-  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> accept_work(ctx.accept_ctx.get_executor());
-  for (int i = 0; i < THREAD_COUNT; i++) {
-    this->thread_group->create_thread(boost::bind(&boost::asio::io_context::run, &(ctx.ctx)));
-    ctx.logger.write_debug("Starting thread: " + std::to_string(i));
+  LOG_INFO(ctx.logger, "", "Listening on port ", this->shards[0]->acceptor.local_endpoint().port(), " with ",
+    this->shards.size(), " shard(s)");
+  LOG_INFO(ctx.logger, "", "Socket profile ", SocketTuning::describe(ctx.socket_tuning.profile()));
+  LOG_INFO(ctx.logger, "", "Listening socket options: ",
+    SocketTuning::describe(this->shards[0]->acceptor.native_handle(), LISTENER_SOCKET));
+  if (ctx.metrics_port > 0) {
+    try {
+      this->metrics_server = MetricsServer::create(ctx.control_ctx, ctx.metrics_port);
+    } catch (boost::system::system_error &e) {
+      LOG_FATAL(ctx.logger, "Server::listen", e.what());
+      std::cout << "Unable to serve metrics on specified port | " << e.what() << std::endl;
+      exit(4);
+    }
+    this->metrics_server->start();
+    LOG_INFO(ctx.logger, "", "Serving metrics on port ", this->metrics_server->port());
+  }
+  ctx.resolver.start();
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> control_work(ctx.control_ctx.get_executor());
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    this->start_accept(*shard);
+    this->thread_group->create_thread(boost::bind(&Shard::run, shard.get(), ctx.pin_shards));
+    LOG_DEBUG(ctx.logger, "", "Starting shard: ", shard->index);
   }
-  this->listen_socket->async_accept(ctx.ctx, std::bind(&Server::handle_accept, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
   std::signal(SIGINT, interrupt_handler);
-  ctx.accept_ctx.run();
+  ctx.control_ctx.run();
+  if (this->metrics_server) {
+    this->metrics_server->stop();
+  }
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    shard->io.stop();
+  }
   this->thread_group->join_all();
+  // Tunnels still open once the shards have stopped never finish, so the journals hold every tunnel they will get.
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    shard->journal.reset();
+  }
+  ctx.resolver.stop();
+  ResolverStatistics resolver_statistics = ctx.resolver.statistics();
+  LOG_INFO(ctx.logger, "", "Resolver cache hits: ", resolver_statistics.hits,
+    ", negative hits: ", resolver_statistics.negative_hits,
+    ", misses: ", resolver_statistics.misses,
+    ", coalesced: ", resolver_statistics.coalesced,
+    ", refreshes: ", resolver_statistics.refreshes,
+    ", failures: ", resolver_statistics.failures);
+  BufferPoolStatistics buffer_statistics = BufferPool::statistics();
+  LOG_INFO(ctx.logger, "", "Buffer pool hits: ", buffer_statistics.hits,
+    ", misses: ", buffer_statistics.misses,
+    ", discards: ", buffer_statistics.discards,
+    ", pooled: ", buffer_statistics.pooled_buffers, " buffers (", buffer_statistics.pooled_bytes, " bytes)",
+    ", outstanding: ", buffer_statistics.outstanding_bytes, " bytes");
+  AdmissionStatistics admission_statistics = ctx.admission.statistics();
+  LOG_INFO(ctx.logger, "", "Admission shed tunnels: ", admission_statistics.shed_tunnels,
+    ", handshakes: ", admission_statistics.shed_handshakes,
+    ", lookups: ", admission_statistics.shed_lookups,
+    ", accept pauses: ", admission_statistics.accept_pauses);
+  MetricsSnapshot metrics = Metrics::snapshot();
+  LOG_INFO(ctx.logger, "", "Expired tunnels in handshake: ", metrics.counters[HANDSHAKE_EXPIRIES],
+    ", idle: ", metrics.counters[IDLE_EXPIRIES],
+    ", past lifetime: ", metrics.counters[LIFETIME_EXPIRIES]);
+  uint64_t pool_lookups = metrics.counters[UPSTREAM_POOL_HITS] + metrics.counters[UPSTREAM_POOL_MISSES];
+  LOG_INFO(ctx.logger, "", "Forwarded requests: ", metrics.counters[FORWARDED_REQUESTS],
+    ", upstream pool hits: ", metrics.counters[UPSTREAM_POOL_HITS],
+    ", misses: ", metrics.counters[UPSTREAM_POOL_MISSES],
+    ", hit rate: ", pool_lookups > 0 ? 100.0 * metrics.counters[UPSTREAM_POOL_HITS] / pool_lookups : 0.0, "%",
+    ", evictions: ", metrics.counters[UPSTREAM_POOL_EVICTIONS]);
+}
+
+// With the pause policy, a shard stops accepting while any admission limit is reached and leaves new connections
+// waiting in the listen backlog.
+void Server::start_accept(Shard &shard) {
+  if (ctx.admission.policy() == PAUSE_ACCEPTING && ctx.admission.is_saturated()) {
+    if (shard.accepting) {
+      shard.accepting = false;
+      ctx.admission.record_pause();
+      LOG_DEBUG(ctx.logger, "", "Paused accepting on shard ", shard.index, ".");
+    }
+    shard.accept_timer.expires_after(ACCEPT_RETRY_INTERVAL);
+    shard.accept_timer.async_wait(std::bind(&Server::resume_accept, shared_from_this(), &shard,
+      std::placeholders::_1));
+    return;
+  }
+  if (!shard.accepting) {
+    shard.accepting = true;
+    LOG_DEBUG(ctx.logger, "", "Resumed accepting on shard ", shard.index, ".");
+  }
+  shard.acceptor.async_accept(shard.io, std::bind(&Server::handle_accept, shared_from_this(), &shard,
+    std::placeholders::_1, std::placeholders::_2));
+}
+
+void Server::resume_accept(Shard *shard, const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+  this->start_accept(*shard);
 }
 
-void Server::handle_accept(const boost::system::error_code &error, boost::asio::ip::tcp::socket peer_socket) {
+// Runs on the shard that accepted the connection, which then serves the connection for its whole lifetime. The
+// connection takes over the tunnel and handshake slots, and is turned away with a 503 if either limit is reached.
+void Server::handle_accept(Shard *shard, const boost::system::error_code &error,
+  boost::asio::ip::tcp::socket peer_socket) {
   if (!error) {
-    std::shared_ptr<boost::asio::ip::tcp::socket> client_socket = std::make_shared<boost::asio::ip::tcp::socket>(std::move(peer_socket));
-    std::string client_address = client_socket->remote_endpoint().address().to_string();
-    uint16_t client_port = client_socket->remote_endpoint().port();
-    ctx.logger.write_debug("Accepted connection from " + client_address + ":" + std::to_string(client_port) + ".");
-    boost::asio::streambuf *stream_buffer = new boost::asio::streambuf();
-    int bytes_transferred = 0;
-    try {
-      bytes_transferred = boost::asio::read_until(*client_socket, *stream_buffer, END_OF_MESSAGE);
-      std::string message = std::string(
-        boost::asio::buffers_begin(stream_buffer->data()),
-        boost::asio::buffers_begin(stream_buffer->data()) + bytes_transferred);
-      stream_buffer->consume(bytes_transferred);
-      std::string remaining = std::string(
-        boost::asio::buffers_begin(stream_buffer->data()),
-        boost::asio::buffers_begin(stream_buffer->data()) + stream_buffer->size());
-      ctx.logger.write_debug(message);
-      std::shared_ptr<Connection> connection = Connection::create(client_socket, message);
-      connection->handle_connection(remaining);
-    } catch (boost::system::system_error &e) {
-      ctx.logger.write_error(e.what(), "Server::handle_accept");
-    } catch (BadRequestException &e) {
-      ctx.logger.write_warn(e.what(), "Server::handle_accept");
-    } catch (UnsupportedHTTPMethod &e) {
-      ctx.logger.write_warn(e.what(), "Server::handle_accept");
-    } catch (UnsupportedHTTPVersionException &e) {
-      ctx.logger.write_warn(e.what(), "Server::handle_accept");
-    } catch (BlockedException &e) {
-      ctx.logger.write_info(e.what(), "Server::handle_accept");
+    Metrics::increment(ACCEPTED_CONNECTIONS);
+    boost::system::error_code endpoint_error;
+    boost::asio::ip::tcp::endpoint client_endpoint = peer_socket.remote_endpoint(endpoint_error);
+    if (endpoint_error) {
+      LOG_ERROR(ctx.logger, "Server::handle_accept", endpoint_error);
+    } else if (!ctx.admission.acquire(TUNNEL_SLOT)) {
+      LOG_WARN(ctx.logger, "Server::handle_accept", "Tunnel limit reached, shedding ", client_endpoint.address(), ":",
+        client_endpoint.port());
+      Connection::reject(peer_socket);
+    } else if (!ctx.admission.acquire(HANDSHAKE_SLOT)) {
+      ctx.admission.release(TUNNEL_SLOT);
+      LOG_WARN(ctx.logger, "Server::handle_accept", "Handshake limit reached, shedding ", client_endpoint.address(),
+        ":", client_endpoint.port());
+      Connection::reject(peer_socket);
+    } else {
+      LOG_DEBUG(ctx.logger, "", "Accepted connection from ", client_endpoint.address(), ":", client_endpoint.port(),
+        " on shard ", shard->index, ".");
+      boost::system::error_code tuning_error = ctx.socket_tuning.apply(peer_socket.native_handle(), CLIENT_SOCKET);
+      if (tuning_error) {
+        LOG_DEBUG(ctx.logger, "Server::handle_accept", "Unable to tune client socket | ", tuning_error);
+      }
+      if (ctx.socket_tuning.is_first(CLIENT_SOCKET)) {
+        LOG_INFO(ctx.logger, "", "Client socket options: ",
+          SocketTuning::describe(peer_socket.native_handle(), CLIENT_SOCKET));
+      }
+      Connection::create(std::move(peer_socket), *shard)->start_handshake();
     }
-    delete stream_buffer;
   } else {
-    ctx.logger.write_error(error.message(), "Server::handle_accept");
+    LOG_ERROR(ctx.logger, "Server::handle_accept", error);
   }
-  this->listen_socket->async_accept(ctx.ctx, std::bind(&Server::handle_accept, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+  this->start_accept(*shard);
 }
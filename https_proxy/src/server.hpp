@@ -2,22 +2,29 @@
 #define HTTPS_PROXY_SERVER_HPP_
 
 #include <memory>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 
+#include "metrics_server.hpp"
+#include "shard.hpp"
+
 class Server : public std::enable_shared_from_this<Server> {
   public:
     static std::shared_ptr<Server> create(int);
     ~Server();
     void listen();
-    
+
   private:
     explicit Server(int);
     std::unique_ptr<boost::thread_group> thread_group;
-    std::shared_ptr<boost::asio::ip::tcp::acceptor> listen_socket;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::shared_ptr<MetricsServer> metrics_server;
 
-    void handle_accept(const boost::system::error_code&, boost::asio::ip::tcp::socket);
+    void start_accept(Shard&);
+    void resume_accept(Shard*, const boost::system::error_code&);
+    void handle_accept(Shard*, const boost::system::error_code&, boost::asio::ip::tcp::socket);
 };
 
 #endif  // HTTPS_PROXY_SERVER_HPP_
@@ -0,0 +1,83 @@
+#include "shard.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "context.hpp"
+
+Shard::Shard(size_t index)
+  : index(index), io(1), acceptor(io), accept_timer(io), tick_timer(io), epoch(std::chrono::steady_clock::now()),
+    upstreams(*this) {
+  if (!ctx.journal_path.empty()) {
+    this->journal = TelemetryJournal::create(ctx.journal_path, index, ctx.journal_size);
+    if (!this->journal) {
+      LOG_WARN(ctx.logger, "Shard::Shard", "Unable to create telemetry journal ",
+        TelemetryJournal::file_name(ctx.journal_path, index, 0), " on shard ", index, ", logging telemetry instead.");
+    }
+  }
+  if (ctx.relay_mode == URING_RELAY) {
+    this->uring = UringRelay::create(this->io);
+    if (!this->uring) {
+      LOG_WARN(ctx.logger, "Shard::Shard", "Unable to set up io_uring on shard ", index, ", falling back to copy relay.");
+    }
+  }
+}
+
+// Runs the event loop on the calling thread until the shard is stopped, optionally pinning the thread to one of the
+// CPUs the process may run on.
+void Shard::run(bool pin) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    size_t target = this->index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (!CPU_ISSET(cpu, &allowed) || target-- > 0) {
+        continue;
+      }
+      cpu_set_t pinned;
+      CPU_ZERO(&pinned);
+      CPU_SET(cpu, &pinned);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) != 0) {
+        LOG_WARN(ctx.logger, "Shard::run", "Unable to pin shard ", this->index, " to CPU ", cpu);
+      } else {
+        LOG_DEBUG(ctx.logger, "Shard::run", "Pinned shard ", this->index, " to CPU ", cpu);
+      }
+      break;
+    }
+  }
+#endif
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work(this->io.get_executor());
+  this->start_tick();
+  this->io.run();
+}
+
+// The wheel tick after which at least the given time will have passed.
+uint64_t Shard::deadline_after(std::chrono::milliseconds timeout) const {
+  return this->wheel.now() + (timeout + SHARD_TICK - std::chrono::milliseconds(1)) / SHARD_TICK;
+}
+
+// Ticks are counted from the epoch of the shard, so a late tick does not delay the following ones.
+void Shard::start_tick() {
+  this->tick_timer.expires_at(this->epoch + (this->wheel.now() + 1) * SHARD_TICK);
+  this->tick_timer.async_wait(boost::bind(&Shard::handle_tick, this, boost::asio::placeholders::error));
+}
+
+void Shard::handle_tick(const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+  this->wheel.advance((std::chrono::steady_clock::now() - this->epoch) / SHARD_TICK);
+  this->start_tick();
+}
+
+// One shard per hardware thread.
+size_t Shard::default_count() {
+  unsigned count = boost::thread::hardware_concurrency();
+  return count > 0 ? count : 1;
+}
@@ -0,0 +1,61 @@
+#ifndef HTTPS_PROXY_SHARD_HPP_
+#define HTTPS_PROXY_SHARD_HPP_
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <boost/asio.hpp>
+
+#include "journal.hpp"
+#include "timing_wheel.hpp"
+#include "upstream_pool.hpp"
+#include "uring_relay.hpp"
+
+#define SHARD_TICK std::chrono::milliseconds(100)
+
+#ifdef SO_REUSEPORT
+typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> ReusePort;
+#endif
+
+// An event loop run by a single thread, with its own listening socket. The
+// listening sockets of all shards are bound to the same port with SO_REUSEPORT
+// so that the kernel spreads incoming connections across the shards, and every
+// handler of a connection runs on the shard that accepted it. A shard stops
+// accepting while the admission limits are reached, leaving new connections in
+// the listen backlog, and polls with its accept timer until it may resume.
+// The deadlines of the connections served by a shard are kept in its timing
+// wheel, which a single timer advances every SHARD_TICK. The wheel outlives the
+// event loop, so connections destroyed along with the loop can still cancel
+// their deadlines. With the io_uring relay, the tunnels of a shard share one
+// ring, whose completions are handled by the event loop. With a telemetry
+// journal, the shard writes the records of its tunnels into its own journal
+// files, which also outlive the event loop. Idle connections to servers kept
+// for forwarded plain HTTP requests belong to the shard that opened them.
+struct Shard {
+  size_t index;
+  TimingWheel wheel;
+  std::unique_ptr<TelemetryJournal> journal;
+  boost::asio::io_context io;
+  boost::asio::ip::tcp::acceptor acceptor;
+  boost::asio::steady_timer accept_timer;
+  boost::asio::steady_timer tick_timer;
+  std::chrono::steady_clock::time_point epoch;
+  std::unique_ptr<UringRelay> uring;
+  UpstreamPool upstreams;
+  bool accepting = true;
+
+  explicit Shard(size_t);
+  void run(bool);
+  uint64_t deadline_after(std::chrono::milliseconds) const;
+
+  static size_t default_count();
+
+  private:
+    void start_tick();
+    void handle_tick(const boost::system::error_code&);
+};
+
+#endif  // HTTPS_PROXY_SHARD_HPP_
@@ -0,0 +1,256 @@
+#include "socket_tuning.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+// No options are changed, which keeps the behaviour of the proxy before profiles existed.
+static const SocketProfile DEFAULT_PROFILE = {
+  .name = DEFAULT_SOCKET_PROFILE,
+  .no_delay = false,
+  .send_buffer = SYSTEM_DEFAULT,
+  .receive_buffer = SYSTEM_DEFAULT,
+  .keepalive_idle = SYSTEM_DEFAULT,
+  .keepalive_interval = SYSTEM_DEFAULT,
+  .keepalive_count = SYSTEM_DEFAULT,
+  .defer_accept = SYSTEM_DEFAULT,
+  .fast_open_connect = false
+};
+
+// Sends small writes such as the 200 response and TLS records at once. Fast open connects are left to the
+// fastopen_connect option: they complete before the server answers, which defeats the connect timeout and the
+// fallback to other addresses, and reports unreachable servers as relay errors instead of 502 responses.
+static const SocketProfile LATENCY_PROFILE = {
+  .name = "latency",
+  .no_delay = true,
+  .send_buffer = SYSTEM_DEFAULT,
+  .receive_buffer = SYSTEM_DEFAULT,
+  .keepalive_idle = SOCKET_KEEPALIVE_IDLE,
+  .keepalive_interval = SOCKET_KEEPALIVE_INTERVAL,
+  .keepalive_count = SOCKET_KEEPALIVE_COUNT,
+  .defer_accept = SOCKET_DEFER_ACCEPT,
+  .fast_open_connect = false
+};
+
+// Keeps more data in flight on tunnels with a large bandwidth-delay product. The relay only writes what it has read,
+// so delaying the tail of a write for coalescing would only stall the peer until its delayed acknowledgement.
+static const SocketProfile BULK_PROFILE = {
+  .name = "bulk",
+  .no_delay = true,
+  .send_buffer = BULK_SOCKET_BUFFER_SIZE,
+  .receive_buffer = BULK_SOCKET_BUFFER_SIZE,
+  .keepalive_idle = SOCKET_KEEPALIVE_IDLE,
+  .keepalive_interval = SOCKET_KEEPALIVE_INTERVAL,
+  .keepalive_count = SOCKET_KEEPALIVE_COUNT,
+  .defer_accept = SOCKET_DEFER_ACCEPT,
+  .fast_open_connect = false
+};
+
+static bool parse_number(const std::string &value, int &number) {
+  if (value.empty()) {
+    return false;
+  }
+  char *end = nullptr;
+  errno = 0;
+  long parsed = strtol(value.c_str(), &end, 10);
+  if (*end != '\0' || errno == ERANGE || parsed < 0 || parsed > INT_MAX) {
+    return false;
+  }
+  number = parsed;
+  return true;
+}
+
+static std::string trim(const std::string &text) {
+  size_t start = text.find_first_not_of(" \t\r");
+  if (start == std::string::npos) {
+    return "";
+  }
+  return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+static void set(int fd, int level, int option, int value, boost::system::error_code &error) {
+  if (setsockopt(fd, level, option, &value, sizeof(value)) != 0) {
+    error = boost::system::error_code(errno, boost::system::system_category());
+  }
+}
+
+// Reads an option back from the kernel, which may have adjusted it, e.g. doubled the buffer sizes.
+static std::string get(int fd, int level, int option) {
+  int value = 0;
+  socklen_t length = sizeof(value);
+  if (getsockopt(fd, level, option, &value, &length) != 0) {
+    return "unsupported";
+  }
+  return std::to_string(value);
+}
+
+static std::string show(int value) {
+  return value == SYSTEM_DEFAULT ? "system" : std::to_string(value);
+}
+
+SocketTuning::SocketTuning() : tuned(DEFAULT_PROFILE) {
+  for (int role = 0; role < SOCKET_ROLES; role++) {
+    this->reported[role] = false;
+  }
+}
+
+bool SocketTuning::use_profile(const std::string &name) {
+  for (const SocketProfile *profile : {&DEFAULT_PROFILE, &LATENCY_PROFILE, &BULK_PROFILE}) {
+    if (profile->name == name) {
+      this->tuned = *profile;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Overrides a single option of the profile. "profile" starts over from a named profile.
+bool SocketTuning::set_option(const std::string &name, const std::string &value) {
+  if (name == "profile") {
+    return this->use_profile(value);
+  }
+  int number;
+  if (!parse_number(value, number)) {
+    return false;
+  }
+  if (name == "nodelay" || name == "fastopen_connect") {
+    if (number > 1) {
+      return false;
+    }
+    (name == "nodelay" ? this->tuned.no_delay : this->tuned.fast_open_connect) = number == 1;
+  } else if (name == "sndbuf") {
+    this->tuned.send_buffer = number;
+  } else if (name == "rcvbuf") {
+    this->tuned.receive_buffer = number;
+  } else if (name == "keepalive_idle") {
+    this->tuned.keepalive_idle = number;
+  } else if (name == "keepalive_interval") {
+    this->tuned.keepalive_interval = number;
+  } else if (name == "keepalive_count") {
+    this->tuned.keepalive_count = number;
+  } else if (name == "defer_accept") {
+    this->tuned.defer_accept = number;
+  } else {
+    return false;
+  }
+  if (this->tuned.name.find('+') == std::string::npos) {
+    this->tuned.name += "+";
+  }
+  return true;
+}
+
+// Reads "name=value" lines, skipping blank lines and lines starting with '#'. On failure, error holds the line that
+// could not be applied.
+bool SocketTuning::read_options(const std::string &path, std::string &error) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    error = "Unable to open " + path;
+    return false;
+  }
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    line = trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t separator = line.find('=');
+    if (separator == std::string::npos
+      || !this->set_option(trim(line.substr(0, separator)), trim(line.substr(separator + 1)))) {
+      error = path + ":" + std::to_string(number) + ": " + line;
+      return false;
+    }
+  }
+  return true;
+}
+
+const SocketProfile &SocketTuning::profile() const {
+  return this->tuned;
+}
+
+// Sets every option of the profile that applies to the role and returns the error of the last one that failed, so
+// that an option the kernel does not support leaves the others in place.
+boost::system::error_code SocketTuning::apply(int fd, SocketRole role) const {
+  boost::system::error_code error;
+  const SocketProfile &profile = this->tuned;
+  if (role != CLIENT_SOCKET) {
+    if (profile.send_buffer != SYSTEM_DEFAULT) {
+      set(fd, SOL_SOCKET, SO_SNDBUF, profile.send_buffer, error);
+    }
+    if (profile.receive_buffer != SYSTEM_DEFAULT) {
+      set(fd, SOL_SOCKET, SO_RCVBUF, profile.receive_buffer, error);
+    }
+  }
+  if (role == LISTENER_SOCKET) {
+#ifdef TCP_DEFER_ACCEPT
+    if (profile.defer_accept != SYSTEM_DEFAULT) {
+      set(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, profile.defer_accept, error);
+    }
+#endif
+    return error;
+  }
+  if (profile.no_delay) {
+    set(fd, IPPROTO_TCP, TCP_NODELAY, 1, error);
+  }
+  if (profile.keepalive_idle != SYSTEM_DEFAULT) {
+    set(fd, SOL_SOCKET, SO_KEEPALIVE, 1, error);
+#ifdef TCP_KEEPIDLE
+    set(fd, IPPROTO_TCP, TCP_KEEPIDLE, profile.keepalive_idle, error);
+    if (profile.keepalive_interval != SYSTEM_DEFAULT) {
+      set(fd, IPPROTO_TCP, TCP_KEEPINTVL, profile.keepalive_interval, error);
+    }
+    if (profile.keepalive_count != SYSTEM_DEFAULT) {
+      set(fd, IPPROTO_TCP, TCP_KEEPCNT, profile.keepalive_count, error);
+    }
+#endif
+  }
+#ifdef TCP_FASTOPEN_CONNECT
+  if (role == UPSTREAM_SOCKET && profile.fast_open_connect) {
+    set(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, error);
+  }
+#endif
+  return error;
+}
+
+// Returns true for the first socket of the role only, so that the effective options get logged once per role.
+bool SocketTuning::is_first(SocketRole role) {
+  return !this->reported[role].exchange(true, std::memory_order_relaxed);
+}
+
+std::string SocketTuning::describe(const SocketProfile &profile) {
+  std::string keepalive = profile.keepalive_idle == SYSTEM_DEFAULT ? "off" : std::to_string(profile.keepalive_idle)
+    + "/" + show(profile.keepalive_interval) + "/" + show(profile.keepalive_count);
+  return profile.name + ": nodelay=" + std::to_string(profile.no_delay)
+    + " sndbuf=" + show(profile.send_buffer)
+    + " rcvbuf=" + show(profile.receive_buffer)
+    + " keepalive=" + keepalive
+    + " defer_accept=" + show(profile.defer_accept)
+    + " fastopen_connect=" + std::to_string(profile.fast_open_connect);
+}
+
+// Describes the options of the socket as the kernel reports them.
+std::string SocketTuning::describe(int fd, SocketRole role) {
+  std::string description = "sndbuf=" + get(fd, SOL_SOCKET, SO_SNDBUF) + " rcvbuf=" + get(fd, SOL_SOCKET, SO_RCVBUF);
+  if (role == LISTENER_SOCKET) {
+#ifdef TCP_DEFER_ACCEPT
+    description += " defer_accept=" + get(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT);
+#endif
+    return description;
+  }
+  description += " nodelay=" + get(fd, IPPROTO_TCP, TCP_NODELAY) + " keepalive=" + get(fd, SOL_SOCKET, SO_KEEPALIVE);
+#ifdef TCP_KEEPIDLE
+  description += "/" + get(fd, IPPROTO_TCP, TCP_KEEPIDLE) + "/" + get(fd, IPPROTO_TCP, TCP_KEEPINTVL) + "/"
+    + get(fd, IPPROTO_TCP, TCP_KEEPCNT);
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+  if (role == UPSTREAM_SOCKET) {
+    description += " fastopen_connect=" + get(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT);
+  }
+#endif
+  return description;
+}
@@ -0,0 +1,58 @@
+#ifndef HTTPS_PROXY_SOCKET_TUNING_HPP_
+#define HTTPS_PROXY_SOCKET_TUNING_HPP_
+
+#include <atomic>
+#include <string>
+
+#include <boost/system/error_code.hpp>
+
+// Leaves an option at the value the system picks.
+#define SYSTEM_DEFAULT 0
+#define DEFAULT_SOCKET_PROFILE "default"
+#define SOCKET_KEEPALIVE_IDLE 60
+#define SOCKET_KEEPALIVE_INTERVAL 10
+#define SOCKET_KEEPALIVE_COUNT 6
+#define SOCKET_DEFER_ACCEPT 5
+#define BULK_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+
+enum SocketRole {LISTENER_SOCKET = 0, CLIENT_SOCKET = 1, UPSTREAM_SOCKET = 2, SOCKET_ROLES = 3};
+
+// Options applied to the sockets of the proxy. Sizes are in bytes and times in
+// seconds, and SYSTEM_DEFAULT leaves an option untouched. Keepalive is enabled
+// when keepalive_idle is set.
+struct SocketProfile {
+  std::string name;
+  bool no_delay;
+  int send_buffer;
+  int receive_buffer;
+  int keepalive_idle;
+  int keepalive_interval;
+  int keepalive_count;
+  int defer_accept;
+  bool fast_open_connect;
+};
+
+// Applies a socket profile to the listeners, to the accepted client sockets and
+// to the upstream sockets. The buffer sizes are set on the listeners, from
+// which accepted sockets inherit them in time for the window scale to be
+// negotiated, and on upstream sockets before they connect. The profile is one
+// of the named profiles, with options overridden one at a time from the
+// command line or a config file.
+class SocketTuning {
+  public:
+    SocketTuning();
+    bool use_profile(const std::string&);
+    bool set_option(const std::string&, const std::string&);
+    bool read_options(const std::string&, std::string&);
+    const SocketProfile &profile() const;
+    boost::system::error_code apply(int, SocketRole) const;
+    bool is_first(SocketRole);
+    static std::string describe(const SocketProfile&);
+    static std::string describe(int, SocketRole);
+
+  private:
+    SocketProfile tuned;
+    std::atomic<bool> reported[SOCKET_ROLES];
+};
+
+#endif  // HTTPS_PROXY_SOCKET_TUNING_HPP_
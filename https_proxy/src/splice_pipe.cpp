@@ -0,0 +1,70 @@
+#include "splice_pipe.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <memory>
+
+SplicePipe::SplicePipe(int read_end, int write_end) : read_end(read_end), write_end(write_end), buffered(0) {
+}
+
+SplicePipe::~SplicePipe() {
+  close(this->read_end);
+  close(this->write_end);
+}
+
+std::unique_ptr<SplicePipe> SplicePipe::create() {
+#ifdef __linux__
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+    return nullptr;
+  }
+  fcntl(fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+  return std::unique_ptr<SplicePipe>(new SplicePipe(fds[0], fds[1]));
+#else
+  return nullptr;
+#endif
+}
+
+bool SplicePipe::is_supported() {
+#ifdef __linux__
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Moves up to length bytes from the socket into the pipe.
+// Returns the number of bytes moved, 0 on end of stream, or -1 with errno set.
+ssize_t SplicePipe::fill(int socket, size_t length) {
+#ifdef __linux__
+  ssize_t moved = splice(socket, NULL, this->write_end, NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (moved > 0) {
+    this->buffered += moved;
+  }
+  return moved;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// Moves as much of the buffered data as possible from the pipe into the socket.
+// Returns the number of bytes moved or -1 with errno set.
+ssize_t SplicePipe::drain(int socket) {
+#ifdef __linux__
+  ssize_t moved = splice(this->read_end, NULL, socket, NULL, this->buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (moved > 0) {
+    this->buffered -= moved;
+  }
+  return moved;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+size_t SplicePipe::pending() {
+  return this->buffered;
+}
@@ -0,0 +1,28 @@
+#ifndef HTTPS_PROXY_SPLICE_PIPE_HPP_
+#define HTTPS_PROXY_SPLICE_PIPE_HPP_
+
+#include <sys/types.h>
+
+#include <memory>
+
+#define SPLICE_PIPE_SIZE 65536
+
+// Kernel pipe used to move data between two sockets with splice() without
+// copying the payload into user space. Only available on Linux.
+class SplicePipe {
+  public:
+    ~SplicePipe();
+    static std::unique_ptr<SplicePipe> create();
+    static bool is_supported();
+    ssize_t fill(int, size_t);
+    ssize_t drain(int);
+    size_t pending();
+
+  private:
+    SplicePipe(int, int);
+    int read_end;
+    int write_end;
+    size_t buffered;
+};
+
+#endif  // HTTPS_PROXY_SPLICE_PIPE_HPP_
@@ -0,0 +1,135 @@
+#include "timing_wheel.hpp"
+
+#define SLOT_MASK (TIMING_WHEEL_SLOTS - 1)
+#define LEVEL_SPAN(level) ((uint64_t) 1 << (TIMING_WHEEL_SLOT_BITS * ((level) + 1)))
+
+TimingWheel::TimingWheel() : current(0), count(0) {
+  for (int level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < TIMING_WHEEL_SLOTS; slot++) {
+      this->slots[level][slot] = nullptr;
+    }
+  }
+}
+
+// Detaches the remaining entries, so that their owners may still cancel them after the wheel is gone.
+TimingWheel::~TimingWheel() {
+  for (int level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < TIMING_WHEEL_SLOTS; slot++) {
+      for (TimerEntry *entry = this->slots[level][slot]; entry != nullptr; ) {
+        TimerEntry *next = entry->next;
+        entry->next = nullptr;
+        entry->link = nullptr;
+        entry = next;
+      }
+    }
+  }
+}
+
+// The next tick to be processed. Deadlines are expressed in the same ticks.
+uint64_t TimingWheel::now() const {
+  return this->current;
+}
+
+size_t TimingWheel::size() const {
+  return this->count;
+}
+
+// Schedules the entry to expire once the given tick has been processed. A scheduled entry whose deadline is pushed
+// back stays where it is until the wheel reaches it.
+void TimingWheel::schedule(TimerEntry &entry, uint64_t deadline) {
+  if (entry.is_scheduled()) {
+    if (deadline >= entry.scheduled) {
+      entry.deadline = deadline;
+      return;
+    }
+    this->unlink(entry);
+  }
+  entry.deadline = deadline;
+  this->insert(entry);
+}
+
+void TimingWheel::cancel(TimerEntry &entry) {
+  if (entry.is_scheduled()) {
+    this->unlink(entry);
+  }
+}
+
+// Processes every tick before the given one and returns the number of entries that expired. An entry is unlinked
+// before its expiry handler is called, so the handler may schedule it again.
+size_t TimingWheel::advance(uint64_t tick) {
+  size_t expired = 0;
+  while (this->current < tick) {
+    int slot = this->current & SLOT_MASK;
+    if (slot == 0) {
+      for (int level = 1; level < TIMING_WHEEL_LEVELS && this->cascade(level); level++) {
+      }
+    }
+    this->current++;
+    // The due entries stay linked through a local head while they are processed, so an expiry handler may still
+    // cancel any of them.
+    TimerEntry *pending = this->slots[0][slot];
+    this->slots[0][slot] = nullptr;
+    if (pending != nullptr) {
+      pending->link = &pending;
+    }
+    while (pending != nullptr) {
+      TimerEntry *entry = pending;
+      this->unlink(*entry);
+      if (entry->deadline >= this->current) {
+        this->insert(*entry);
+      } else {
+        expired++;
+        entry->expire(*entry);
+      }
+    }
+  }
+  return expired;
+}
+
+void TimingWheel::insert(TimerEntry &entry) {
+  uint64_t deadline = entry.deadline < this->current ? this->current : entry.deadline;
+  uint64_t last = this->current + LEVEL_SPAN(TIMING_WHEEL_LEVELS - 1) - 1;
+  if (deadline > last) {
+    deadline = last;
+  }
+  int level = 0;
+  while (deadline - this->current >= LEVEL_SPAN(level)) {
+    level++;
+  }
+  TimerEntry **head = &this->slots[level][(deadline >> (TIMING_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+  entry.scheduled = deadline;
+  entry.next = *head;
+  entry.link = head;
+  if (*head != nullptr) {
+    (*head)->link = &entry.next;
+  }
+  *head = &entry;
+  this->count++;
+}
+
+void TimingWheel::unlink(TimerEntry &entry) {
+  *entry.link = entry.next;
+  if (entry.next != nullptr) {
+    entry.next->link = entry.link;
+  }
+  entry.next = nullptr;
+  entry.link = nullptr;
+  this->count--;
+}
+
+// Moves the entries of the level's current slot down to finer levels. Returns whether the level has wrapped around,
+// in which case the next coarser level is due as well.
+bool TimingWheel::cascade(int level) {
+  int slot = (this->current >> (TIMING_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+  TimerEntry *entry = this->slots[level][slot];
+  this->slots[level][slot] = nullptr;
+  while (entry != nullptr) {
+    TimerEntry *next = entry->next;
+    entry->next = nullptr;
+    entry->link = nullptr;
+    this->count--;
+    this->insert(*entry);
+    entry = next;
+  }
+  return slot == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef HTTPS_PROXY_TIMING_WHEEL_HPP_
+#define HTTPS_PROXY_TIMING_WHEEL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#define TIMING_WHEEL_LEVELS 4
+#define TIMING_WHEEL_SLOT_BITS 6
+#define TIMING_WHEEL_SLOTS (1 << TIMING_WHEEL_SLOT_BITS)
+#define NO_DEADLINE UINT64_MAX
+
+struct TimerEntry;
+typedef void (*ExpiryHandler)(TimerEntry&);
+
+// A deadline tracked by a TimingWheel, embedded in the object it belongs to.
+// The owner is whatever the expiry handler needs to find that object.
+struct TimerEntry {
+  TimerEntry *next = nullptr;
+  TimerEntry **link = nullptr;
+  uint64_t deadline = 0;
+  uint64_t scheduled = 0;
+  ExpiryHandler expire = nullptr;
+  void *owner = nullptr;
+
+  bool is_scheduled() const {
+    return this->link != nullptr;
+  }
+};
+
+// Hierarchical timing wheel counting time in ticks, with TIMING_WHEEL_LEVELS
+// levels of TIMING_WHEEL_SLOTS slots. An entry is kept in the slot of the
+// coarsest level needed to tell its deadline apart from the current tick, and
+// moves down a level each time the wheel reaches its slot, so scheduling and
+// cancelling take constant time however many entries there are.
+//
+// Entries are intrusive lists, so the wheel never allocates. Pushing a deadline
+// back only records the new deadline, and the entry is moved when the wheel
+// reaches its old slot, which keeps frequent refreshes down to a comparison and
+// a store. Deadlines further away than the wheel spans are clamped to its last
+// slot in the same way.
+class TimingWheel {
+  public:
+    TimingWheel();
+    ~TimingWheel();
+    uint64_t now() const;
+    size_t size() const;
+    void schedule(TimerEntry&, uint64_t);
+    void cancel(TimerEntry&);
+    size_t advance(uint64_t);
+
+  private:
+    TimerEntry *slots[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOTS];
+    uint64_t current;
+    size_t count;
+
+    void insert(TimerEntry&);
+    void unlink(TimerEntry&);
+    bool cascade(int);
+};
+
+#endif  // HTTPS_PROXY_TIMING_WHEEL_HPP_
@@ -0,0 +1,193 @@
+#include "top_talkers.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <utility>
+
+struct CachedTalkers {
+  const void *owner = nullptr;
+  void *talkers = nullptr;
+};
+
+static thread_local CachedTalkers cached_talkers;
+
+// The slots are never reallocated, so the views of their keys stay valid.
+SpaceSaving::SpaceSaving(size_t capacity) : capacity(capacity) {
+  this->slots.reserve(capacity);
+  this->heap.reserve(capacity);
+}
+
+void SpaceSaving::add(std::string_view key, uint64_t weight) {
+  if (this->capacity == 0) {
+    return;
+  }
+  std::unordered_map<std::string_view, size_t>::iterator position = this->positions.find(key);
+  if (position != this->positions.end()) {
+    Slot &slot = this->slots[position->second];
+    slot.count += weight;
+    this->sift_down(slot.heap_index);
+    return;
+  }
+  if (this->slots.size() < this->capacity) {
+    size_t index = this->slots.size();
+    this->slots.push_back(Slot {std::string(key), weight, 0, this->heap.size()});
+    this->positions.emplace(this->slots.back().key, index);
+    this->heap.push_back(index);
+    // A new entry starts from the smallest possible count, so it only needs to move up.
+    for (size_t child = this->heap.size() - 1; child > 0 && this->slots[this->heap[(child - 1) / 2]].count > weight; ) {
+      this->swap(child, (child - 1) / 2);
+      child = (child - 1) / 2;
+    }
+    return;
+  }
+  size_t index = this->heap[0];
+  Slot &minimum = this->slots[index];
+  this->positions.erase(minimum.key);
+  minimum.error = minimum.count;
+  minimum.count += weight;
+  minimum.key.assign(key);
+  this->positions.emplace(minimum.key, index);
+  this->sift_down(0);
+}
+
+// The tracked keys, largest count first.
+std::vector<TalkerEstimate> SpaceSaving::top() const {
+  std::vector<TalkerEstimate> estimates;
+  for (const Slot &slot : this->slots) {
+    estimates.push_back(TalkerEstimate {slot.key, slot.count, slot.error});
+  }
+  std::sort(estimates.begin(), estimates.end(), [](const TalkerEstimate &a, const TalkerEstimate &b) {
+    return a.count > b.count;
+  });
+  return estimates;
+}
+
+// The largest total a key that is not tracked can have.
+uint64_t SpaceSaving::minimum() const {
+  return this->slots.size() < this->capacity ? 0 : this->slots[this->heap[0]].count;
+}
+
+// Combines summaries of separate streams into estimates for their union, largest count first, keeping the given number
+// of keys. A key not tracked by a summary may have had up to that summary's minimum in its stream, which is added to
+// both its count and its error, so the true total of every key still lies between count - error and count.
+std::vector<TalkerEstimate> SpaceSaving::merge(const std::vector<const SpaceSaving*> &summaries, size_t capacity) {
+  struct Merged {
+    uint64_t count = 0;
+    uint64_t error = 0;
+    uint64_t minimums = 0;
+  };
+  uint64_t minimums = 0;
+  std::unordered_map<std::string_view, Merged> merged;
+  for (const SpaceSaving *summary : summaries) {
+    uint64_t minimum = summary->minimum();
+    minimums += minimum;
+    for (const Slot &slot : summary->slots) {
+      Merged &estimate = merged[slot.key];
+      estimate.count += slot.count;
+      estimate.error += slot.error;
+      estimate.minimums += minimum;
+    }
+  }
+  std::vector<TalkerEstimate> estimates;
+  for (const std::pair<const std::string_view, Merged> &entry : merged) {
+    uint64_t untracked = minimums - entry.second.minimums;
+    estimates.push_back(TalkerEstimate {std::string(entry.first), entry.second.count + untracked,
+      entry.second.error + untracked});
+  }
+  std::sort(estimates.begin(), estimates.end(), [](const TalkerEstimate &a, const TalkerEstimate &b) {
+    return a.count > b.count;
+  });
+  if (estimates.size() > capacity) {
+    estimates.resize(capacity);
+  }
+  return estimates;
+}
+
+void SpaceSaving::sift_down(size_t parent) {
+  while (true) {
+    size_t smallest = parent;
+    for (size_t child = parent * 2 + 1; child <= parent * 2 + 2 && child < this->heap.size(); child++) {
+      if (this->slots[this->heap[child]].count < this->slots[this->heap[smallest]].count) {
+        smallest = child;
+      }
+    }
+    if (smallest == parent) {
+      return;
+    }
+    this->swap(parent, smallest);
+    parent = smallest;
+  }
+}
+
+void SpaceSaving::swap(size_t a, size_t b) {
+  std::swap(this->heap[a], this->heap[b]);
+  this->slots[this->heap[a]].heap_index = a;
+  this->slots[this->heap[b]].heap_index = b;
+}
+
+TopTalkers::LocalTalkers::LocalTalkers(size_t capacity) : thread(std::this_thread::get_id()),
+  destination_bytes(capacity), destination_tunnels(capacity), client_bytes(capacity), client_tunnels(capacity) {
+}
+
+TopTalkers::TopTalkers() : capacity(DEFAULT_TOP_TALKERS) {
+}
+
+// Only called before any traffic is recorded.
+void TopTalkers::set_capacity(size_t capacity) {
+  this->capacity = capacity;
+}
+
+void TopTalkers::record_tunnel(std::string_view destination, std::string_view client) {
+  LocalTalkers &talkers = this->local();
+  std::lock_guard<std::mutex> guard(talkers.lock);
+  talkers.destination_tunnels.add(destination, 1);
+  talkers.client_tunnels.add(client, 1);
+}
+
+void TopTalkers::record_bytes(std::string_view destination, std::string_view client, uint64_t bytes) {
+  LocalTalkers &talkers = this->local();
+  std::lock_guard<std::mutex> guard(talkers.lock);
+  talkers.destination_bytes.add(destination, bytes);
+  talkers.client_bytes.add(client, bytes);
+}
+
+TopTalkersSnapshot TopTalkers::snapshot() {
+  std::lock_guard<std::mutex> guard(this->registry_lock);
+  std::vector<std::unique_lock<std::mutex>> locks;
+  std::vector<const SpaceSaving*> destination_bytes;
+  std::vector<const SpaceSaving*> destination_tunnels;
+  std::vector<const SpaceSaving*> client_bytes;
+  std::vector<const SpaceSaving*> client_tunnels;
+  for (std::unique_ptr<LocalTalkers> &talkers : this->registry) {
+    locks.emplace_back(talkers->lock);
+    destination_bytes.push_back(&(talkers->destination_bytes));
+    destination_tunnels.push_back(&(talkers->destination_tunnels));
+    client_bytes.push_back(&(talkers->client_bytes));
+    client_tunnels.push_back(&(talkers->client_tunnels));
+  }
+  return TopTalkersSnapshot {
+    .destination_bytes = SpaceSaving::merge(destination_bytes, this->capacity),
+    .destination_tunnels = SpaceSaving::merge(destination_tunnels, this->capacity),
+    .client_bytes = SpaceSaving::merge(client_bytes, this->capacity),
+    .client_tunnels = SpaceSaving::merge(client_tunnels, this->capacity)
+  };
+}
+
+// Returns the summaries of the calling thread, creating them on its first record. They are kept after the thread exits
+// so that its traffic is still reported.
+TopTalkers::LocalTalkers &TopTalkers::local() {
+  if (cached_talkers.owner != this) {
+    std::lock_guard<std::mutex> guard(this->registry_lock);
+    std::vector<std::unique_ptr<LocalTalkers>>::iterator found = std::find_if(this->registry.begin(),
+      this->registry.end(), [](const std::unique_ptr<LocalTalkers> &talkers) {
+        return talkers->thread == std::this_thread::get_id();
+      });
+    if (found == this->registry.end()) {
+      found = this->registry.insert(this->registry.end(), std::make_unique<LocalTalkers>(this->capacity));
+    }
+    cached_talkers.owner = this;
+    cached_talkers.talkers = found->get();
+  }
+  return *static_cast<LocalTalkers*>(cached_talkers.talkers);
+}
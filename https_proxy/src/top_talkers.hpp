@@ -0,0 +1,99 @@
+#ifndef HTTPS_PROXY_TOP_TALKERS_HPP_
+#define HTTPS_PROXY_TOP_TALKERS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define DEFAULT_TOP_TALKERS 64
+// Bytes a tunnel relays before they are added to the top talkers, so that long
+// lived tunnels show up while they are still open.
+#define TOP_TALKERS_FLUSH_BYTES (1024 * 1024)
+
+// Estimated total of a key. The true total lies between count - error and count.
+struct TalkerEstimate {
+  std::string key;
+  uint64_t count;
+  uint64_t error;
+};
+
+// Space-Saving summary of a weighted stream, which tracks at most a fixed number
+// of keys. A key that is not tracked replaces the key with the smallest count
+// and inherits that count as its error, so every key whose total exceeds the
+// sum of all weights divided by the capacity is guaranteed to be tracked. The
+// tracked keys live in slots allocated once, which are ordered by count in a
+// min-heap of slot indices, and are found by views of the keys in the slots, so
+// a key that is already tracked is added without copying it.
+class SpaceSaving {
+  public:
+    explicit SpaceSaving(size_t);
+    SpaceSaving(SpaceSaving&&) = default;
+    SpaceSaving &operator=(SpaceSaving&&) = default;
+    void add(std::string_view, uint64_t);
+    std::vector<TalkerEstimate> top() const;
+    uint64_t minimum() const;
+
+    static std::vector<TalkerEstimate> merge(const std::vector<const SpaceSaving*>&, size_t);
+
+  private:
+    struct Slot {
+      std::string key;
+      uint64_t count;
+      uint64_t error;
+      size_t heap_index;
+    };
+
+    size_t capacity;
+    std::vector<Slot> slots;
+    std::vector<size_t> heap;
+    std::unordered_map<std::string_view, size_t> positions;
+
+    void sift_down(size_t);
+    void swap(size_t, size_t);
+};
+
+struct TopTalkersSnapshot {
+  std::vector<TalkerEstimate> destination_bytes;
+  std::vector<TalkerEstimate> destination_tunnels;
+  std::vector<TalkerEstimate> client_bytes;
+  std::vector<TalkerEstimate> client_tunnels;
+};
+
+// Destination hostnames and client addresses with the most relayed bytes and
+// the most tunnels, in memory bounded by the capacity of the summaries. Each
+// thread recording traffic, which is a shard thread, keeps its own summaries,
+// so recording only takes a lock that snapshots contend for. The summaries of
+// all threads are merged when a snapshot is taken.
+class TopTalkers {
+  public:
+    TopTalkers();
+    void set_capacity(size_t);
+    void record_tunnel(std::string_view, std::string_view);
+    void record_bytes(std::string_view, std::string_view, uint64_t);
+    TopTalkersSnapshot snapshot();
+
+  private:
+    struct LocalTalkers {
+      explicit LocalTalkers(size_t);
+      std::thread::id thread;
+      std::mutex lock;
+      SpaceSaving destination_bytes;
+      SpaceSaving destination_tunnels;
+      SpaceSaving client_bytes;
+      SpaceSaving client_tunnels;
+    };
+
+    size_t capacity;
+    std::mutex registry_lock;
+    std::vector<std::unique_ptr<LocalTalkers>> registry;
+
+    LocalTalkers &local();
+};
+
+#endif  // HTTPS_PROXY_TOP_TALKERS_HPP_
@@ -0,0 +1,127 @@
+#include "upstream_pool.hpp"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "context.hpp"
+#include "metrics.hpp"
+#include "shard.hpp"
+
+IdleUpstream::IdleUpstream(boost::asio::ip::tcp::socket socket) : socket(std::move(socket)), id(0), pool(nullptr) {
+}
+
+UpstreamPool::UpstreamPool(Shard &shard) : shard(shard), next_id(0) {
+}
+
+UpstreamPool::~UpstreamPool() {
+  for (std::pair<const uint64_t, std::unique_ptr<IdleUpstream>> &connection : this->connections) {
+    this->shard.wheel.cancel(connection.second->deadline);
+  }
+}
+
+// Moves an idle connection to the key into the socket. Connections found closed on the way are dropped.
+bool UpstreamPool::acquire(const std::string &key, boost::asio::ip::tcp::socket &socket) {
+  for (;;) {
+    std::unordered_map<std::string, std::vector<uint64_t>>::iterator found = this->idle.find(key);
+    if (found == this->idle.end()) {
+      Metrics::increment(UPSTREAM_POOL_MISSES);
+      return false;
+    }
+    std::unique_ptr<IdleUpstream> connection = this->remove(found->second.back());
+    if (UpstreamPool::is_reusable(connection->socket)) {
+      Metrics::increment(UPSTREAM_POOL_HITS);
+      socket = std::move(connection->socket);
+      return true;
+    }
+    LOG_DEBUG(ctx.logger, "UpstreamPool::acquire", "Dropping closed connection to ", key);
+    Metrics::increment(UPSTREAM_POOL_EVICTIONS);
+  }
+}
+
+// Keeps the connection until it is idle for too long, closing it instead if the shard keeps as many as it may.
+void UpstreamPool::release(const std::string &key, boost::asio::ip::tcp::socket socket) {
+  std::vector<uint64_t> &ids = this->idle[key];
+  if (ids.size() >= UPSTREAM_POOL_HOST_SIZE) {
+    this->evict(ids.front());
+  }
+  if (this->connections.size() >= ctx.upstream_pool_size) {
+    if (this->idle[key].empty()) {
+      this->idle.erase(key);
+    }
+    boost::system::error_code error;
+    socket.close(error);
+    return;
+  }
+  std::unique_ptr<IdleUpstream> connection = std::make_unique<IdleUpstream>(std::move(socket));
+  connection->key = key;
+  connection->id = this->next_id++;
+  connection->pool = this;
+  connection->deadline.expire = &UpstreamPool::expire;
+  connection->deadline.owner = connection.get();
+  this->shard.wheel.schedule(connection->deadline,
+    this->shard.deadline_after(std::chrono::seconds(ctx.upstream_idle_timeout)));
+  this->watch(*connection);
+  this->idle[key].push_back(connection->id);
+  this->connections.emplace(connection->id, std::move(connection));
+  Metrics::increment(UPSTREAM_POOL_RELEASES);
+}
+
+size_t UpstreamPool::size() const {
+  return this->connections.size();
+}
+
+// Waits for the server to close the idle connection. A completion for a connection that has left the pool since is
+// ignored.
+void UpstreamPool::watch(IdleUpstream &connection) {
+  uint64_t id = connection.id;
+  connection.socket.async_wait(boost::asio::ip::tcp::socket::wait_read,
+    [this, id](const boost::system::error_code &error) {
+      if (error == boost::asio::error::operation_aborted || this->connections.count(id) == 0) {
+        return;
+      }
+      LOG_DEBUG(ctx.logger, "UpstreamPool::watch", "Idle connection to ", this->connections[id]->key,
+        " closed by the server");
+      this->evict(id);
+    });
+}
+
+void UpstreamPool::evict(uint64_t id) {
+  this->remove(id);
+  Metrics::increment(UPSTREAM_POOL_EVICTIONS);
+}
+
+// Takes the connection out of the pool, cancelling its deadline and the wait for it to close.
+std::unique_ptr<IdleUpstream> UpstreamPool::remove(uint64_t id) {
+  std::unordered_map<uint64_t, std::unique_ptr<IdleUpstream>>::iterator found = this->connections.find(id);
+  std::unique_ptr<IdleUpstream> connection = std::move(found->second);
+  this->connections.erase(found);
+  this->shard.wheel.cancel(connection->deadline);
+  boost::system::error_code error;
+  connection->socket.cancel(error);
+  std::vector<uint64_t> &ids = this->idle[connection->key];
+  ids.erase(std::find(ids.begin(), ids.end(), id));
+  if (ids.empty()) {
+    this->idle.erase(connection->key);
+  }
+  return connection;
+}
+
+// Whether the connection is still open with nothing left to read, as a server sends nothing on an idle connection
+// before closing it.
+bool UpstreamPool::is_reusable(boost::asio::ip::tcp::socket &socket) {
+  char byte;
+  ssize_t received = recv(socket.native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Runs on the shard thread while the wheel advances, which the pool is only used from.
+void UpstreamPool::expire(TimerEntry &entry) {
+  IdleUpstream *connection = static_cast<IdleUpstream*>(entry.owner);
+  LOG_DEBUG(ctx.logger, "UpstreamPool::expire", "Closing idle connection to ", connection->key);
+  connection->pool->evict(connection->id);
+}
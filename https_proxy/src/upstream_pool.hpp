@@ -0,0 +1,65 @@
+#ifndef HTTPS_PROXY_UPSTREAM_POOL_HPP_
+#define HTTPS_PROXY_UPSTREAM_POOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "timing_wheel.hpp"
+
+#define DEFAULT_UPSTREAM_POOL_SIZE 256
+#define DEFAULT_UPSTREAM_IDLE_TIMEOUT 30
+// Idle connections kept to the same host and port.
+#define UPSTREAM_POOL_HOST_SIZE 8
+
+struct Shard;
+class UpstreamPool;
+
+// A connection waiting in the pool, until its idle deadline.
+struct IdleUpstream {
+  boost::asio::ip::tcp::socket socket;
+  TimerEntry deadline;
+  std::string key;
+  uint64_t id;
+  UpstreamPool *pool;
+
+  explicit IdleUpstream(boost::asio::ip::tcp::socket);
+};
+
+// Idle keep-alive connections to servers, kept by a shard for the plain HTTP
+// requests it forwards and keyed by "host:port", so that a repeated request
+// skips the lookup and the TCP handshake. Only used from the thread of the
+// shard, so it takes no lock. The most recently released connection to a key
+// is handed out first, and a connection is dropped once it has been idle for
+// the idle timeout, when the server closes it or sends anything while it is
+// idle, or to make room for a newer connection to the same key. A shard keeps
+// at most the configured number of idle connections, and at most
+// UPSTREAM_POOL_HOST_SIZE to the same key.
+class UpstreamPool {
+  public:
+    explicit UpstreamPool(Shard&);
+    ~UpstreamPool();
+    bool acquire(const std::string&, boost::asio::ip::tcp::socket&);
+    void release(const std::string&, boost::asio::ip::tcp::socket);
+    size_t size() const;
+
+  private:
+    Shard &shard;
+    uint64_t next_id;
+    std::unordered_map<uint64_t, std::unique_ptr<IdleUpstream>> connections;
+    std::unordered_map<std::string, std::vector<uint64_t>> idle;
+
+    void watch(IdleUpstream&);
+    void evict(uint64_t);
+    std::unique_ptr<IdleUpstream> remove(uint64_t);
+
+    static bool is_reusable(boost::asio::ip::tcp::socket&);
+    static void expire(TimerEntry&);
+};
+
+#endif  // HTTPS_PROXY_UPSTREAM_POOL_HPP_
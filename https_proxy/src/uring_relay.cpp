@@ -0,0 +1,512 @@
+#include "uring_relay.hpp"
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include <boost/bind/bind.hpp>
+
+#ifdef __linux__
+
+#define RECEIVE_OPERATION 0
+#define SEND_OPERATION 1
+#define OPERATION_MASK 3
+#define URING_COMPLETION_ENTRIES (4 * URING_QUEUE_DEPTH)
+
+static int setup(unsigned entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0);
+}
+
+static int register_ring(int fd, unsigned opcode, void *argument, unsigned count) {
+  return syscall(__NR_io_uring_register, fd, opcode, argument, count);
+}
+
+// The ring indexes are shared with the kernel.
+static unsigned load_acquire(const unsigned *index) {
+  return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+template <typename Index>
+static void store_release(Index *index, Index value) {
+  __atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+// Channels are aligned to at least 8 bytes, so the operation fits in the low bits of the user data.
+static uint64_t user_data(UringChannel &channel, int operation) {
+  return reinterpret_cast<uint64_t>(&channel) | operation;
+}
+
+UringRelay::UringRelay(boost::asio::io_context &io, int ring_fd)
+  : ring_fd(ring_fd), descriptor(io), submission_ring(MAP_FAILED), submission_ring_size(0),
+    entries(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+    entries_size(0), local_tail(0), submitted_tail(0), buffer_ring(static_cast<struct io_uring_buf_ring*>(MAP_FAILED)),
+    buffers(static_cast<char*>(MAP_FAILED)), buffer_tail(0), free_buffers(0), returned(false), reaping(false) {
+}
+
+UringRelay::~UringRelay() {
+  this->descriptor.release();
+  close(this->ring_fd);
+  if (this->buffers != MAP_FAILED) {
+    munmap(this->buffers, (size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+  }
+  if (this->buffer_ring != MAP_FAILED) {
+    munmap(this->buffer_ring, URING_BUFFER_COUNT * sizeof(struct io_uring_buf));
+  }
+  if (this->entries != MAP_FAILED) {
+    munmap(this->entries, this->entries_size);
+  }
+  if (this->submission_ring != MAP_FAILED) {
+    munmap(this->submission_ring, this->submission_ring_size);
+  }
+}
+
+// Returns nullptr when the kernel lacks io_uring or buffer rings, or when io_uring is disabled.
+std::unique_ptr<UringRelay> UringRelay::create(boost::asio::io_context &io) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+  params.cq_entries = URING_COMPLETION_ENTRIES;
+  int ring_fd = setup(URING_QUEUE_DEPTH, &params);
+  if (ring_fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<UringRelay> relay(new UringRelay(io, ring_fd));
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !relay->map_rings(params) || !relay->register_buffers()) {
+    return nullptr;
+  }
+  boost::system::error_code error;
+  relay->descriptor.assign(ring_fd, error);
+  if (error) {
+    return nullptr;
+  }
+  relay->wait();
+  return relay;
+}
+
+// Relays a byte through a socket pair, to check that receives pick their buffers from the ring.
+bool UringRelay::is_supported() {
+  boost::asio::io_context io(1);
+  std::unique_ptr<UringRelay> relay = UringRelay::create(io);
+  int fds[2];
+  if (!relay || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+    return false;
+  }
+  struct Probe {
+    size_t received = 0;
+    bool released = false;
+  } probe;
+  UringChannel channel;
+  channel.read_fd = fds[0];
+  channel.write_fd = fds[0];
+  channel.owner = &probe;
+  channel.handle = [](UringChannel &channel, UringEvent event, size_t bytes) {
+    Probe *probe = static_cast<Probe*>(channel.owner);
+    if (event == URING_RECEIVED) {
+      probe->received += bytes;
+    } else if (event == URING_RELEASED) {
+      probe->released = true;
+    }
+  };
+  relay->start(channel);
+  ssize_t written = write(fds[1], "x", 1);
+  for (int i = 0; i < 100 && probe.received == 0 && written == 1; i++) {
+    io.run_for(std::chrono::milliseconds(10));
+  }
+  relay->stop(channel);
+  shutdown(fds[0], SHUT_RDWR);
+  for (int i = 0; i < 100 && !probe.released; i++) {
+    io.run_for(std::chrono::milliseconds(10));
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if (!probe.released) {
+    // The kernel may still write to the channel.
+    relay.release();
+    return false;
+  }
+  return probe.received == 1;
+}
+
+// Arms the receive of the channel. Its fds and handler must be set and stay valid until URING_RELEASED.
+void UringRelay::start(UringChannel &channel) {
+  channel.stopped = false;
+  if (channel.segments.empty()) {
+    channel.segments.resize(URING_CHANNEL_BUFFERS);
+  }
+  this->receive(channel);
+  if (!this->reaping) {
+    this->submit();
+  }
+}
+
+// Stops relaying the channel. Operations in flight complete once the caller has shut its sockets down, and
+// URING_RELEASED is reported after the last one, or right away when none is in flight. The handler may be running
+// when it is reported, so the channel must outlive the current handler.
+void UringRelay::stop(UringChannel &channel) {
+  if (channel.stopped) {
+    return;
+  }
+  channel.stopped = true;
+  this->starved.erase(std::remove(this->starved.begin(), this->starved.end(), &channel), this->starved.end());
+  if (!channel.sending) {
+    this->release_segments(channel);
+  }
+  // Queued entries refer to the sockets by descriptor, which the caller is about to close.
+  this->submit();
+  this->complete(channel);
+}
+
+// Maps the submission and completion queues, which share one mapping, and the submission queue entries.
+bool UringRelay::map_rings(const struct io_uring_params &params) {
+  this->submission_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+    params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+  this->submission_ring = mmap(nullptr, this->submission_ring_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+  if (this->submission_ring == MAP_FAILED) {
+    return false;
+  }
+  this->entries_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *entries = mmap(nullptr, this->entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+    this->ring_fd, IORING_OFF_SQES);
+  if (entries == MAP_FAILED) {
+    return false;
+  }
+  this->entries = static_cast<struct io_uring_sqe*>(entries);
+  char *submission = static_cast<char*>(this->submission_ring);
+  this->submission_head = reinterpret_cast<unsigned*>(submission + params.sq_off.head);
+  this->submission_tail = reinterpret_cast<unsigned*>(submission + params.sq_off.tail);
+  this->submission_flags = reinterpret_cast<unsigned*>(submission + params.sq_off.flags);
+  this->submission_mask = *reinterpret_cast<unsigned*>(submission + params.sq_off.ring_mask);
+  this->submission_entries = params.sq_entries;
+  // Entries are always submitted in order, so each slot of the array points at the entry of the same index.
+  unsigned *array = reinterpret_cast<unsigned*>(submission + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++) {
+    array[i] = i;
+  }
+  this->local_tail = *this->submission_tail;
+  this->submitted_tail = this->local_tail;
+  // The completion queue shares the mapping of the submission queue.
+  char *completion = submission;
+  this->completion_head = reinterpret_cast<unsigned*>(completion + params.cq_off.head);
+  this->completion_tail = reinterpret_cast<unsigned*>(completion + params.cq_off.tail);
+  this->completion_mask = *reinterpret_cast<unsigned*>(completion + params.cq_off.ring_mask);
+  this->completions = reinterpret_cast<struct io_uring_cqe*>(completion + params.cq_off.cqes);
+  return true;
+}
+
+// Hands every receive buffer to the kernel through a buffer ring, from which receives pick a buffer only once data
+// has arrived, so idle tunnels hold no buffers.
+bool UringRelay::register_buffers() {
+  void *ring = mmap(nullptr, URING_BUFFER_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  this->buffer_ring = static_cast<struct io_uring_buf_ring*>(ring);
+  void *buffers = mmap(nullptr, (size_t) URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) {
+    return false;
+  }
+  this->buffers = static_cast<char*>(buffers);
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = reinterpret_cast<uint64_t>(ring);
+  registration.ring_entries = URING_BUFFER_COUNT;
+  registration.bgid = URING_BUFFER_GROUP;
+  if (register_ring(this->ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+    return false;
+  }
+  for (uint16_t buffer = 0; buffer < URING_BUFFER_COUNT; buffer++) {
+    this->recycle(buffer);
+  }
+  return true;
+}
+
+// Returns a cleared submission queue entry, submitting the queued ones first when the queue is full.
+struct io_uring_sqe *UringRelay::next_entry() {
+  if (this->local_tail - load_acquire(this->submission_head) >= this->submission_entries) {
+    this->submit();
+  }
+  struct io_uring_sqe *entry = &this->entries[this->local_tail & this->submission_mask];
+  memset(entry, 0, sizeof(*entry));
+  this->local_tail++;
+  return entry;
+}
+
+void UringRelay::submit() {
+  unsigned count = this->local_tail - this->submitted_tail;
+  if (count == 0) {
+    return;
+  }
+  store_release(this->submission_tail, this->local_tail);
+  while (count > 0) {
+    int submitted = enter(this->ring_fd, count, 0, 0);
+    if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      // Only fails on invalid arguments, the entries of a failed submission are still completed with an error.
+      break;
+    }
+    if (submitted < 0) {
+      // Waits for completions to be reaped before retrying.
+      enter(this->ring_fd, 0, 0, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+    count -= submitted;
+  }
+  this->submitted_tail = this->local_tail;
+}
+
+void UringRelay::wait() {
+  this->descriptor.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+    boost::bind(&UringRelay::handle_ready, this, boost::asio::placeholders::error));
+}
+
+void UringRelay::handle_ready(const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+  this->reap();
+  this->wait();
+}
+
+// Handles every completion, then submits the operations they queued at once.
+void UringRelay::reap() {
+  this->reaping = true;
+  this->returned = false;
+  while (true) {
+    unsigned head = *this->completion_head;
+    unsigned tail = load_acquire(this->completion_tail);
+    if (head == tail) {
+      if (!(load_acquire(this->submission_flags) & IORING_SQ_CQ_OVERFLOW)) {
+        break;
+      }
+      // Moves the completions that did not fit into the ring.
+      enter(this->ring_fd, 0, 0, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+    for (; head != tail; head++) {
+      const struct io_uring_cqe &completion = this->completions[head & this->completion_mask];
+      uint64_t data = completion.user_data;
+      int result = completion.res;
+      unsigned flags = completion.flags;
+      store_release(this->completion_head, head + 1);
+      this->dispatch(data, result, flags);
+    }
+  }
+  // Channels that ran out of buffers receive again once sent buffers have been returned.
+  if (this->returned) {
+    std::vector<UringChannel*> starved;
+    starved.swap(this->starved);
+    for (UringChannel *channel : starved) {
+      this->resume_receive(*channel);
+    }
+  }
+  this->reaping = false;
+  this->submit();
+}
+
+void UringRelay::dispatch(uint64_t data, int result, unsigned flags) {
+  UringChannel &channel = *reinterpret_cast<UringChannel*>(data & ~(uint64_t) OPERATION_MASK);
+  switch (data & OPERATION_MASK) {
+    case RECEIVE_OPERATION:
+      this->handle_receive(channel, result, flags);
+      break;
+    case SEND_OPERATION:
+      this->handle_send(channel, result);
+      break;
+  }
+}
+
+// A channel holding buffers may only take more while the ring has more than the reserve left. Channels armed at once
+// may each take one buffer of the reserve.
+bool UringRelay::may_receive(const UringChannel &channel) const {
+  return channel.queued < URING_CHANNEL_BUFFERS && (channel.queued == 0 || this->free_buffers > URING_RESERVED_BUFFERS);
+}
+
+// The receive is single-shot. A multishot receive would be refilled by the kernel whenever the shard thread makes a
+// system call, before its completions are handled, so a single channel could take every buffer of the ring.
+void UringRelay::receive(UringChannel &channel) {
+  struct io_uring_sqe *entry = this->next_entry();
+  entry->opcode = IORING_OP_RECV;
+  entry->fd = channel.read_fd;
+  entry->flags = IOSQE_BUFFER_SELECT;
+  entry->buf_group = URING_BUFFER_GROUP;
+  entry->user_data = user_data(channel, RECEIVE_OPERATION);
+  channel.receiving = true;
+  channel.operations++;
+}
+
+// Sends the queued buffers with a single sendmsg, picking up after the part of the first one already sent.
+void UringRelay::send(UringChannel &channel) {
+  size_t count = std::min(channel.queued, (size_t) URING_MAX_IOVECS);
+  for (size_t i = 0; i < count; i++) {
+    const UringChannel::Segment &segment = channel.segments[(channel.first + i) % channel.segments.size()];
+    size_t offset = i == 0 ? channel.sent_offset : 0;
+    channel.iovecs[i].iov_base = this->buffers + (size_t) segment.buffer * URING_BUFFER_SIZE + offset;
+    channel.iovecs[i].iov_len = segment.length - offset;
+  }
+  memset(&channel.message, 0, sizeof(channel.message));
+  channel.message.msg_iov = channel.iovecs;
+  channel.message.msg_iovlen = count;
+  struct io_uring_sqe *entry = this->next_entry();
+  entry->opcode = IORING_OP_SENDMSG;
+  entry->fd = channel.write_fd;
+  entry->addr = reinterpret_cast<uint64_t>(&channel.message);
+  entry->len = 1;
+  entry->msg_flags = MSG_NOSIGNAL;
+  entry->user_data = user_data(channel, SEND_OPERATION);
+  channel.sending = true;
+  channel.operations++;
+}
+
+// Receives again while the channel is within its budget.
+void UringRelay::resume_receive(UringChannel &channel) {
+  if (!channel.receiving && !channel.ended && !channel.stopped && this->may_receive(channel)) {
+    this->receive(channel);
+  }
+}
+
+// The receive has ended with a chunk, at the end of the stream or on an error, or when the buffer ring was empty. After
+// a chunk it is armed again while the channel is within its budget, and otherwise once the channel has sent buffers.
+// After finding the ring empty, it is armed again once buffers have been returned.
+void UringRelay::handle_receive(UringChannel &channel, int result, unsigned flags) {
+  channel.receiving = false;
+  channel.operations--;
+  if (result > 0) {
+    uint16_t buffer = flags >> IORING_CQE_BUFFER_SHIFT;
+    this->free_buffers--;
+    if (channel.stopped || channel.ended) {
+      this->recycle(buffer);
+    } else {
+      channel.segments[(channel.first + channel.queued) % channel.segments.size()] = {buffer, (uint32_t) result};
+      channel.queued++;
+      channel.handle(channel, URING_RECEIVED, result);
+      if (!channel.sending && !channel.stopped) {
+        this->send(channel);
+      }
+    }
+    this->resume_receive(channel);
+  } else if (result == -ENOBUFS) {
+    if (!channel.stopped) {
+      this->starved.push_back(&channel);
+    }
+  } else {
+    channel.ended = true;
+  }
+  if (channel.ended && channel.queued == 0 && !channel.sending && !channel.closed && !channel.stopped) {
+    channel.closed = true;
+    channel.handle(channel, URING_CLOSED, 0);
+  }
+  this->complete(channel);
+}
+
+// Returns the buffers that were sent, sends the rest, and resumes receiving once the channel is within its budget.
+void UringRelay::handle_send(UringChannel &channel, int result) {
+  channel.sending = false;
+  channel.operations--;
+  if (channel.stopped) {
+    this->release_segments(channel);
+    this->complete(channel);
+    return;
+  }
+  if (result < 0) {
+    channel.ended = true;
+    this->release_segments(channel);
+  }
+  size_t sent = std::max(result, 0);
+  for (size_t remaining = sent; remaining > 0;) {
+    UringChannel::Segment &segment = channel.segments[channel.first];
+    size_t length = segment.length - channel.sent_offset;
+    if (remaining < length) {
+      channel.sent_offset += remaining;
+      break;
+    }
+    remaining -= length;
+    this->recycle(segment.buffer);
+    channel.first = (channel.first + 1) % channel.segments.size();
+    channel.queued--;
+    channel.sent_offset = 0;
+  }
+  if (sent > 0) {
+    channel.handle(channel, URING_SENT, sent);
+  }
+  if (channel.stopped) {
+    this->complete(channel);
+    return;
+  }
+  if (channel.queued > 0) {
+    this->send(channel);
+  } else if (channel.ended && !channel.closed) {
+    channel.closed = true;
+    channel.handle(channel, URING_CLOSED, 0);
+  }
+  this->resume_receive(channel);
+  this->complete(channel);
+}
+
+void UringRelay::recycle(uint16_t buffer) {
+  // The entries start at the beginning of the ring. The header declares them after an empty struct, which takes a
+  // byte in C++ and moves them.
+  struct io_uring_buf &entry = reinterpret_cast<struct io_uring_buf*>(this->buffer_ring)[this->buffer_tail
+    & (URING_BUFFER_COUNT - 1)];
+  entry.addr = reinterpret_cast<uint64_t>(this->buffers + (size_t) buffer * URING_BUFFER_SIZE);
+  entry.len = URING_BUFFER_SIZE;
+  entry.bid = buffer;
+  this->buffer_tail++;
+  store_release(&this->buffer_ring->tail, this->buffer_tail);
+  this->free_buffers++;
+  this->returned = true;
+}
+
+void UringRelay::release_segments(UringChannel &channel) {
+  for (; channel.queued > 0; channel.queued--) {
+    this->recycle(channel.segments[channel.first].buffer);
+    channel.first = (channel.first + 1) % channel.segments.size();
+  }
+  channel.sent_offset = 0;
+}
+
+// Reports the channel as released once it is stopped and its last operation completed.
+void UringRelay::complete(UringChannel &channel) {
+  if (channel.stopped && channel.operations == 0 && !channel.released) {
+    channel.released = true;
+    channel.handle(channel, URING_RELEASED, 0);
+  }
+}
+
+#else
+
+UringRelay::UringRelay(boost::asio::io_context &io, int ring_fd) : ring_fd(ring_fd), descriptor(io) {
+}
+
+UringRelay::~UringRelay() {
+}
+
+std::unique_ptr<UringRelay> UringRelay::create(boost::asio::io_context&) {
+  return nullptr;
+}
+
+bool UringRelay::is_supported() {
+  return false;
+}
+
+void UringRelay::start(UringChannel&) {
+}
+
+void UringRelay::stop(UringChannel&) {
+}
+
+#endif
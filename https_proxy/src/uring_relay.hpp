@@ -0,0 +1,132 @@
+#ifndef HTTPS_PROXY_URING_RELAY_HPP_
+#define HTTPS_PROXY_URING_RELAY_HPP_
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#define URING_QUEUE_DEPTH 1024
+#define URING_BUFFER_SIZE 16384
+// Number of receive buffers shared by the tunnels of a shard, a power of two.
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_GROUP 0
+// Received buffers a channel may hold before it stops receiving until they are sent.
+#define URING_CHANNEL_BUFFERS 16
+// Buffers of the ring kept for channels holding none. Once only these are left, channels holding buffers receive no
+// more until they have sent them, so tunnels whose peers stop reading cannot starve the others.
+#define URING_RESERVED_BUFFERS (URING_BUFFER_COUNT / 4)
+#define URING_MAX_IOVECS 16
+
+// URING_RECEIVED and URING_SENT carry the number of bytes. URING_CLOSED is
+// reported once the channel has nothing left to relay, after the end of its
+// stream or an error, and URING_RELEASED once the channel has been stopped and
+// the kernel no longer references it. URING_RELEASED is the last event.
+enum UringEvent {URING_RECEIVED = 0, URING_SENT = 1, URING_CLOSED = 2, URING_RELEASED = 3};
+
+struct UringChannel;
+typedef void (*UringHandler)(UringChannel&, UringEvent, size_t);
+
+// One direction of a tunnel relayed through the ring of its shard.
+struct UringChannel {
+  struct Segment {
+    uint16_t buffer;
+    uint32_t length;
+  };
+
+  int read_fd = -1;
+  int write_fd = -1;
+  UringHandler handle = nullptr;
+  void *owner = nullptr;
+
+  // Received buffers waiting to be sent, in a circular queue of URING_CHANNEL_BUFFERS, and how much of the first one
+  // was sent.
+  std::vector<Segment> segments;
+  size_t first = 0;
+  size_t queued = 0;
+  size_t sent_offset = 0;
+  struct msghdr message;
+  struct iovec iovecs[URING_MAX_IOVECS];
+
+  int operations = 0;
+  bool receiving = false;
+  bool sending = false;
+  bool ended = false;
+  bool closed = false;
+  bool stopped = false;
+  bool released = false;
+};
+
+// Relays tunnels through an io_uring instance owned by a shard, set up with the
+// raw system calls. Each channel keeps one receive armed that picks a buffer
+// from a ring of buffers registered with the kernel, so receiving takes no
+// system call per chunk. Receives are single-shot and each takes one buffer, so
+// a channel is only armed while it is within its budget of buffers. The
+// buffers received in one pass over the completion queue are sent with one
+// sendmsg per channel, and every request queued during the pass is submitted
+// with a single io_uring_enter. The ring signals completions through its file
+// descriptor, which the shard waits on like any other socket, so everything
+// runs on the shard thread.
+class UringRelay {
+  public:
+    ~UringRelay();
+    static std::unique_ptr<UringRelay> create(boost::asio::io_context&);
+    static bool is_supported();
+    void start(UringChannel&);
+    void stop(UringChannel&);
+
+  private:
+    UringRelay(boost::asio::io_context&, int);
+    int ring_fd;
+    boost::asio::posix::stream_descriptor descriptor;
+
+    void *submission_ring;
+    size_t submission_ring_size;
+    struct io_uring_sqe *entries;
+    size_t entries_size;
+    unsigned *submission_head;
+    unsigned *submission_tail;
+    unsigned *submission_flags;
+    unsigned submission_mask;
+    unsigned submission_entries;
+    unsigned local_tail;
+    unsigned submitted_tail;
+    unsigned *completion_head;
+    unsigned *completion_tail;
+    unsigned completion_mask;
+    struct io_uring_cqe *completions;
+
+    struct io_uring_buf_ring *buffer_ring;
+    char *buffers;
+    uint16_t buffer_tail;
+    size_t free_buffers;
+    bool returned;
+
+    std::vector<UringChannel*> starved;
+    bool reaping;
+
+    bool map_rings(const struct io_uring_params&);
+    bool register_buffers();
+    struct io_uring_sqe *next_entry();
+    void submit();
+    void wait();
+    void handle_ready(const boost::system::error_code&);
+    void reap();
+    void dispatch(uint64_t, int, unsigned);
+    bool may_receive(const UringChannel&) const;
+    void receive(UringChannel&);
+    void send(UringChannel&);
+    void resume_receive(UringChannel&);
+    void handle_receive(UringChannel&, int, unsigned);
+    void handle_send(UringChannel&, int);
+    void recycle(uint16_t);
+    void release_segments(UringChannel&);
+    void complete(UringChannel&);
+};
+
+#endif  // HTTPS_PROXY_URING_RELAY_HPP_
@@ -0,0 +1,52 @@
+#include "verdict_cache.hpp"
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+VerdictCache::VerdictCache() : hits(0), misses(0) {
+}
+
+bool VerdictCache::lookup(const std::string &hostname, bool &blocked) {
+  size_t hash = std::hash<std::string>()(hostname);
+  Shard &shard = this->shards[hash % VERDICT_CACHE_SHARDS];
+  {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    Slot &slot = shard.slots[(hash / VERDICT_CACHE_SHARDS) % VERDICT_CACHE_SLOTS];
+    if (slot.valid && slot.hash == hash && slot.hostname == hostname) {
+      blocked = slot.blocked;
+      this->hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  this->misses.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void VerdictCache::store(const std::string &hostname, bool blocked) {
+  size_t hash = std::hash<std::string>()(hostname);
+  Shard &shard = this->shards[hash % VERDICT_CACHE_SHARDS];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  Slot &slot = shard.slots[(hash / VERDICT_CACHE_SHARDS) % VERDICT_CACHE_SLOTS];
+  slot.hash = hash;
+  slot.valid = true;
+  slot.blocked = blocked;
+  slot.hostname.assign(hostname);
+}
+
+void VerdictCache::clear() {
+  for (Shard &shard : this->shards) {
+    std::lock_guard<std::mutex> guard(shard.lock);
+    for (Slot &slot : shard.slots) {
+      slot.valid = false;
+    }
+  }
+}
+
+uint64_t VerdictCache::hit_count() {
+  return this->hits.load(std::memory_order_relaxed);
+}
+
+uint64_t VerdictCache::miss_count() {
+  return this->misses.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,42 @@
+#ifndef HTTPS_PROXY_VERDICT_CACHE_HPP_
+#define HTTPS_PROXY_VERDICT_CACHE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#define VERDICT_CACHE_SHARDS 64
+#define VERDICT_CACHE_SLOTS 256
+
+// Bounded cache of recent blacklist verdicts keyed by hostname. The cache is
+// split into independently locked shards, and each shard is a direct-mapped
+// table in which a new hostname replaces whichever entry occupied its slot.
+class VerdictCache {
+  public:
+    VerdictCache();
+    bool lookup(const std::string&, bool&);
+    void store(const std::string&, bool);
+    void clear();
+    uint64_t hit_count();
+    uint64_t miss_count();
+
+  private:
+    struct Slot {
+      size_t hash = 0;
+      bool valid = false;
+      bool blocked = false;
+      std::string hostname;
+    };
+
+    struct Shard {
+      std::mutex lock;
+      Slot slots[VERDICT_CACHE_SLOTS];
+    };
+
+    Shard shards[VERDICT_CACHE_SHARDS];
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
+
+#endif  // HTTPS_PROXY_VERDICT_CACHE_HPP_
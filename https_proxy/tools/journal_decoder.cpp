@@ -0,0 +1,185 @@
+// Decodes the telemetry journal files the proxy writes with --journal. Prints the tunnels of all the given files in
+// the order they ended, in the format of the telemetry lines the proxy prints without a journal, followed by summary
+// statistics: traffic, percentiles of the tunnel duration and of the DNS and connect latencies, close reasons and the
+// hostnames with the most traffic.
+// Usage: ./journal_decoder [--summary] FILE...
+//   e.g. ./journal_decoder telemetry.journal.*
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "journal.hpp"
+
+#define TOP_HOSTNAMES 10
+
+static const char *const CLOSE_REASONS[] = {"unknown", "client", "server", "write failed", "idle timeout",
+  "lifetime expired", "request completed"};
+
+struct Tunnel {
+  std::string hostname;
+  TunnelRecord record;
+};
+
+struct HostnameTotals {
+  uint64_t tunnels = 0;
+  uint64_t bytes = 0;
+};
+
+// Appends the tunnels of the file. Returns false if it is not a journal, or if a record is cut short or of an
+// unknown type, in which case the tunnels before it are kept.
+static bool read_journal(const std::string &path, std::vector<Tunnel> &tunnels) {
+  std::ifstream file(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  JournalHeader header;
+  if (!file.is_open() || data.size() < sizeof(header)) {
+    fprintf(stderr, "%s: not a telemetry journal\n", path.c_str());
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 || header.version != JOURNAL_VERSION
+    || header.record_size != JOURNAL_RECORD_SIZE) {
+    fprintf(stderr, "%s: not a telemetry journal of version %d\n", path.c_str(), JOURNAL_VERSION);
+    return false;
+  }
+  std::unordered_map<uint32_t, std::string> hostnames;
+  for (size_t offset = JOURNAL_RECORD_SIZE; offset + JOURNAL_RECORD_SIZE <= data.size(); ) {
+    uint16_t type;
+    memcpy(&type, data.data() + offset, sizeof(type));
+    if (type == JOURNAL_END) {
+      break;
+    }
+    if (type == JOURNAL_HOSTNAME) {
+      HostnameRecord definition;
+      memcpy(&definition, data.data() + offset, sizeof(definition));
+      size_t continued = definition.length > JOURNAL_HOSTNAME_LENGTH ? definition.length - JOURNAL_HOSTNAME_LENGTH : 0;
+      if (offset + JOURNAL_RECORD_SIZE + continued > data.size()) {
+        fprintf(stderr, "%s: hostname cut short at offset %zu\n", path.c_str(), offset);
+        return false;
+      }
+      std::string &name = hostnames[definition.hostname];
+      name.assign(definition.name, std::min<size_t>(definition.length, JOURNAL_HOSTNAME_LENGTH));
+      name.append(data, offset + JOURNAL_RECORD_SIZE, continued);
+      offset += JOURNAL_RECORD_SIZE + (continued + JOURNAL_RECORD_SIZE - 1) / JOURNAL_RECORD_SIZE * JOURNAL_RECORD_SIZE;
+    } else if (type == JOURNAL_TUNNEL) {
+      Tunnel tunnel;
+      memcpy(&tunnel.record, data.data() + offset, sizeof(tunnel.record));
+      std::unordered_map<uint32_t, std::string>::const_iterator hostname = hostnames.find(tunnel.record.hostname);
+      tunnel.hostname = hostname == hostnames.end() ? "?" : hostname->second;
+      tunnels.push_back(std::move(tunnel));
+      offset += JOURNAL_RECORD_SIZE;
+    } else {
+      fprintf(stderr, "%s: unknown record type %d at offset %zu\n", path.c_str(), type, offset);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Milliseconds the tunnel was open, truncated as the proxy does.
+static int64_t duration(const TunnelRecord &record) {
+  return (record.end_time - record.start_time) / 1000000;
+}
+
+static void print_tunnel(const Tunnel &tunnel) {
+  printf("Hostname: %s, Size: %" PRIu64 " bytes, Sent: %" PRIu64 " bytes, Time: %f sec, Connect: %f sec "
+    "(%d attempts)\n", tunnel.hostname.c_str(), tunnel.record.downstream_bytes, tunnel.record.upstream_bytes,
+    duration(tunnel.record)/(1000.0), (tunnel.record.connect_latency / 1000)/(1000.0), tunnel.record.connect_attempts);
+}
+
+// Prints the nearest-rank percentiles of the values, which are sorted in place.
+static void print_percentiles(const char *name, std::vector<double> &values) {
+  std::sort(values.begin(), values.end());
+  printf("%-22s", name);
+  for (double percentile : {0.5, 0.9, 0.99}) {
+    size_t rank = std::max<size_t>(1, static_cast<size_t>(percentile * values.size() + 0.999999));
+    printf(" p%-2g %10.3f", 100 * percentile, values[rank - 1]);
+  }
+  printf(" max %10.3f\n", values.back());
+}
+
+static void print_summary(const std::vector<Tunnel> &tunnels) {
+  uint64_t upstream = 0;
+  uint64_t downstream = 0;
+  uint64_t retried = 0;
+  uint64_t reasons[sizeof(CLOSE_REASONS) / sizeof(CLOSE_REASONS[0])] = {0};
+  std::vector<double> durations;
+  std::vector<double> resolve_latencies;
+  std::vector<double> connect_latencies;
+  std::unordered_map<std::string, HostnameTotals> hostnames;
+  for (const Tunnel &tunnel : tunnels) {
+    const TunnelRecord &record = tunnel.record;
+    upstream += record.upstream_bytes;
+    downstream += record.downstream_bytes;
+    retried += record.connect_attempts > 1;
+    reasons[record.close_reason < std::size(reasons) ? record.close_reason : NOT_CLOSED]++;
+    durations.push_back(duration(record) / 1000.0);
+    resolve_latencies.push_back(record.resolve_latency / 1000.0);
+    connect_latencies.push_back(record.connect_latency / 1000.0);
+    HostnameTotals &totals = hostnames[tunnel.hostname];
+    totals.tunnels++;
+    totals.bytes += record.upstream_bytes + record.downstream_bytes;
+  }
+  printf("\nTunnels: %zu, Sent: %" PRIu64 " bytes, Received: %" PRIu64 " bytes, Retried connects: %" PRIu64 "\n",
+    tunnels.size(), upstream, downstream, retried);
+  if (tunnels.empty()) {
+    return;
+  }
+  print_percentiles("Duration (sec)", durations);
+  print_percentiles("DNS lookup (ms)", resolve_latencies);
+  print_percentiles("Connect (ms)", connect_latencies);
+  printf("Close reasons:");
+  for (size_t reason = 0; reason < std::size(reasons); reason++) {
+    if (reasons[reason] > 0) {
+      printf(" %s %" PRIu64, CLOSE_REASONS[reason], reasons[reason]);
+    }
+  }
+  std::vector<std::pair<std::string, HostnameTotals>> ranked(hostnames.begin(), hostnames.end());
+  std::sort(ranked.begin(), ranked.end(), [](const std::pair<std::string, HostnameTotals> &left,
+    const std::pair<std::string, HostnameTotals> &right) {
+    return left.second.bytes != right.second.bytes ? left.second.bytes > right.second.bytes : left.first < right.first;
+  });
+  printf("\n%-40s %10s %16s\n", "Top hostnames", "tunnels", "bytes");
+  for (size_t i = 0; i < ranked.size() && i < TOP_HOSTNAMES; i++) {
+    printf("%-40s %10" PRIu64 " %16" PRIu64 "\n", ranked[i].first.c_str(), ranked[i].second.tunnels,
+      ranked[i].second.bytes);
+  }
+}
+
+int main(int argc, char * argv[]) {
+  bool summary_only = false;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "--summary") {
+      summary_only = true;
+    } else {
+      paths.push_back(argument);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "Usage: ./journal_decoder [--summary] FILE...\n");
+    return 1;
+  }
+  bool complete = true;
+  std::vector<Tunnel> tunnels;
+  for (const std::string &path : paths) {
+    complete = read_journal(path, tunnels) && complete;
+  }
+  std::stable_sort(tunnels.begin(), tunnels.end(), [](const Tunnel &left, const Tunnel &right) {
+    return left.record.end_time < right.record.end_time;
+  });
+  if (!summary_only) {
+    for (const Tunnel &tunnel : tunnels) {
+      print_tunnel(tunnel);
+    }
+  }
+  print_summary(tunnels);
+  return complete ? 0 : 2;
+}